@@ -201,7 +201,7 @@ static int callback_static_file_uncompressed (const struct _u_request * request,
           y_log_message(Y_LOG_LEVEL_WARNING, "Static File Server - Unknown mime type for extension %s", get_filename_ext(file_requested));
         }
         u_map_put(response->map_header, "Content-Type", content_type);
-        u_map_copy_into(response->map_header, &((struct _u_compressed_inmemory_website_config *)user_data)->map_header);
+        u_map_merge(response->map_header, &((struct _u_compressed_inmemory_website_config *)user_data)->map_header, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW);
 
         if (ulfius_set_stream_response(response, 200, callback_static_file_uncompressed_stream, callback_static_file_uncompressed_stream_free, length, CHUNK, f) != U_OK) {
           y_log_message(Y_LOG_LEVEL_ERROR, "Static File Server - Error ulfius_set_stream_response");
@@ -352,7 +352,7 @@ int callback_static_compressed_inmemory_website (const struct _u_request * reque
               content_type = u_map_get(&config->mime_types, "*");
             }
             u_map_put(response->map_header, "Content-Type", content_type);
-            u_map_copy_into(response->map_header, &config->map_header);
+            u_map_merge(response->map_header, &config->map_header, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW);
           } else if (compress_mode == U_COMPRESS_DEFL && config->allow_cache_compressed && u_map_has_key(&config->deflate_files, file_requested)) {
             ulfius_set_binary_body_response(response, 200, u_map_get(&config->deflate_files, file_requested), (size_t)u_map_get_length(&config->deflate_files, file_requested));
             u_map_put(response->map_header, U_CONTENT_HEADER, U_ACCEPT_DEFLATE);
@@ -362,7 +362,7 @@ int callback_static_compressed_inmemory_website (const struct _u_request * reque
               content_type = u_map_get(&config->mime_types, "*");
             }
             u_map_put(response->map_header, "Content-Type", content_type);
-            u_map_copy_into(response->map_header, &config->map_header);
+            u_map_merge(response->map_header, &config->map_header, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW);
           } else {
             file_path = msprintf("%s/%s", ((struct _u_compressed_inmemory_website_config *)user_data)->files_path, file_requested);
             real_path = realpath(file_path, NULL);
@@ -379,7 +379,7 @@ int callback_static_compressed_inmemory_website (const struct _u_request * reque
                     ret = callback_static_file_uncompressed(request, response, user_data);
                   } else {
                     u_map_put(response->map_header, "Content-Type", content_type);
-                    u_map_copy_into(response->map_header, &config->map_header);
+                    u_map_merge(response->map_header, &config->map_header, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW);
 
                     fseek (f, 0, SEEK_END);
                     offset = length = (size_t)ftell (f);
@@ -0,0 +1,248 @@
+/**
+ * 
+ * Ulfius Framework example program
+ * 
+ * This example program compares the webservice throughput
+ * with one thread per connection and with a pool of worker threads
+ * when a large number of keep-alive connections are open
+ * 
+ * Copyright 2022 Nicolas Mora <mail@babelouest.org>
+ * 
+ * License MIT
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ulfius.h>
+
+#include "u_example.h"
+
+#define PORT 7878
+#define PREFIX "/bench"
+#define BUFFER_SIZE 1024
+#define DEFAULT_NB_CONNECTIONS 1000
+#define DEFAULT_DURATION 10
+#define BENCHMARK_REQUEST "GET " PREFIX " HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+struct _bench_connection {
+  int    fd;
+  int    connected;
+  size_t len;
+  char   buffer[BUFFER_SIZE];
+};
+
+/**
+ * Callback function for the benchmark endpoint
+ */
+int callback_bench (const struct _u_request * request, struct _u_response * response, void * user_data) {
+  (void)(request);
+  (void)(user_data);
+  ulfius_set_string_body_response(response, 200, "Hello World!");
+  return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * Returns the number of threads of the current process, -1 if unavailable
+ */
+static long get_nb_threads(void) {
+  FILE * f = fopen("/proc/self/status", "r");
+  char line[256];
+  long nb_threads = -1;
+
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (0 == strncmp(line, "Threads:", 8)) {
+        nb_threads = strtol(line+8, NULL, 10);
+        break;
+      }
+    }
+    fclose(f);
+  }
+  return nb_threads;
+}
+
+static double get_time(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Open a non blocking connection to the webservice
+ */
+static int open_connection(struct _bench_connection * connection) {
+  struct sockaddr_in address;
+
+  memset(connection, 0, sizeof(struct _bench_connection));
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((connection->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    return 0;
+  }
+  fcntl(connection->fd, F_SETFL, fcntl(connection->fd, F_GETFL, 0) | O_NONBLOCK);
+  if (connect(connection->fd, (struct sockaddr *)&address, sizeof(address)) && errno != EINPROGRESS) {
+    close(connection->fd);
+    connection->fd = -1;
+    return 0;
+  }
+  return 1;
+}
+
+static int send_request(struct _bench_connection * connection) {
+  connection->len = 0;
+  return send(connection->fd, BENCHMARK_REQUEST, strlen(BENCHMARK_REQUEST), 0) == (ssize_t)strlen(BENCHMARK_REQUEST);
+}
+
+/**
+ * Read the available response data
+ * Return 1 if the response is complete, 0 if incomplete, -1 on error
+ */
+static int read_response(struct _bench_connection * connection) {
+  ssize_t res = recv(connection->fd, connection->buffer + connection->len, BUFFER_SIZE - connection->len - 1, 0);
+  const char * body, * content_length;
+
+  if (res <= 0) {
+    return (res < 0 && errno == EAGAIN)?0:-1;
+  }
+  connection->len += (size_t)res;
+  connection->buffer[connection->len] = '\0';
+  if ((body = strstr(connection->buffer, "\r\n\r\n")) != NULL && (content_length = o_strcasestr(connection->buffer, "Content-Length:")) != NULL) {
+    body += 4;
+    if ((size_t)(connection->len - (size_t)(body - connection->buffer)) >= strtoul(content_length + 15, NULL, 10)) {
+      return 1;
+    }
+  }
+  return connection->len < BUFFER_SIZE - 1?0:-1;
+}
+
+int main (int argc, char **argv) {
+  struct _u_instance instance;
+  struct _bench_connection * connections;
+  struct pollfd * fds;
+  struct rlimit limit;
+  size_t nb_connections = DEFAULT_NB_CONNECTIONS, nb_open = 0, nb_requests = 0, nb_errors = 0, i;
+  double duration = DEFAULT_DURATION, start, last_sample;
+  long nb_threads, max_threads = 0;
+  int res;
+
+  if (argc < 2 || (0 != o_strcmp(argv[1], "thread") && 0 != o_strcmp(argv[1], "pool"))) {
+    fprintf(stderr, "Usage: %s <thread|pool> [nb_connections] [duration_seconds] [thread_pool_size]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 2) {
+    nb_connections = strtoul(argv[2], NULL, 10);
+  }
+  if (argc > 3) {
+    duration = strtod(argv[3], NULL);
+  }
+
+  // Allow as many file descriptors as possible, each connection uses 2 of them
+  if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < 2*nb_connections + 64) {
+      fprintf(stderr, "Warning: file descriptors limit is %lu, some connections may fail\n", (unsigned long)limit.rlim_cur);
+    }
+  }
+
+  if (ulfius_init_instance(&instance, PORT, NULL, NULL) != U_OK) {
+    fprintf(stderr, "Error ulfius_init_instance, abort\n");
+    return 1;
+  }
+  if (0 == o_strcmp(argv[1], "pool")) {
+    instance.daemon_mode = U_DAEMON_MODE_THREAD_POOL;
+    if (argc > 4) {
+      instance.thread_pool_size = (unsigned int)strtoul(argv[4], NULL, 10);
+    }
+  }
+  ulfius_add_endpoint_by_val(&instance, "GET", PREFIX, NULL, 0, &callback_bench, NULL);
+
+  connections = o_malloc(nb_connections * sizeof(struct _bench_connection));
+  fds = o_malloc(nb_connections * sizeof(struct pollfd));
+  if (connections == NULL || fds == NULL) {
+    fprintf(stderr, "Error allocating connections\n");
+  } else if (ulfius_start_framework(&instance) == U_OK) {
+    for (i=0; i<nb_connections; i++) {
+      if (open_connection(&connections[i])) {
+        nb_open++;
+      } else {
+        nb_errors++;
+      }
+    }
+    start = last_sample = get_time();
+    while (get_time() - start < duration) {
+      for (i=0; i<nb_connections; i++) {
+        fds[i].fd = connections[i].fd;
+        fds[i].events = connections[i].connected?POLLIN:POLLOUT;
+        fds[i].revents = 0;
+      }
+      if (poll(fds, (nfds_t)nb_connections, 100) > 0) {
+        for (i=0; i<nb_connections; i++) {
+          if (fds[i].fd < 0 || !fds[i].revents) {
+            continue;
+          }
+          if (fds[i].revents & (POLLERR|POLLHUP|POLLNVAL)) {
+            res = -1;
+          } else if (!connections[i].connected) {
+            connections[i].connected = 1;
+            res = send_request(&connections[i])?0:-1;
+          } else if ((res = read_response(&connections[i])) == 1) {
+            nb_requests++;
+            res = send_request(&connections[i])?0:-1;
+          }
+          if (res < 0) {
+            close(connections[i].fd);
+            connections[i].fd = -1;
+            nb_open--;
+            nb_errors++;
+          }
+        }
+      }
+      if (get_time() - last_sample >= 1.0) {
+        if ((nb_threads = get_nb_threads()) > max_threads) {
+          max_threads = nb_threads;
+        }
+        last_sample = get_time();
+      }
+    }
+    duration = get_time() - start;
+
+    printf("mode:              %s\n", argv[1]);
+    if (instance.daemon_mode == U_DAEMON_MODE_THREAD_POOL) {
+      printf("thread_pool_size:  %u\n", instance.thread_pool_size);
+    }
+    printf("connections:       %zu requested, %zu still open\n", nb_connections, nb_open);
+    printf("requests:          %zu in %.2f seconds\n", nb_requests, duration);
+    printf("requests/second:   %.0f\n", (double)nb_requests / duration);
+    printf("connection errors: %zu\n", nb_errors);
+    printf("max threads:       %ld\n", max_threads);
+
+    for (i=0; i<nb_connections; i++) {
+      if (connections[i].fd >= 0) {
+        close(connections[i].fd);
+      }
+    }
+    ulfius_stop_framework(&instance);
+  } else {
+    fprintf(stderr, "Error starting framework\n");
+  }
+  o_free(connections);
+  o_free(fds);
+  ulfius_clean_instance(&instance);
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+/**
+ *
+ * Ulfius Framework example program
+ *
+ * This example program measures the cost of the struct _u_map operations
+ * in nanoseconds and allocations per operation, for maps of increasing sizes
+ *
+ * Copyright 2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * License MIT
+ *
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ulfius.h>
+
+#define DEFAULT_NB_OPERATIONS 1000000
+#define KEY_SIZE 64
+#define VALUE_SIZE 128
+
+/**
+ * Header names found in most requests, the keys after them are custom headers
+ */
+static const char * common_headers[] = {
+  "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Connection",
+  "Cookie", "Referer", "Cache-Control", "Content-Type", "Content-Length", "Authorization",
+  "Origin", "If-None-Match", "If-Modified-Since", "Upgrade-Insecure-Requests", "Sec-Fetch-Dest",
+  "Sec-Fetch-Mode", "Sec-Fetch-Site", "Sec-Fetch-User", "DNT", "Pragma", "X-Forwarded-For",
+  "X-Forwarded-Proto", "X-Requested-With", "X-Request-Id", "Forwarded", "Via", NULL
+};
+
+static size_t nb_allocs = 0;
+
+static void * malloc_count(size_t size) {
+  nb_allocs++;
+  return malloc(size);
+}
+
+static void * realloc_count(void * ptr, size_t size) {
+  nb_allocs++;
+  return realloc(ptr, size);
+}
+
+static double get_time(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000000000.0 + (double)ts.tv_nsec;
+}
+
+/**
+ * Measure of one operation, the time and the allocations are counted between
+ * measure_start and measure_stop only, so the setup of each round isn't counted
+ */
+struct _measure {
+  double duration;
+  size_t allocs;
+  size_t operations;
+  double start;
+  size_t start_allocs;
+};
+
+static void measure_start(struct _measure * measure) {
+  measure->start_allocs = nb_allocs;
+  measure->start = get_time();
+}
+
+static void measure_stop(struct _measure * measure, size_t operations) {
+  measure->duration += get_time() - measure->start;
+  measure->allocs += nb_allocs - measure->start_allocs;
+  measure->operations += operations;
+}
+
+static void print_measure(const char * name, size_t size, struct _measure * measure) {
+  printf("%-10s %6zu %12.1f %12.3f\n", name, size, measure->duration/(double)measure->operations, (double)measure->allocs/(double)measure->operations);
+}
+
+/**
+ * Build size keys with the common header names first, the same keys in lowercase, and their values
+ */
+static void build_keys(size_t size, char (* keys)[KEY_SIZE], char (* keys_lower)[KEY_SIZE], char (* values)[VALUE_SIZE]) {
+  size_t i, j, nb_common;
+
+  for (nb_common=0; common_headers[nb_common]!=NULL; nb_common++);
+  for (i=0; i<size; i++) {
+    if (i < nb_common) {
+      snprintf(keys[i], KEY_SIZE, "%s", common_headers[i]);
+    } else {
+      snprintf(keys[i], KEY_SIZE, "X-Custom-Header-%zu", i-nb_common);
+    }
+    for (j=0; keys[i][j]; j++) {
+      keys_lower[i][j] = (char)tolower((unsigned char)keys[i][j]);
+    }
+    keys_lower[i][j] = '\0';
+    // Short values mostly, with a few long values like cookies or user agents
+    if (i%8 == 6) {
+      snprintf(values[i], VALUE_SIZE, "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) value %zu", i);
+    } else {
+      snprintf(values[i], VALUE_SIZE, "value-%zu", i);
+    }
+  }
+}
+
+static void fill_map(struct _u_map * map, size_t size, char (* keys)[KEY_SIZE], char (* values)[VALUE_SIZE]) {
+  size_t i;
+
+  for (i=0; i<size; i++) {
+    u_map_put(map, keys[i], values[i]);
+  }
+}
+
+static void benchmark_size(size_t size, size_t nb_operations) {
+  char (* keys)[KEY_SIZE] = malloc(size*KEY_SIZE), (* keys_lower)[KEY_SIZE] = malloc(size*KEY_SIZE), (* values)[VALUE_SIZE] = malloc(size*VALUE_SIZE);
+  struct _u_map map, copy;
+  struct _measure put = {0}, get = {0}, get_case = {0}, remove_key = {0}, copy_into = {0}, enum_keys = {0};
+  size_t rounds = nb_operations/size, round, i, checksum = 0;
+  const char ** enum_result;
+
+  if (keys == NULL || keys_lower == NULL || values == NULL) {
+    fprintf(stderr, "Error allocating keys\n");
+    free(keys);
+    free(keys_lower);
+    free(values);
+    return;
+  }
+  if (!rounds) {
+    rounds = 1;
+  }
+  build_keys(size, keys, keys_lower, values);
+
+  for (round=0; round<rounds; round++) {
+    u_map_init(&map);
+    measure_start(&put);
+    fill_map(&map, size, keys, values);
+    measure_stop(&put, size);
+
+    measure_start(&get);
+    for (i=0; i<size; i++) {
+      checksum += (size_t)u_map_get(&map, keys[i]);
+    }
+    measure_stop(&get, size);
+
+    measure_start(&get_case);
+    for (i=0; i<size; i++) {
+      checksum += (size_t)u_map_get_case(&map, keys_lower[i]);
+    }
+    measure_stop(&get_case, size);
+
+    u_map_init(&copy);
+    measure_start(&copy_into);
+    u_map_copy_into(&copy, &map);
+    measure_stop(&copy_into, size);
+    u_map_clean(&copy);
+
+    // The keys are removed in a different order than they were added
+    measure_start(&remove_key);
+    for (i=0; i<size; i+=2) {
+      u_map_remove_from_key(&map, keys[i]);
+    }
+    for (i=1; i<size; i+=2) {
+      u_map_remove_from_key(&map, keys[i]);
+    }
+    measure_stop(&remove_key, size);
+    u_map_clean(&map);
+
+    // u_map_enum_keys is measured on a map with removed values, then on the same map again
+    u_map_init(&map);
+    fill_map(&map, size, keys, values);
+    for (i=0; i<size; i+=4) {
+      u_map_remove_from_key(&map, keys[i]);
+    }
+    measure_start(&enum_keys);
+    enum_result = u_map_enum_keys(&map);
+    for (i=0; enum_result[i]!=NULL; i++) {
+      checksum += (size_t)enum_result[i][0];
+    }
+    enum_result = u_map_enum_keys(&map);
+    for (i=0; enum_result[i]!=NULL; i++) {
+      checksum += (size_t)enum_result[i][0];
+    }
+    measure_stop(&enum_keys, 2*size);
+    u_map_clean(&map);
+  }
+
+  print_measure("put", size, &put);
+  print_measure("get", size, &get);
+  print_measure("get_case", size, &get_case);
+  print_measure("remove", size, &remove_key);
+  print_measure("copy_into", size, &copy_into);
+  print_measure("enum_keys", size, &enum_keys);
+  if (!checksum) {
+    // Keeps the results of the lookups, so the compiler can't skip them
+    printf("\n");
+  }
+  free(keys);
+  free(keys_lower);
+  free(values);
+}
+
+int main (int argc, char **argv) {
+  size_t sizes[] = {4, 16, 32, 64, 256, 1024, 10000}, nb_operations = DEFAULT_NB_OPERATIONS, i;
+
+  if (argc > 1) {
+    nb_operations = strtoul(argv[1], NULL, 10);
+  }
+  // Count the allocations of the u_map functions, they all use o_malloc and o_realloc
+  o_set_alloc_funcs(&malloc_count, &realloc_count, &free);
+
+  printf("Operations per measure: %zu\n", nb_operations);
+  printf("%-10s %6s %12s %12s\n", "operation", "size", "ns/op", "allocs/op");
+  for (i=0; i<sizeof(sizes)/sizeof(size_t); i++) {
+    benchmark_size(sizes[i], nb_operations);
+  }
+  return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ *
+ * Ulfius Framework example program
+ *
+ * This example program measures the throughput of the utf8 validation
+ * of the request parameters, compared to the scalar validation,
+ * for strings of increasing sizes
+ *
+ * Copyright 2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * License MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ulfius.h>
+
+#define DEFAULT_NB_BYTES 100000000
+
+/**
+ * Validation used by the framework when u_instance.check_utf8 is set,
+ * it's a private function of the library
+ */
+const unsigned char * utf8_check(const char * s_orig, size_t len);
+
+/**
+ * Scalar validation, as it was before the vectorized validation
+ */
+static const unsigned char * utf8_check_scalar(const char * s_orig, size_t len) {
+  const unsigned char * s = (unsigned char *)s_orig;
+  size_t i = 0;
+
+  while (i<len) {
+    if (*s < 0x80) {
+      s++;
+      i++;
+    } else if ((s[0] & 0xe0) == 0xc0) {
+      if ((i+1 >= len) || (s[1] & 0xc0) != 0x80 || (s[0] & 0xfe) == 0xc0) {
+        return s;
+      }
+      s += 2;
+      i += 2;
+    } else if ((s[0] & 0xf0) == 0xe0) {
+      if ((i+2 >= len) || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 ||
+          (s[0] == 0xe0 && (s[1] & 0xe0) == 0x80) || (s[0] == 0xed && (s[1] & 0xe0) == 0xa0)) {
+        return s;
+      }
+      s += 3;
+      i += 3;
+    } else if ((s[0] & 0xf8) == 0xf0) {
+      if ((i+3 >= len) || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80 ||
+          (s[0] == 0xf0 && (s[1] & 0xf0) == 0x80) || (s[0] == 0xf4 && s[1] > 0x8f) || s[0] > 0xf4) {
+        return s;
+      }
+      s += 4;
+      i += 4;
+    } else {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Text repeated to fill the strings, from a header value to a form body
+ */
+static const char * patterns[][2] = {
+  {"ascii", "{\"name\":\"value\",\"list\":[1,2,3],\"text\":\"Lorem ipsum dolor sit amet\"}"},
+  {"json", "{\"nom\":\"Fran\xc3\xa7ois\",\"ville\":\"Montr\xc3\xa9" "al\",\"texte\":\"D\xc3\xa9j\xc3\xa0 vu, na\xc3\xafve\"}"},
+  {"latin", "\xce\x95\xce\xbb\xce\xbb\xce\xb7\xce\xbd\xce\xb9\xce\xba\xce\xac \xd0\xa0\xd1\x83\xd1\x81\xd1\x81\xd0\xba\xd0\xb8\xd0\xb9 "},
+  {"cjk", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe4\xb8\xad\xe6\x96\x87\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4"},
+  {"emoji", "\xf0\x9f\x98\x80\xf0\x9f\x8e\x89 ok \xf0\x9f\x91\x8d"},
+  {NULL, NULL}
+};
+
+static double get_time(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000000000.0 + (double)ts.tv_nsec;
+}
+
+/**
+ * Fill buffer with the pattern, the last character is removed if it's cut
+ */
+static size_t fill_buffer(char * buffer, size_t size, const char * pattern) {
+  size_t pattern_len = o_strlen(pattern), len, start, char_len;
+  unsigned char lead;
+
+  for (len=0; len<size; len++) {
+    buffer[len] = pattern[len%pattern_len];
+  }
+  for (start=len; start && ((unsigned char)buffer[start-1] & 0xc0) == 0x80; start--);
+  if (start && (lead = (unsigned char)buffer[start-1]) >= 0xc0) {
+    char_len = lead>=0xf0?4:(lead>=0xe0?3:2);
+    if (start-1+char_len > len) {
+      len = start-1;
+    }
+  }
+  return len;
+}
+
+/**
+ * Return the throughput in MB/s of the validation of rounds strings of buffer
+ */
+static double measure(const unsigned char * (* check)(const char *, size_t), const char * buffer, size_t len, size_t rounds, size_t * errors) {
+  size_t round;
+  double start = get_time();
+
+  for (round=0; round<rounds; round++) {
+    if (check(buffer, len) != NULL) {
+      (*errors)++;
+    }
+  }
+  return ((double)len * (double)rounds * 1000.0) / (get_time() - start);
+}
+
+int main (int argc, char **argv) {
+  size_t sizes[] = {16, 64, 256, 4096, 65536, 1048576}, nb_bytes = DEFAULT_NB_BYTES, i, j, len, rounds, errors = 0;
+  char * buffer = malloc(1048576);
+  double scalar, current;
+
+  if (argc > 1) {
+    nb_bytes = strtoul(argv[1], NULL, 10);
+  }
+  if (buffer == NULL) {
+    fprintf(stderr, "Error allocating buffer\n");
+    return 1;
+  }
+
+  printf("Bytes per measure: %zu\n", nb_bytes);
+  printf("%-8s %8s %14s %14s %8s\n", "text", "size", "scalar MB/s", "utf8_check MB/s", "speedup");
+  for (i=0; patterns[i][0]!=NULL; i++) {
+    for (j=0; j<sizeof(sizes)/sizeof(size_t); j++) {
+      len = fill_buffer(buffer, sizes[j], patterns[i][1]);
+      rounds = nb_bytes/len;
+      if (!rounds) {
+        rounds = 1;
+      }
+      // Warm up the caches
+      measure(&utf8_check_scalar, buffer, len, 1, &errors);
+      measure(&utf8_check, buffer, len, 1, &errors);
+      scalar = measure(&utf8_check_scalar, buffer, len, rounds, &errors);
+      current = measure(&utf8_check, buffer, len, rounds, &errors);
+      printf("%-8s %8zu %14.1f %15.1f %8.2f\n", patterns[i][0], len, scalar, current, current/scalar);
+    }
+  }
+  if (errors) {
+    fprintf(stderr, "Error, %zu strings weren't validated\n", errors);
+  }
+  free(buffer);
+  return errors?1:0;
+}
@@ -39,7 +39,7 @@ char * print_map(const struct _u_map * map) {
   int len, i;
   if (map != NULL) {
     keys = u_map_enum_keys(map);
-    for (i=0; keys[i] != NULL; i++) {
+    for (i=0; keys != NULL && keys[i] != NULL; i++) {
       value = u_map_get(map, keys[i]);
       len = snprintf(NULL, 0, "key is %s, value is %s", keys[i], value);
       line = o_malloc((size_t)(len+1));
@@ -44,18 +44,415 @@
 #endif // U_WITH_FREERTOS
 
 #include <ulfius.h>
+#ifndef U_DISABLE_GNUTLS
+  #include <gnutls/crypto.h>
+#endif
+
+/** Number of matching endpoints stored on the stack during a match before using the heap **/
+#define U_ROUTER_MATCH_STACK_SIZE 32
+
+/** Maximum number of endpoints in a route match cache entry, results with more endpoints aren't cached **/
+#define U_ROUTE_CACHE_MAX_ENDPOINTS 8
+
+/** Number of entries in a route match cache set **/
+#define U_ROUTE_CACHE_WAYS 4
+
+/** Maximum size of a request body allocated from its Content-Length before its data is received, a larger body grows geometrically **/
+#define U_BODY_PREALLOC_MAX_SIZE (256*1024)
+
+/** Alignment of the buffer and the writes of a file uploaded in the upload directory, required by O_DIRECT **/
+#define U_UPLOAD_FILE_ALIGNMENT 4096
+
+/** Atomic operations used by the routing table, based on gcc and clang builtins **/
+#define U_ATOMIC_LOAD(ptr)             __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define U_ATOMIC_STORE(ptr, value)     __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+#define U_ATOMIC_EXCHANGE(ptr, value)  __atomic_exchange_n((ptr), (value), __ATOMIC_SEQ_CST)
+#define U_ATOMIC_INCREMENT(ptr)        __atomic_add_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define U_ATOMIC_ADD(ptr, value)       __atomic_add_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+#define U_ATOMIC_DECREMENT(ptr)        __atomic_sub_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define U_ATOMIC_TEST_AND_SET(ptr)     __atomic_test_and_set((ptr), __ATOMIC_ACQUIRE)
+#define U_ATOMIC_CLEAR(ptr)            __atomic_clear((ptr), __ATOMIC_RELEASE)
+
+/**
+ * Node of the endpoint routing tree, each node is an url segment
+ */
+struct _u_route_node {
+  char                       * segment;      /* static segment value, NULL for the root node and parametric nodes */
+  size_t                       segment_len;  /* length of segment */
+  size_t                       nb_children;  /* number of static children */
+  struct _u_route_node      ** children;     /* static children, sorted by segment */
+  struct _u_route_node       * param_child;  /* child matching any segment, i.e. ':param' or '@param' */
+  size_t                       nb_endpoints; /* number of endpoints whose url ends on this node */
+  const struct _u_endpoint  ** endpoints;    /* endpoints whose url ends on this node */
+  size_t                       nb_wildcards; /* number of endpoints whose url ends with '*' after this node */
+  const struct _u_endpoint  ** wildcards;    /* endpoints whose url ends with '*' after this node */
+};
+
+/**
+ * Url parameter of an endpoint, i.e. a ':param' or '@param' segment
+ */
+struct _u_route_param {
+  size_t   segment_index; /* index of the url segment holding the parameter value */
+  char   * key;           /* parameter name */
+};
+
+/**
+ * Url parameters of an endpoint
+ * Endpoints with the same parameters at the same positions share the same set
+ */
+struct _u_route_params {
+  size_t                  nb_params; /* number of parameters */
+  struct _u_route_param * params;    /* parameters in url order */
+};
+
+/**
+ * Position of an url segment
+ */
+struct _u_route_segment {
+  size_t offset; /* offset of the segment in the url */
+  size_t len;    /* length of the segment */
+};
+
+/**
+ * Url segments captured while matching an url
+ * Only the first U_ROUTER_MATCH_STACK_SIZE segments are kept
+ */
+struct _u_route_captures {
+  size_t                  nb_segments;                          /* number of segments captured */
+  struct _u_route_segment segments[U_ROUTER_MATCH_STACK_SIZE]; /* segments captured */
+};
+
+/**
+ * Route match cache entry, result of a match for an http method and an url path
+ */
+struct _u_route_cache_entry {
+  size_t                     hash;                                   /* hash of method and url */
+  char                     * method;                                 /* http method, also the allocated buffer holding url */
+  char                     * url;                                    /* url path */
+  unsigned char              referenced;                             /* CLOCK reference bit, set when the entry is used */
+  size_t                     nb_endpoints;                           /* number of matching endpoints */
+  const struct _u_endpoint * endpoints[U_ROUTE_CACHE_MAX_ENDPOINTS]; /* matching endpoints sorted by priority */
+};
+
+/**
+ * Route match cache set, an url can only be stored in the set selected by its hash
+ * The set is locked during a lookup or an update,
+ * if the set is already locked, the lookup is a miss and the result isn't stored
+ */
+struct _u_route_cache_set {
+  char                        lock;                        /* spin lock, never waited for */
+  unsigned char               hand;                        /* CLOCK hand, next entry to check for eviction */
+  struct _u_route_cache_entry entries[U_ROUTE_CACHE_WAYS]; /* entries of the set */
+};
+
+/**
+ * Compiled routing table of an instance
+ * endpoint_list is a copy of the instance endpoints sorted by priority
+ */
+struct _u_router {
+  struct _u_route_node            root;            /* root node of the routing tree */
+  size_t                          nb_endpoints;    /* number of endpoints in endpoint_list */
+  size_t                          nb_body_callbacks; /* number of endpoints with a body_callback */
+  struct _u_endpoint            * endpoint_list;   /* endpoints sorted by priority, then by declaration order */
+  struct _u_route_params        * params;          /* url parameters parsed for each endpoint, empty if shared */
+  const struct _u_route_params ** endpoint_params; /* url parameters set of each endpoint */
+  size_t                          nb_cache_sets;   /* number of sets in the route match cache, 0 if the cache is disabled */
+  struct _u_route_cache_set     * cache_sets;      /* route match cache, emptied when the routing table is replaced */
+  size_t                          holders;         /* number of suspended requests keeping the routing table */
+  size_t                          retire_epoch;    /* epoch when the routing table was replaced */
+  struct _u_router              * next_retired;    /* next routing table in the retired list */
+};
+
+/**
+ * Routing table holder of an instance
+ * A routing table is never modified once published, a new one is compiled and published instead
+ * Readers don't take any lock, they register in the current epoch, then load the routing table
+ * A replaced routing table is retired and free'd when no reader nor holder can use it anymore
+ * Writers are serialized with write_lock
+ */
+struct _u_router_handler {
+  char                   write_lock; /* spin lock held by the writers */
+  struct _u_router     * router;     /* current routing table, NULL if there is no endpoint */
+  size_t                 epoch;      /* current epoch */
+  size_t                 readers[2]; /* number of readers registered in an even or an odd epoch */
+  struct _u_router     * retired;    /* routing tables replaced but maybe still used by a reader */
+  size_t                 cache_hits;   /* number of route match cache hits */
+  size_t                 cache_misses; /* number of route match cache misses */
+};
+
+/** Number of entries allocated by u_map_init, the NULL terminator included **/
+#define U_MAP_INITIAL_CAPACITY 8
+
+/** A u_map with more values has its keys indexed **/
+#define U_MAP_INDEX_THRESHOLD 8
+
+/** u_map_empty releases the arrays of a u_map with a larger capacity **/
+#define U_MAP_MAX_KEPT_CAPACITY 64
+
+/** Keys and values of a u_map with this size or less, the trailing '\0' included, are stored in its slab **/
+#define U_MAP_INLINE_SIZE 32
+
+/** Size of the first block of a u_map slab, each new block is twice as large as the previous one **/
+#define U_MAP_SLAB_FIRST_SIZE 256
+
+/** u_map_empty releases the slab of a u_map with a larger current block **/
+#define U_MAP_MAX_KEPT_SLAB_SIZE 4096
+
+/** The key of a u_map entry is borrowed, it's not free'd with the entry **/
+#define U_MAP_BORROWED_KEY   0x01
+
+/** The value of a u_map entry is borrowed, it's copied before it's modified and not free'd with the entry **/
+#define U_MAP_BORROWED_VALUE 0x02
+
+/** The u_map entry is removed, it's skipped until the map is compacted **/
+#define U_MAP_REMOVED        0x04
+
+/** Value of an empty slot in a u_map hash index **/
+#define U_MAP_SLOT_EMPTY -1
+
+/**
+ * Block of a u_map slab, the short keys and values are stored one after the other in data
+ * A string stored in the slab is never free'd or moved, the blocks are free'd with the map
+ */
+struct _u_map_slab {
+  struct _u_map_slab * next; /* previous block, the current block is first */
+  size_t               size; /* size of data */
+  size_t               used; /* size already used in data */
+  char                 data[]; /* strings of the block */
+};
+
+/**
+ * Slot of a u_map hash index
+ */
+struct _u_map_slot {
+  unsigned int hash;     /* case-insensitive hash of the key */
+  int          position; /* position of the key in the u_map arrays, U_MAP_SLOT_EMPTY if the slot is free */
+};
+
+/**
+ * Open addressing hash index of the keys of a u_map, with linear probing
+ * The keys are hashed case-insensitively, so the same index is used
+ * by the case sensitive and the case insensitive functions
+ */
+struct _u_map_index {
+  size_t             size;    /* number of slots, a power of 2 */
+  struct _u_map_slot slots[]; /* slots of the index */
+};
+
+/** Alignment of the allocations in a memory arena **/
+#define U_ARENA_ALIGNMENT (2*sizeof(void *))
+
+/**
+ * Block of a memory arena, the allocations are stored after the block header
+ */
+struct _u_arena_block {
+  struct _u_arena_block * next; /* next block in the arena */
+  size_t                  size; /* size available for allocations in the block */
+  size_t                  used; /* size already allocated in the block */
+};
+
+/**
+ * Memory arena of a request, allocations are never free'd one by one,
+ * all the blocks are free'd at once when the request is complete
+ * Small allocations are stored one after the other in the current block,
+ * large allocations have their own block
+ */
+struct _u_arena {
+  size_t                  block_size; /* size of the blocks, 0 if each allocation has its own block */
+  size_t                  reserved;   /* size of the first block kept by ulfius_arena_reset, the arena included */
+  struct _u_arena_block * blocks;     /* blocks of the arena, the current block first */
+};
+
+/**
+ * Objects of a request received by the framework, reserved at the beginning of its arena
+ * When the request is complete, the context is reset and kept in the instance pool for the next request
+ */
+struct _u_request_context {
+  struct connection_info_struct   con_info;    /* must be the first member, con_info is given to MHD as the context */
+  struct _u_request               request;     /* request given to the callback functions */
+  struct _u_response              response;    /* response given to the callback functions, initialized when con_info.response is set */
+  struct _u_request_context     * next_pooled; /* next context in the pool shard */
+};
+
+/** Number of shards of the instance pool, each shard has its own lock **/
+#define U_POOL_SHARDS 8
+
+/**
+ * Shard of the instance pool, a list of request contexts ready to be reused
+ */
+struct _u_pool_shard {
+  char                        lock;     /* spin lock protecting the list */
+  struct _u_request_context * contexts; /* request contexts available */
+};
+
+/**
+ * Pool of request contexts of an instance
+ * The shards are picked in turn, so concurrent requests seldom wait for the same lock
+ */
+struct _u_pool {
+  struct _u_pool_shard shards[U_POOL_SHARDS]; /* shards of the pool */
+  size_t               next_shard;            /* counter used to pick the next shard */
+  size_t               retained;              /* number of request contexts in the pool */
+  size_t               hits;                  /* number of requests using a request context from the pool */
+  size_t               misses;                /* number of requests allocating a new request context */
+  size_t               body_reallocs;         /* number of o_realloc of the request bodies buffered in request->binary_body */
+  size_t               body_bytes_copied;     /* number of bytes copied in the request bodies buffered, o_realloc included */
+};
+
+/**
+ * File of a multipart/form-data body written in the upload directory of the instance
+ */
+struct _u_upload_file {
+  int                    fd;          /* file descriptor, -1 when the file is closed */
+  char                 * key;         /* post parameter of the file */
+  char                 * filename;    /* file name sent by the client */
+  char                 * path;        /* path of the file written */
+  unsigned char        * buffer;      /* data waiting to be written, aligned on U_UPLOAD_FILE_ALIGNMENT */
+  size_t                 buffer_size; /* size of buffer, a multiple of U_UPLOAD_FILE_ALIGNMENT */
+  size_t                 buffer_len;  /* length of the data in buffer */
+  uint64_t               size;        /* size of the file received */
+  int                    direct;      /* the file is written with O_DIRECT */
+#ifndef U_DISABLE_GNUTLS
+  gnutls_hash_hd_t       hash;        /* SHA-256 of the file received */
+#endif
+};
+
+/** MHD flag allowing the connections to be suspended, used in U_DAEMON_MODE_THREAD_POOL only **/
+#if MHD_VERSION >= 0x00095300
+  #define U_MHD_SUSPEND_RESUME MHD_ALLOW_SUSPEND_RESUME
+#else
+  #define U_MHD_SUSPEND_RESUME MHD_USE_SUSPEND_RESUME
+#endif
+
+/** Suspension status of a request **/
+#define U_SUSPEND_STATUS_NONE     0 /* no callback is suspended */
+#define U_SUSPEND_STATUS_SUSPENDED 1 /* the connection is suspended, waiting for ulfius_resume_response */
+#define U_SUSPEND_STATUS_RESUMED   2 /* ulfius_resume_response was called, the callback list goes on */
+#define U_SUSPEND_STATUS_TERMINATED 3 /* the connection was closed while suspended, the request context is free'd by ulfius_resume_response */
+
+/** Suspension status of a request body streamed to a body_callback **/
+#define U_BODY_STATUS_NONE      0 /* the body is read */
+#define U_BODY_STATUS_SUSPENDED 1 /* the connection is suspended, waiting for ulfius_resume_request_body */
+#define U_BODY_STATUS_RESUMED   2 /* ulfius_resume_request_body was called before the body_callback returned */
+#define U_BODY_STATUS_TERMINATED 3 /* the connection was closed while suspended, the request context is free'd by ulfius_resume_request_body */
+
+/**
+ * Callback list state of a request suspended by a callback
+ * Kept until the request is complete
+ */
+struct _u_suspend_state {
+  struct _u_router          * router;        /* routing table retained while the request isn't complete */
+  const struct _u_endpoint ** endpoint_list; /* matching endpoints sorted by priority */
+  size_t                      nb_endpoints;  /* number of matching endpoints */
+  size_t                      index;         /* index of the suspended callback in endpoint_list */
+  struct _u_route_captures    captures;      /* url segments captured during the match */
+};
 
 /**********************************
  * Internal functions declarations
  **********************************/
 
 /**
- * ulfius_endpoint_match
- * return the endpoint array matching the url called with the proper http method
- * the returned array always has its last value to NULL
- * return NULL on memory error
+ * ulfius_router_compile
+ * build the routing table of the endpoint list
+ * with a route match cache of cache_size entries, 0 to disable the cache
+ * return a new struct _u_router on success, NULL on error
+ * returned value must be free'd with ulfius_router_free after use
+ */
+struct _u_router * ulfius_router_compile(const struct _u_endpoint * endpoint_list, size_t nb_endpoints, size_t cache_size);
+
+/**
+ * ulfius_router_free
+ * free a routing table and its endpoints
+ */
+void ulfius_router_free(struct _u_router * router);
+
+/**
+ * ulfius_router_lock
+ * take the write lock of the handler, must be held to modify the endpoint list and publish a routing table
+ */
+void ulfius_router_lock(struct _u_router_handler * handler);
+
+/**
+ * ulfius_router_unlock
+ * release the write lock of the handler
  */
-struct _u_endpoint ** ulfius_endpoint_match(const char * method, const char * url, struct _u_endpoint * endpoint_list);
+void ulfius_router_unlock(struct _u_router_handler * handler);
+
+/**
+ * ulfius_router_publish
+ * replace atomically the current routing table of the handler by router
+ * the previous routing table is free'd when no reader can use it anymore
+ * the write lock must be held
+ */
+void ulfius_router_publish(struct _u_router_handler * handler, struct _u_router * router);
+
+/**
+ * ulfius_router_acquire
+ * register a reader and return the current routing table of the handler, without locking
+ * return NULL if there is no routing table
+ * reader_slot must be given to ulfius_router_release when the routing table isn't used anymore
+ */
+struct _u_router * ulfius_router_acquire(struct _u_router_handler * handler, size_t * reader_slot);
+
+/**
+ * ulfius_router_release
+ * unregister a reader, the routing table acquired must not be used afterwards
+ */
+void ulfius_router_release(struct _u_router_handler * handler, size_t reader_slot);
+
+/**
+ * ulfius_router_retain
+ * keep the routing table acquired after the reader is unregistered, used when a request is suspended
+ * the routing table can't be free'd until ulfius_router_drop is called
+ */
+void ulfius_router_retain(struct _u_router_handler * handler, struct _u_router * router, size_t reader_slot);
+
+/**
+ * ulfius_router_drop
+ * release a routing table kept with ulfius_router_retain, the routing table must not be used afterwards
+ */
+void ulfius_router_drop(struct _u_router_handler * handler, struct _u_router * router);
+
+/**
+ * ulfius_router_clean_handler
+ * free the current and the retired routing tables of the handler
+ * must be called when there is no reader left
+ */
+void ulfius_router_clean_handler(struct _u_router_handler * handler);
+
+/**
+ * ulfius_router_match
+ * fills endpoints with at most max_endpoints endpoints of the router matching the url called
+ * with the proper http method, sorted by priority
+ * if captures isn't NULL, the url segments are captured during the match
+ * does not allocate memory, the endpoints returned belong to the router
+ * return the total number of matching endpoints, which may be greater than max_endpoints
+ */
+size_t ulfius_router_match(const struct _u_router * router, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t max_endpoints, struct _u_route_captures * captures);
+
+/**
+ * ulfius_router_lookup
+ * same as ulfius_router_match, but looks in the route match cache of the router first
+ * the result is stored in the cache on a miss, the handler hit and miss counters are updated
+ * on a hit, no url segment is captured
+ */
+size_t ulfius_router_lookup(struct _u_router_handler * handler, struct _u_router * router, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t max_endpoints, struct _u_route_captures * captures);
+
+/**
+ * ulfius_router_get_params
+ * return the url parameters set of an endpoint returned by ulfius_router_match
+ * return NULL if the endpoint doesn't belong to the router
+ */
+const struct _u_route_params * ulfius_router_get_params(const struct _u_router * router, const struct _u_endpoint * endpoint);
+
+/**
+ * ulfius_router_parse_url
+ * fills map with the url parameters values of the url, using the segments captured during the match
+ * only the segments holding a parameter are decoded
+ * return U_OK on success
+ */
+int ulfius_router_parse_url(const struct _u_route_params * params, const char * url, const struct _u_route_captures * captures, struct _u_map * map, int check_utf8);
 
 /**
  * ulfius_parse_url
@@ -64,6 +461,139 @@ struct _u_endpoint ** ulfius_endpoint_match(const char * method, const char * ur
  */
 int ulfius_parse_url(const char * url, const struct _u_endpoint * endpoint, struct _u_map * map, int check_utf8);
 
+/**
+ * ulfius_reset_request
+ * reset a request initialized with ulfius_init_request to its initial values
+ * the inner maps are emptied but not free'd, so the request can be used again
+ * return U_OK on success
+ */
+int ulfius_reset_request(struct _u_request * request);
+
+/**
+ * ulfius_reset_response
+ * reset a response initialized with ulfius_init_response to its initial values
+ * the header map and the websocket handle are emptied but not free'd, so the response can be used again
+ * return U_OK on success
+ */
+int ulfius_reset_response(struct _u_response * response);
+
+/**
+ * u_map_put_borrowed
+ * add or replace the value of key in u_map without copying key and value
+ * key and value must stay valid and unchanged as long as the entry exists
+ * a borrowed value is copied before it's modified, the borrowed strings aren't free'd with the map
+ * return U_OK on success
+ */
+int u_map_put_borrowed(struct _u_map * u_map, const char * key, const char * value);
+
+/**
+ * ulfius_arena_create
+ * create a memory arena with blocks of block_size bytes, the arena is stored in its first block
+ * the first block has room for reserved_size bytes after the arena,
+ * so the first allocation of reserved_size bytes is kept by ulfius_arena_reset
+ * return NULL on error
+ * returned value must be free'd with ulfius_arena_free after use
+ */
+struct _u_arena * ulfius_arena_create(size_t block_size, size_t reserved_size);
+
+/**
+ * ulfius_arena_alloc
+ * allocate size bytes in the arena, aligned on U_ARENA_ALIGNMENT
+ * return NULL on error
+ * returned value must not be free'd, it's free'd with the arena
+ */
+void * ulfius_arena_alloc(struct _u_arena * arena, size_t size);
+
+/**
+ * ulfius_arena_strdup
+ * duplicate str in the arena
+ * return NULL on error or if str is NULL
+ */
+char * ulfius_arena_strdup(struct _u_arena * arena, const char * str);
+
+/**
+ * ulfius_arena_strndup
+ * duplicate the first len bytes of str in the arena, adding a trailing '\0'
+ * return NULL on error or if str is NULL
+ */
+char * ulfius_arena_strndup(struct _u_arena * arena, const char * str, size_t len);
+
+/**
+ * ulfius_arena_free
+ * free all the blocks of an arena and the arena itself
+ */
+void ulfius_arena_free(struct _u_arena * arena);
+
+/**
+ * ulfius_arena_reset
+ * free all the blocks of an arena but the first one,
+ * the allocations are discarded except the reserved one
+ */
+void ulfius_arena_reset(struct _u_arena * arena);
+
+/**
+ * ulfius_request_context_new
+ * create a request context in a new arena with blocks of block_size bytes
+ * return NULL on error
+ * returned value must be free'd with ulfius_request_context_free after use
+ */
+struct _u_request_context * ulfius_request_context_new(size_t block_size);
+
+/**
+ * ulfius_request_context_recycle
+ * reset a request context and its arena so it can be used for another request
+ * return U_OK on success, the request context must be free'd otherwise
+ */
+int ulfius_request_context_recycle(struct _u_request_context * context);
+
+/**
+ * ulfius_request_context_free
+ * free a request context, its request, its response and its arena
+ */
+void ulfius_request_context_free(struct _u_request_context * context);
+
+/**
+ * ulfius_pool_get
+ * take a request context from the pool
+ * return NULL if the pool is empty
+ */
+struct _u_request_context * ulfius_pool_get(struct _u_pool * pool);
+
+/**
+ * ulfius_pool_put
+ * keep a recycled request context in the pool, unless the pool has max_retained request contexts already
+ * return U_OK if the request context is kept, U_ERROR otherwise
+ */
+int ulfius_pool_put(struct _u_pool * pool, struct _u_request_context * context, size_t max_retained);
+
+/**
+ * ulfius_pool_clean
+ * free all the request contexts in the pool
+ */
+void ulfius_pool_clean(struct _u_pool * pool);
+
+/**
+ * ulfius_upload_file_write
+ * write a block of a file sent in a multipart/form-data body in the upload directory of the instance
+ * the file in progress is completed first if the block belongs to another file
+ * return U_OK on success
+ */
+int ulfius_upload_file_write(struct connection_info_struct * con_info, const char * key, const char * filename, const char * data, uint64_t off, size_t size);
+
+/**
+ * ulfius_upload_file_complete
+ * write the end of the file in progress, then set its path, file name, size and hash in request->map_upload_file
+ * return U_OK on success or if there's no file in progress
+ */
+int ulfius_upload_file_complete(struct connection_info_struct * con_info);
+
+/**
+ * ulfius_upload_file_clean
+ * close and remove the file in progress, then remove the files written for the request if remove_files is set
+ * used when the request is complete, the files are kept only if the request was successful
+ */
+void ulfius_upload_file_clean(struct connection_info_struct * con_info, int remove_files);
+
 /**
  * ulfius_set_response_header
  * adds headers defined in the response_map_header to the response
@@ -96,6 +626,9 @@ int ulfius_set_response_cookie(struct MHD_Response * mhd_response, const struct
  * Markus Kuhn <http://www.cl.cam.ac.uk/~mgk25/> -- 2005-03-30
  * Nicolas Mora <mail@babelouest.org>
  * License: http://www.cl.cam.ac.uk/~mgk25/short-license.html
+ *
+ * On x86 processors with SSE4.1 or AVX2, the strings of 64 bytes or more
+ * are validated by blocks with vector instructions first, the result is the same
  */
 const unsigned char * utf8_check(const char * s_orig, size_t len);
 
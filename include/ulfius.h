@@ -121,6 +121,7 @@ int y_close_logs();
 #define U_CALLBACK_COMPLETE     2 ///< Callback exited with success, exit callback list
 #define U_CALLBACK_UNAUTHORIZED 3 ///< Request is unauthorized, exit callback list and return status 401
 #define U_CALLBACK_ERROR        4 ///< Error during request process, exit callback list and return status 500
+#define U_CALLBACK_SUSPEND      5 ///< Callback will complete later, the connection is suspended until ulfius_resume_response is called, available in U_DAEMON_MODE_THREAD_POOL only
 
 #define U_COOKIE_SAME_SITE_EMPTY  0 ///< Set same_site cookie property not set
 #define U_COOKIE_SAME_SITE_STRICT 1 ///< Set same_site cookie property to strict
@@ -138,6 +139,21 @@ int y_close_logs();
 #define U_POST_PROCESS_URL_ENCODED        0x0001
 #define U_POST_PROCESS_MULTIPART_FORMDATA 0x0010
 
+#define U_POST_BODY_RAW    0x0001 ///< Store the form body in request->binary_body
+#define U_POST_BODY_PARSED 0x0010 ///< Parse the form body in request->map_post_body
+
+#define U_UPLOAD_FILE_DIRECT 0x0001 ///< Write the files uploaded in upload_file_directory with O_DIRECT when the system supports it
+#define U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE 1048576 ///< Default size of the writes of the files uploaded in upload_file_directory
+
+#define U_ROUTE_CACHE_DEFAULT_SIZE 64 ///< Default number of entries in the route match cache of an instance
+
+#define U_DAEMON_MODE_THREAD_PER_CONNECTION 0 ///< Start the webservice with one thread per connection
+#define U_DAEMON_MODE_THREAD_POOL           1 ///< Start the webservice with a pool of worker threads polling the connections, using epoll when available
+
+#define U_ARENA_DEFAULT_BLOCK_SIZE 4096 ///< Default size of the memory blocks of the per-request arena
+
+#define U_POOL_DEFAULT_MAX_RETAINED 64 ///< Default maximum number of per-request objects kept by the instance for the next requests
+
 /**
  * Options available to set or get properties using
  * ulfius_set_request_properties or ulfius_set_request_properties
@@ -184,6 +200,72 @@ typedef enum {
   U_OPT_HTTP_URL_APPEND               = 32  ///< append char * value to the current url, expected option value type: const char *
 } u_option;
 
+#define U_MAP_MERGE_OVERWRITE     0x00 ///< u_map_merge replaces the values of the keys already present in the destination map
+#define U_MAP_MERGE_SKIP_EXISTING 0x01 ///< u_map_merge keeps the values of the keys already present in the destination map
+#define U_MAP_MERGE_BORROW        0x02 ///< u_map_merge doesn't copy the keys and values of the source map, the source map must not be modified or free'd while the destination map uses them, a borrowed value is copied before it's modified in the destination map
+
+/**
+ * Standard HTTP header names interned by struct _u_map
+ * Use with u_map_get_known and u_map_count_known
+ */
+typedef enum {
+  U_HDR_ACCEPT                         = 0, ///< Accept
+  U_HDR_ACCEPT_CHARSET                 = 1, ///< Accept-Charset
+  U_HDR_ACCEPT_ENCODING                = 2, ///< Accept-Encoding
+  U_HDR_ACCEPT_LANGUAGE                = 3, ///< Accept-Language
+  U_HDR_ACCESS_CONTROL_ALLOW_ORIGIN    = 4, ///< Access-Control-Allow-Origin
+  U_HDR_ACCESS_CONTROL_REQUEST_HEADERS = 5, ///< Access-Control-Request-Headers
+  U_HDR_ACCESS_CONTROL_REQUEST_METHOD  = 6, ///< Access-Control-Request-Method
+  U_HDR_ALLOW                          = 7, ///< Allow
+  U_HDR_AUTHORIZATION                  = 8, ///< Authorization
+  U_HDR_CACHE_CONTROL                  = 9, ///< Cache-Control
+  U_HDR_CONNECTION                     = 10, ///< Connection
+  U_HDR_CONTENT_DISPOSITION            = 11, ///< Content-Disposition
+  U_HDR_CONTENT_ENCODING               = 12, ///< Content-Encoding
+  U_HDR_CONTENT_LENGTH                 = 13, ///< Content-Length
+  U_HDR_CONTENT_TYPE                   = 14, ///< Content-Type
+  U_HDR_COOKIE                         = 15, ///< Cookie
+  U_HDR_DATE                           = 16, ///< Date
+  U_HDR_ETAG                           = 17, ///< ETag
+  U_HDR_EXPECT                         = 18, ///< Expect
+  U_HDR_EXPIRES                        = 19, ///< Expires
+  U_HDR_FORWARDED                      = 20, ///< Forwarded
+  U_HDR_HOST                           = 21, ///< Host
+  U_HDR_IF_MATCH                       = 22, ///< If-Match
+  U_HDR_IF_MODIFIED_SINCE              = 23, ///< If-Modified-Since
+  U_HDR_IF_NONE_MATCH                  = 24, ///< If-None-Match
+  U_HDR_IF_RANGE                       = 25, ///< If-Range
+  U_HDR_IF_UNMODIFIED_SINCE            = 26, ///< If-Unmodified-Since
+  U_HDR_KEEP_ALIVE                     = 27, ///< Keep-Alive
+  U_HDR_LAST_MODIFIED                  = 28, ///< Last-Modified
+  U_HDR_LOCATION                       = 29, ///< Location
+  U_HDR_ORIGIN                         = 30, ///< Origin
+  U_HDR_PRAGMA                         = 31, ///< Pragma
+  U_HDR_PROXY_AUTHORIZATION            = 32, ///< Proxy-Authorization
+  U_HDR_RANGE                          = 33, ///< Range
+  U_HDR_REFERER                        = 34, ///< Referer
+  U_HDR_SEC_WEBSOCKET_ACCEPT           = 35, ///< Sec-WebSocket-Accept
+  U_HDR_SEC_WEBSOCKET_EXTENSIONS       = 36, ///< Sec-WebSocket-Extensions
+  U_HDR_SEC_WEBSOCKET_KEY              = 37, ///< Sec-WebSocket-Key
+  U_HDR_SEC_WEBSOCKET_PROTOCOL         = 38, ///< Sec-WebSocket-Protocol
+  U_HDR_SEC_WEBSOCKET_VERSION          = 39, ///< Sec-WebSocket-Version
+  U_HDR_SERVER                         = 40, ///< Server
+  U_HDR_SET_COOKIE                     = 41, ///< Set-Cookie
+  U_HDR_TE                             = 42, ///< TE
+  U_HDR_TRAILER                        = 43, ///< Trailer
+  U_HDR_TRANSFER_ENCODING              = 44, ///< Transfer-Encoding
+  U_HDR_UPGRADE                        = 45, ///< Upgrade
+  U_HDR_USER_AGENT                     = 46, ///< User-Agent
+  U_HDR_VARY                           = 47, ///< Vary
+  U_HDR_VIA                            = 48, ///< Via
+  U_HDR_WWW_AUTHENTICATE               = 49, ///< WWW-Authenticate
+  U_HDR_X_FORWARDED_FOR                = 50, ///< X-Forwarded-For
+  U_HDR_X_FORWARDED_HOST               = 51, ///< X-Forwarded-Host
+  U_HDR_X_FORWARDED_PROTO              = 52, ///< X-Forwarded-Proto
+  U_HDR_X_REQUESTED_WITH               = 53, ///< X-Requested-With
+  U_HDR_COUNT                          = 54  ///< Number of known header names, not a header name
+} u_known_header;
+
 /**
  * @}
  */
@@ -202,10 +284,30 @@ typedef enum {
  * struct _u_map
  */
 struct _u_map {
-  int      nb_values; /* !< Values count */
-  char  ** keys; /* !< Array of keys */
-  char  ** values; /* !< Array of values */
+  int      nb_values; /* !< Values count, including the removed values until the map is compacted, use u_map_count to get the number of values */
+  char  ** keys; /* !< Array of keys, including the removed values until the map is compacted, use u_map_iter_begin or u_map_enum_keys to get the keys */
+  char  ** values; /* !< Array of values, including the removed values until the map is compacted, use u_map_iter_begin or u_map_enum_values to get the values */
   size_t * lengths; /* !< Lengths of each values */
+  int      nb_removed; /* !< Internal variable, number of removed values left in the arrays until the map is compacted, Do not change this value */
+  size_t   capacity; /* !< Internal variable, number of entries allocated in keys, values and lengths, Do not change this value */
+  void   * index; /* !< Internal variable, hash index of the keys, Do not change this value */
+  void   * slab; /* !< Internal variable, storage of the short keys and values, Do not change this value */
+  const struct _u_map * base; /* !< Internal variable, frozen map whose values are visible in this map unless this map has the same key, see u_map_set_base, Do not change this value */
+  int      frozen; /* !< Internal variable, the map can't be modified if true, see u_map_freeze, Do not change this value */
+  char  ** enum_keys; /* !< Internal variable, array of the keys returned by u_map_enum_keys when the map has removed values or a base, Do not change this value */
+  char  ** enum_values; /* !< Internal variable, array of the values returned by u_map_enum_values when the map has removed values or a base, Do not change this value */
+};
+
+/**
+ * struct _u_map_iter
+ * iterator on the values of a struct _u_map, see u_map_iter_begin and u_map_iter_next
+ */
+struct _u_map_iter {
+  const struct _u_map * u_map; /* !< Map iterated */
+  int                   position; /* !< Internal variable, position of the next value, Do not change this value */
+  const char          * key; /* !< Key of the current value */
+  const char          * value; /* !< Current value, NULL if the value is empty, like u_map_get */
+  size_t                length; /* !< Length of the current value */
 };
 
 /**
@@ -253,9 +355,12 @@ struct _u_request {
   struct _u_map *      map_header; /* !< map containing the header variables */
   struct _u_map *      map_cookie; /* !< map containing the cookie variables */
   struct _u_map *      map_post_body; /* !< map containing the post body variables (if available) */
+  struct _u_map *      map_upload_file; /* !< map containing the files written in the upload directory, see ulfius_set_upload_file_directory */
   unsigned char *      binary_body; /* !< raw body */
   size_t               binary_body_length; /* !< length of raw body */
   unsigned int         callback_position; /* !< position of the current callback function in the callback list, starts at 0 */
+  void *               arena; /* !< memory arena of a request received by the framework, used by ulfius_request_arena_alloc */
+  void *               body_handle; /* !< handle for requests whose body is streamed to a body_callback, used by ulfius_resume_request_body */
 #ifndef U_DISABLE_GNUTLS
   gnutls_x509_crt_t    client_cert; /* !< x509 certificate of the client if the instance uses client certificate authentication and the client is authenticated, available only if GnuTLS support is enabled */
   char *               client_cert_file; /* !< path to client certificate file for sending http requests with certificate authentication, available only if GnuTLS support is enabled */
@@ -288,6 +393,7 @@ struct _u_response {
   void *             shared_data; /* !< any data shared between callback functions, must be allocated and freed by the callback functions */
   void            (* free_shared_data)(void * shared_data); /* !< pointer to a function that will free shared_data */
   unsigned int       timeout; /* !< Timeout in seconds to close the connection because of inactivity between the client and the server */
+  void             * suspend_handle; /* !< handle for suspended requests, used by ulfius_resume_response */
 };
 
 /**
@@ -304,7 +410,12 @@ struct _u_endpoint {
   int       (* callback_function)(const struct _u_request * request, /* !< pointer to a function that will be executed each time the endpoint is called, you must declare the function as described. */
                                   struct _u_response * response,
                                   void * user_data);
-  void       * user_data; /* !< pointer to a data or a structure that will be available in callback_function */
+  void       * user_data; /* !< pointer to a data or a structure that will be available in callback_function and body_callback */
+  int       (* body_callback)(const struct _u_request * request, /* !< optional pointer to a function that receives the request body by chunks as they arrive, the body isn't stored in request->binary_body nor parsed in request->map_post_body, return U_CALLBACK_CONTINUE, U_CALLBACK_SUSPEND to wait for ulfius_resume_request_body before the next chunk in U_DAEMON_MODE_THREAD_POOL only, or U_CALLBACK_ERROR */
+                              const char * data,
+                              uint64_t off,
+                              size_t size,
+                              void * user_data);
 };
 
 /**
@@ -327,7 +438,7 @@ struct _u_instance {
   char                        * default_auth_realm; /* !< Default realm on authentication error */
   struct _u_endpoint          * endpoint_list; /* !< List of available endpoints */
   struct _u_endpoint          * default_endpoint; /* !< Default endpoint if no other endpoint match the current url */
-  struct _u_map               * default_headers; /* !< Default headers that will be added to all response->map_header */
+  struct _u_map               * default_headers; /* !< Default headers that will be added to all response->map_header, frozen while the framework is running */
   size_t                        max_post_param_size; /* !< maximum size for a post parameter, 0 means no limit, default 0 */
   size_t                        max_post_body_size; /* !< maximum size for the entire post body, 0 means no limit, default 0 */
   void                        * websocket_handler; /* !< handler for the websocket structure */
@@ -347,6 +458,19 @@ struct _u_instance {
   int                           use_client_cert_auth; /* !< Internal variable use to indicate if the instance uses client certificate authentication, Do not change this value, available only if websocket support is enabled */
 #endif
   int                           allowed_post_processor; /* !< Specifies which content-type are allowed to process in the request->map_post_body parameters list, default value is U_POST_PROCESS_URL_ENCODED|U_POST_PROCESS_MULTIPART_FORMDATA, to disable all, use U_POST_PROCESS_NONE */
+  size_t                        route_cache_size; /* !< number of match results stored in the route match cache, per http method and url path, 0 disables the cache, default U_ROUTE_CACHE_DEFAULT_SIZE, changes are taken into account when the routing table is updated */
+  int                           daemon_mode; /* !< threading mode used by ulfius_start_framework and its variants, values available are U_DAEMON_MODE_THREAD_PER_CONNECTION or U_DAEMON_MODE_THREAD_POOL, default U_DAEMON_MODE_THREAD_PER_CONNECTION */
+  unsigned int                  thread_pool_size; /* !< number of worker threads in U_DAEMON_MODE_THREAD_POOL mode, 0 means the number of processors online, default 0 */
+  size_t                        arena_block_size; /* !< size of the memory blocks of the per-request arena, 0 to allocate each per-request object separately, default U_ARENA_DEFAULT_BLOCK_SIZE */
+  size_t                        pool_max_retained; /* !< maximum number of per-request objects kept by the instance to be reused by the next requests, 0 disables the pool, default U_POOL_DEFAULT_MAX_RETAINED */
+  int                           post_body_storage; /* !< Specifies how a form body processed by allowed_post_processor is kept, in request->binary_body, in request->map_post_body or both, values available are U_POST_BODY_RAW, U_POST_BODY_PARSED or both, default value is both (U_POST_BODY_RAW|U_POST_BODY_PARSED) */
+  size_t                        post_processor_buffer_size; /* !< size of the buffer used to parse the form bodies, a file is received by blocks of at most this size, default ULFIUS_POSTBUFFERSIZE */
+  char                        * upload_file_directory; /* !< directory where the files of the multipart/form-data bodies are written as they are received, instead of being stored in request->map_post_body, NULL to disable, default NULL, use ulfius_set_upload_file_directory to set this value */
+  size_t                        upload_file_buffer_size; /* !< size of the writes of the files uploaded in upload_file_directory, default U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE */
+  int                           upload_file_flags; /* !< options of the files uploaded in upload_file_directory, value available is U_UPLOAD_FILE_DIRECT, default 0 */
+  void                        * router; /* !< Internal variable, routing table compiled from endpoint_list, updated when an endpoint is added or removed, Do not change this value */
+  void                        * pool; /* !< Internal variable, per-request objects ready to be reused, Do not change this value */
+  int                           allow_suspend; /* !< Internal variable, set when the framework starts if the connections can be suspended by U_CALLBACK_SUSPEND, Do not change this value */
 };
 
 /**
@@ -362,8 +486,27 @@ struct connection_info_struct {
   int                        has_post_processor;
   int                        callback_first_iteration;
   struct _u_request        * request;
+  struct _u_response       * response;
   size_t                     max_post_param_size;
   struct _u_map              map_url_initial;
+  struct MHD_Connection    * connection;
+  char                       suspend_lock;
+  int                        suspend_status;
+  int                        resume_callback_ret;
+  struct _u_suspend_state  * suspend_state;
+  struct _u_arena          * arena;
+  int                     (* body_callback)(const struct _u_request * request, const char * data, uint64_t off, size_t size, void * user_data);
+  void                     * body_user_data;
+  uint64_t                   body_offset;
+  int                        body_status;
+  int                        body_callback_ret;
+  size_t                     body_capacity;
+  struct _u_upload_file    * upload_file;
+  int                        upload_file_allowed;
+  int                        upload_file_keep;
+  int                        upload_file_status;
+  char                    ** upload_file_paths;
+  size_t                     nb_upload_file_paths;
 };
 
 /**********************************
@@ -492,6 +635,7 @@ int ulfius_start_secure_ca_trust_framework(struct _u_instance * u_instance, cons
  * @param mhd_ops struct MHD_OptionItem * options table,
  * - MUST contain an option with the fllowing value: {.option = MHD_OPTION_NOTIFY_COMPLETED; .value = (intptr_t)mhd_request_completed; .ptr_value = NULL;}
  * - MUST contain an option with the fllowing value: {.option = MHD_OPTION_URI_LOG_CALLBACK; .value = (intptr_t)ulfius_uri_logger; .ptr_value = NULL;}
+ *   .ptr_value may be set to u_instance to use u_instance->arena_block_size and the instance pool, U_ARENA_DEFAULT_BLOCK_SIZE is used and the pool is disabled otherwise
  * - MUST end with a terminal struct MHD_OptionItem: {.option = MHD_OPTION_END; .value = 0; .ptr_value = NULL;}
  * @return U_OK on success
  */
@@ -544,6 +688,34 @@ int ulfius_set_upload_file_callback_function(struct _u_instance * u_instance,
                                                                            void * cls),
                                              void * cls);
 
+/**
+ * ulfius_set_upload_file_directory
+ *
+ * Write the files uploaded in multipart/form-data bodies in a directory
+ * as they are received, instead of storing them in request->map_post_body
+ * For a file sent in the post parameter key, request->map_upload_file contains:
+ * - key: path of the file written
+ * - key_filename: file name sent by the client, an empty string if it's not valid utf8 and check_utf8 is set
+ * - key_size: size of the file in bytes
+ * - key_sha256: SHA-256 hash of the file in hexadecimal, available only if GnuTLS support is enabled
+ * The next files sent in the same post parameter are given in key.1, key.1_filename, etc., then key.2, etc.
+ * Only the framework writes in request->map_upload_file, so the post parameters sent by the client
+ * in request->map_post_body can't change these values
+ *
+ * The files are written only if an endpoint matches the request,
+ * they're removed by the framework if the request is incomplete,
+ * or if the callback functions end with an error or U_CALLBACK_UNAUTHORIZED
+ * Otherwise the files written belong to the application and must be removed by it
+ * If a file upload callback function is set, it has priority over the directory
+ *
+ * @param u_instance pointer to a struct _u_instance that describe its port and bind address
+ * @param directory path of an existing directory, NULL to disable
+ * @param buffer_size size of the writes, rounded up to a multiple of 4096, 0 to use U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE
+ * @param flags U_UPLOAD_FILE_DIRECT to bypass the page cache when the system supports it, or 0
+ * @return U_OK on success
+ */
+int ulfius_set_upload_file_directory(struct _u_instance * u_instance, const char * directory, size_t buffer_size, int flags);
+
 /**
  * @}
  */
@@ -643,6 +815,39 @@ int ulfius_set_default_endpoint(struct _u_instance * u_instance,
  */
 int ulfius_remove_endpoint_by_val(struct _u_instance * u_instance, const char * http_method, const char * url_prefix, const char * url_format);
 
+/**
+ * ulfius_get_route_cache_stats
+ * Get the number of hits and misses of the route match cache
+ * since the instance was initialized
+ * @param u_instance pointer to a struct _u_instance that describe its port and bind address
+ * @param hits set to the number of requests whose endpoints were found in the cache, may be NULL
+ * @param misses set to the number of requests whose endpoints were searched in the routing table, may be NULL
+ * @return U_OK on success
+ */
+int ulfius_get_route_cache_stats(const struct _u_instance * u_instance, size_t * hits, size_t * misses);
+
+/**
+ * ulfius_get_pool_stats
+ * Get the usage of the pool of per-request objects since the instance was initialized
+ * @param u_instance pointer to a struct _u_instance that describe its port and bind address
+ * @param hits set to the number of requests reusing objects from the pool, may be NULL
+ * @param misses set to the number of requests allocating new objects, may be NULL
+ * @param retained set to the number of objects currently kept in the pool, may be NULL
+ * @return U_OK on success
+ */
+int ulfius_get_pool_stats(const struct _u_instance * u_instance, size_t * hits, size_t * misses, size_t * retained);
+
+/**
+ * ulfius_get_body_stats
+ * Get the cost of the request bodies buffered in request->binary_body since the instance was initialized
+ * @param u_instance pointer to a struct _u_instance that describe its port and bind address
+ * @param reallocs set to the number of allocations of the request bodies, may be NULL
+ * @param bytes_copied set to the number of bytes copied in the request bodies,
+ * including the bytes moved by the allocations, may be NULL
+ * @return U_OK on success
+ */
+int ulfius_get_body_stats(const struct _u_instance * u_instance, size_t * reallocs, size_t * bytes_copied);
+
 /**
  * ulfius_empty_endpoint
  * @return empty endpoint that goes at the end of an endpoint list
@@ -1024,6 +1229,28 @@ int ulfius_copy_request(struct _u_request * dest, const struct _u_request * sour
  */
 int ulfius_set_request_properties(struct _u_request * request, ...);
 
+/**
+ * ulfius_request_arena_alloc
+ * Allocates memory in the arena of a request received by the framework
+ * The memory is free'd at once when the request is complete, it must not be free'd by the user
+ * This function isn't thread-safe, it's meant to be used by the callback functions
+ * or the thread completing a suspended response
+ * @param request the request given to the callback function
+ * @param size the number of bytes to allocate
+ * @return a pointer to the memory allocated, NULL on error or if the request has no arena
+ */
+void * ulfius_request_arena_alloc(const struct _u_request * request, size_t size);
+
+/**
+ * ulfius_request_arena_strdup
+ * Duplicates a string in the arena of a request received by the framework
+ * The string is free'd when the request is complete, it must not be free'd by the user
+ * @param request the request given to the callback function
+ * @param str the string to duplicate
+ * @return the duplicated string, NULL on error or if the request has no arena
+ */
+char * ulfius_request_arena_strdup(const struct _u_request * request, const char * str);
+
 /**
  * create a new request based on the source elements
  * returned value must be u_free'd after use
@@ -1124,6 +1351,38 @@ int ulfius_set_response_properties(struct _u_response * response, ...);
  */
 int ulfius_set_response_shared_data(struct _u_response * response, void * shared_data, void (* free_shared_data) (void * shared_data));
 
+/**
+ * Completes a request suspended by a callback function returning U_CALLBACK_SUSPEND
+ * The response may be updated from any thread until this function is called,
+ * then the callback list goes on as if the suspended callback had returned callback_ret
+ * The connections can be suspended in U_DAEMON_MODE_THREAD_POOL only,
+ * in U_DAEMON_MODE_THREAD_PER_CONNECTION, U_CALLBACK_SUSPEND is handled as U_CALLBACK_ERROR
+ * This function must be called exactly once for each U_CALLBACK_SUSPEND returned,
+ * the response must not be used afterwards
+ * If the connection was closed while the request was suspended, e.g. by ulfius_stop_framework,
+ * the request and the response are free'd by this function, which returns U_ERROR
+ * @param response the response given to the suspended callback function
+ * @param callback_ret the result of the suspended callback function,
+ * U_CALLBACK_CONTINUE, U_CALLBACK_IGNORE, U_CALLBACK_COMPLETE, U_CALLBACK_UNAUTHORIZED or U_CALLBACK_ERROR
+ * @return U_OK on success, U_ERROR if the connection was closed
+ */
+int ulfius_resume_response(struct _u_response * response, int callback_ret);
+
+/**
+ * Receives the next chunks of a request body suspended by a body_callback returning U_CALLBACK_SUSPEND
+ * The connection isn't read until this function is called, so the client waits
+ * until the body_callback is ready for more data
+ * The connections can be suspended in U_DAEMON_MODE_THREAD_POOL only,
+ * in U_DAEMON_MODE_THREAD_PER_CONNECTION, U_CALLBACK_SUSPEND is handled as U_CALLBACK_ERROR
+ * This function must be called exactly once for each U_CALLBACK_SUSPEND returned,
+ * it may be called from any thread, even before the body_callback returns
+ * If the connection was closed while the request body was suspended, e.g. by ulfius_stop_framework,
+ * the request is free'd by this function, which returns U_ERROR
+ * @param request the request given to the suspended body_callback function
+ * @return U_OK on success, U_ERROR if the connection was closed
+ */
+int ulfius_resume_request_body(const struct _u_request * request);
+
 /**
  * Exports a struct _u_response * into a readable HTTP response
  * This function is for debug or educational purpose
@@ -1271,7 +1530,8 @@ int u_map_clean(struct _u_map * u_map);
 int u_map_clean_full(struct _u_map * u_map);
 
 /**
- * free an enum return by functions u_map_enum_keys or u_map_enum_values
+ * free an array of char * ending with a NULL element and its strings
+ * the arrays returned by u_map_enum_keys and u_map_enum_values belong to the map and must not be free'd
  * @param array the string array to cleanup
  * @return U_OK on success
  */
@@ -1279,18 +1539,41 @@ int u_map_clean_enum(char ** array);
 
 /**
  * returns an array containing all the keys in the struct _u_map
+ * the array belongs to the map, it must not be free'd and is valid until the map is modified,
+ * cleaned or enumerated again, the values of the map aren't modified
  * @param u_map the _u_map to retreive the keys from
- * @return an array of char * ending with a NULL element
+ * @return an array of char * ending with a NULL element, NULL on error
  */
 const char ** u_map_enum_keys(const struct _u_map * u_map);
 
 /**
  * returns an array containing all the values in the struct _u_map
+ * the array belongs to the map, it must not be free'd and is valid until the map is modified,
+ * cleaned or enumerated again, the values of the map aren't modified
  * @param u_map the _u_map to retreive the values from
- * @return an array of char * ending with a NULL element
+ * @return an array of char * ending with a NULL element, NULL on error
  */
 const char ** u_map_enum_values(const struct _u_map * u_map);
 
+/**
+ * initialize an iterator on the values of the struct _u_map
+ * unlike u_map_enum_keys and u_map_enum_values, the keys and values aren't gathered in an array
+ * the map must not be modified until the end of the iteration
+ * @param u_map the _u_map to iterate
+ * @param iter the iterator to initialize
+ * @return U_OK on success
+ */
+int u_map_iter_begin(const struct _u_map * u_map, struct _u_map_iter * iter);
+
+/**
+ * move the iterator to the next value of the struct _u_map
+ * and set iter->key, iter->value and iter->length
+ * the values are iterated in the order they were added
+ * @param iter the iterator initialized with u_map_iter_begin
+ * @return 1 if the iterator is on a value, 0 at the end of the map
+ */
+int u_map_iter_next(struct _u_map_iter * iter);
+
 /**
  * Detects if the key exists in the _u_map
  * search is case sensitive
@@ -1356,6 +1639,8 @@ int u_map_put(struct _u_map * u_map, const char * key, const char * value);
  * add the specified key/binary value pair into the specified u_map
  * if the u_map already contains a pair with the same key,
  * replace the value at the specified offset with the specified length
+ * the value grows geometrically when it's extended, so appending chunks
+ * at increasing offsets doesn't reallocate the value for each chunk
  * @param u_map the _u_map to update
  * @param key the key string
  * @param value the value binary
@@ -1454,6 +1739,24 @@ int u_map_remove_from_value_binary(struct _u_map * u_map, const char * key, size
  */
 int u_map_remove_at(struct _u_map * u_map, const int index);
 
+/**
+ * remove all pairs key/value that have one of the specified keys
+ * the map is compacted once after all the keys are removed
+ * @param u_map the _u_map to update
+ * @param keys a NULL terminated array of keys to remove
+ * @return U_OK on success, U_ERROR_NOT_FOUND if no key was found, error otherwise
+ */
+int u_map_remove_keys(struct _u_map * u_map, const char ** keys);
+
+/**
+ * remove all pairs key/value that have one of the specified keys (case insensitive search)
+ * the map is compacted once after all the keys are removed
+ * @param u_map the _u_map to update
+ * @param keys a NULL terminated array of keys to remove
+ * @return U_OK on success, U_ERROR_NOT_FOUND if no key was found, error otherwise
+ */
+int u_map_remove_keys_case(struct _u_map * u_map, const char ** keys);
+
 /**
  * Create an exact copy of the specified struct _u_map
  * @param source the _u_map to copy
@@ -1471,6 +1774,50 @@ struct _u_map * u_map_copy(const struct _u_map * source);
  */
 int u_map_copy_into(struct _u_map * dest, const struct _u_map * source);
 
+/**
+ * Merge all key/values pairs of source into dest
+ * dest capacity is increased once for all the values of source
+ * @param dest the _u_map to update
+ * @param source the _u_map to merge
+ * @param flags U_MAP_MERGE_OVERWRITE or U_MAP_MERGE_SKIP_EXISTING, can be combined with U_MAP_MERGE_BORROW
+ * @return U_OK on success, error otherwise
+ */
+int u_map_merge(struct _u_map * dest, const struct _u_map * source, int flags);
+
+/**
+ * Make the struct _u_map read-only
+ * A frozen map can be read by several threads at the same time without lock,
+ * the functions modifying it return U_ERROR_PARAMS until it's unfrozen,
+ * u_map_clean is still allowed
+ * @param u_map the _u_map to freeze
+ * @return U_OK on success
+ */
+int u_map_freeze(struct _u_map * u_map);
+
+/**
+ * Make a frozen struct _u_map modifiable again
+ * The map must not be read by other threads or used as a base anymore
+ * @param u_map the _u_map to unfreeze
+ * @return U_OK on success
+ */
+int u_map_unfreeze(struct _u_map * u_map);
+
+/**
+ * Use a frozen struct _u_map as the base of u_map
+ * The values of base are visible in u_map without being copied,
+ * unless u_map has a value with the same key. A value of base is copied
+ * in u_map when it's modified, all the values of base are copied in u_map
+ * when a value is removed from u_map, then the base is detached
+ * base must not be unfrozen or free'd while it's the base of u_map,
+ * the base is detached by u_map_empty, u_map_clean, u_map_freeze or u_map_set_base,
+ * u_map doesn't reference any key or value of base afterwards
+ * With base NULL, the values of the current base aren't visible in u_map anymore
+ * @param u_map the _u_map to update
+ * @param base the frozen _u_map to use as base, NULL to detach the current base
+ * @return U_OK on success
+ */
+int u_map_set_base(struct _u_map * u_map, const struct _u_map * base);
+
 /**
  * Count the number of elements in the _u_map
  * @param u_map the _u_map to analyze
@@ -1488,6 +1835,24 @@ int u_map_count(const struct _u_map * u_map);
  */
 int u_map_count_keys_case(const struct _u_map * source, const char * key);
 
+/**
+ * get the value corresponding to a known header name in the u_map
+ * search is case insensitive, and faster than u_map_get_case with the header name
+ * @param u_map the _u_map to analyze
+ * @param header the known header name, U_HDR_CONTENT_TYPE, U_HDR_HOST, etc.
+ * @return the value corresponding to the first key inserted matching the header name, NULL if no match found
+ */
+const char * u_map_get_known(const struct _u_map * u_map, u_known_header header);
+
+/**
+ * Count the number of elements matching a known header name in the _u_map
+ * search is case insensitive, and faster than u_map_count_keys_case with the header name
+ * @param u_map the _u_map to analyze
+ * @param header the known header name, U_HDR_CONTENT_TYPE, U_HDR_HOST, etc.
+ * @return the number of keys matching the header name
+ */
+int u_map_count_known(const struct _u_map * u_map, u_known_header header);
+
 /**
  * Empty a struct u_map of all its elements
  * @param u_map the _u_map to empty
@@ -0,0 +1,302 @@
+/**
+ *
+ * Ulfius Framework
+ *
+ * REST framework library
+ *
+ * u_arena.c: per-request memory arena and request context pool functions definitions
+ *
+ * Copyright 2015-2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <u_private.h>
+#include <ulfius.h>
+
+/** Rounds size up to the arena alignment **/
+#define U_ARENA_ALIGN(size) (((size) + U_ARENA_ALIGNMENT - 1) & ~(U_ARENA_ALIGNMENT - 1))
+
+/** Size of a block header, the allocations start right after **/
+#define U_ARENA_BLOCK_HEADER_SIZE U_ARENA_ALIGN(sizeof(struct _u_arena_block))
+
+/** Address of the first byte available for allocations in a block **/
+#define U_ARENA_BLOCK_DATA(block) ((unsigned char *)(block) + U_ARENA_BLOCK_HEADER_SIZE)
+
+/**
+ * Allocate a new block with size bytes available
+ */
+static struct _u_arena_block * ulfius_arena_new_block(size_t size) {
+  struct _u_arena_block * block = o_malloc(U_ARENA_BLOCK_HEADER_SIZE + size);
+
+  if (block != NULL) {
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for arena block");
+  }
+  return block;
+}
+
+struct _u_arena * ulfius_arena_create(size_t block_size, size_t reserved_size) {
+  size_t arena_size = U_ARENA_ALIGN(sizeof(struct _u_arena)), first_size;
+  struct _u_arena_block * block;
+  struct _u_arena * arena = NULL;
+
+  if (block_size <= SIZE_MAX - U_ARENA_BLOCK_HEADER_SIZE - U_ARENA_ALIGNMENT &&
+      reserved_size <= SIZE_MAX - U_ARENA_BLOCK_HEADER_SIZE - U_ARENA_ALIGNMENT - arena_size) {
+    block_size = U_ARENA_ALIGN(block_size);
+    first_size = arena_size + U_ARENA_ALIGN(reserved_size);
+    // The arena itself is the first allocation of its first block, the reserved allocation comes right after
+    if ((block = ulfius_arena_new_block(block_size>first_size?block_size:first_size)) != NULL) {
+      arena = (struct _u_arena *)U_ARENA_BLOCK_DATA(block);
+      block->used = arena_size;
+      arena->block_size = block_size;
+      arena->reserved = first_size;
+      arena->blocks = block;
+    }
+  }
+  return arena;
+}
+
+void * ulfius_arena_alloc(struct _u_arena * arena, size_t size) {
+  struct _u_arena_block * block;
+  size_t aligned_size;
+  void * ptr = NULL;
+
+  if (arena != NULL && size && size <= SIZE_MAX - U_ARENA_BLOCK_HEADER_SIZE - U_ARENA_ALIGNMENT) {
+    aligned_size = U_ARENA_ALIGN(size);
+    block = arena->blocks;
+    if (aligned_size <= block->size - block->used) {
+      ptr = U_ARENA_BLOCK_DATA(block) + block->used;
+      block->used += aligned_size;
+    } else if (aligned_size > arena->block_size/4) {
+      // A large allocation has its own block, the current block is kept for the next allocations
+      if ((block = ulfius_arena_new_block(aligned_size)) != NULL) {
+        block->used = aligned_size;
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+        ptr = U_ARENA_BLOCK_DATA(block);
+      }
+    } else if ((block = ulfius_arena_new_block(arena->block_size)) != NULL) {
+      block->used = aligned_size;
+      block->next = arena->blocks;
+      arena->blocks = block;
+      ptr = U_ARENA_BLOCK_DATA(block);
+    }
+  }
+  return ptr;
+}
+
+char * ulfius_arena_strndup(struct _u_arena * arena, const char * str, size_t len) {
+  char * copy = NULL;
+
+  if (str != NULL && len < SIZE_MAX && (copy = ulfius_arena_alloc(arena, len+1)) != NULL) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+char * ulfius_arena_strdup(struct _u_arena * arena, const char * str) {
+  return ulfius_arena_strndup(arena, str, o_strlen(str));
+}
+
+void ulfius_arena_free(struct _u_arena * arena) {
+  struct _u_arena_block * block, * next;
+
+  if (arena != NULL) {
+    // The arena is free'd with its first block, so it's not used in the loop
+    for (block = arena->blocks; block != NULL; block = next) {
+      next = block->next;
+      o_free(block);
+    }
+  }
+}
+
+void ulfius_arena_reset(struct _u_arena * arena) {
+  struct _u_arena_block * first, * block, * next;
+
+  if (arena != NULL) {
+    first = (struct _u_arena_block *)((unsigned char *)arena - U_ARENA_BLOCK_HEADER_SIZE);
+    for (block = arena->blocks; block != NULL; block = next) {
+      next = block->next;
+      if (block != first) {
+        o_free(block);
+      }
+    }
+    first->next = NULL;
+    first->used = arena->reserved;
+    arena->blocks = first;
+  }
+}
+
+/**
+ * Set the connection info of a request context to its initial values
+ */
+static void ulfius_init_connection_info(struct connection_info_struct * con_info) {
+  con_info->u_instance = NULL;
+  con_info->post_processor = NULL;
+  con_info->has_post_processor = 0;
+  con_info->callback_first_iteration = 1;
+  con_info->max_post_param_size = 0;
+  con_info->connection = NULL;
+  con_info->suspend_lock = 0;
+  con_info->suspend_status = U_SUSPEND_STATUS_NONE;
+  con_info->resume_callback_ret = 0;
+  con_info->suspend_state = NULL;
+  con_info->body_callback = NULL;
+  con_info->body_user_data = NULL;
+  con_info->body_offset = 0;
+  con_info->body_status = U_BODY_STATUS_NONE;
+  con_info->body_callback_ret = U_CALLBACK_CONTINUE;
+  con_info->body_capacity = 0;
+  con_info->upload_file = NULL;
+  con_info->upload_file_allowed = 0;
+  con_info->upload_file_keep = 0;
+  con_info->upload_file_status = U_OK;
+  con_info->upload_file_paths = NULL;
+  con_info->nb_upload_file_paths = 0;
+}
+
+/**
+ * The request values allocated in the arena are free'd or discarded with the arena
+ */
+static void ulfius_detach_arena_request(struct _u_request * request) {
+  request->http_protocol = NULL;
+  request->http_verb = NULL;
+  request->http_url = NULL;
+  request->url_path = NULL;
+  request->client_address = NULL;
+}
+
+struct _u_request_context * ulfius_request_context_new(size_t block_size) {
+  struct _u_arena * arena = ulfius_arena_create(block_size, sizeof(struct _u_request_context));
+  struct _u_request_context * context = ulfius_arena_alloc(arena, sizeof(struct _u_request_context));
+
+  if (context != NULL) {
+    memset(context, 0, sizeof(struct _u_request_context));
+    if (ulfius_init_request(&context->request) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error initializing context->request");
+      ulfius_arena_free(arena);
+      context = NULL;
+    } else if (u_map_init(&context->con_info.map_url_initial) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error initializing context->con_info.map_url_initial");
+      ulfius_clean_request(&context->request);
+      ulfius_arena_free(arena);
+      context = NULL;
+    } else {
+      ulfius_init_connection_info(&context->con_info);
+      context->con_info.request = &context->request;
+      context->con_info.response = NULL;
+      context->con_info.arena = arena;
+      context->request.arena = arena;
+      context->next_pooled = NULL;
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for context");
+    ulfius_arena_free(arena);
+  }
+  return context;
+}
+
+int ulfius_request_context_recycle(struct _u_request_context * context) {
+  if (context != NULL) {
+    ulfius_detach_arena_request(&context->request);
+    if (ulfius_reset_request(&context->request) != U_OK ||
+        (context->con_info.response != NULL && ulfius_reset_response(context->con_info.response) != U_OK) ||
+        u_map_empty(&context->con_info.map_url_initial) != U_OK) {
+      return U_ERROR_MEMORY;
+    }
+    ulfius_arena_reset(context->con_info.arena);
+    ulfius_init_connection_info(&context->con_info);
+    context->request.arena = context->con_info.arena;
+    context->next_pooled = NULL;
+    return U_OK;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
+void ulfius_request_context_free(struct _u_request_context * context) {
+  if (context != NULL) {
+    ulfius_detach_arena_request(&context->request);
+    ulfius_clean_request(&context->request);
+    ulfius_clean_response(context->con_info.response);
+    u_map_clean(&context->con_info.map_url_initial);
+    // The context is free'd with its arena
+    ulfius_arena_free(context->con_info.arena);
+  }
+}
+
+struct _u_request_context * ulfius_pool_get(struct _u_pool * pool) {
+  struct _u_request_context * context = NULL;
+  struct _u_pool_shard * shard;
+  size_t start = U_ATOMIC_INCREMENT(&pool->next_shard), i;
+
+  // Empty or busy shards are skipped, a miss costs a new request context, not a wait
+  for (i=0; i<U_POOL_SHARDS && context == NULL; i++) {
+    shard = &pool->shards[(start+i)%U_POOL_SHARDS];
+    if (U_ATOMIC_LOAD(&shard->contexts) != NULL && !U_ATOMIC_TEST_AND_SET(&shard->lock)) {
+      if ((context = shard->contexts) != NULL) {
+        U_ATOMIC_STORE(&shard->contexts, context->next_pooled);
+        context->next_pooled = NULL;
+        U_ATOMIC_DECREMENT(&pool->retained);
+      }
+      U_ATOMIC_CLEAR(&shard->lock);
+    }
+  }
+  if (context != NULL) {
+    U_ATOMIC_INCREMENT(&pool->hits);
+  } else {
+    U_ATOMIC_INCREMENT(&pool->misses);
+  }
+  return context;
+}
+
+int ulfius_pool_put(struct _u_pool * pool, struct _u_request_context * context, size_t max_retained) {
+  struct _u_pool_shard * shard;
+  size_t i;
+
+  if (U_ATOMIC_INCREMENT(&pool->retained) > max_retained) {
+    U_ATOMIC_DECREMENT(&pool->retained);
+    return U_ERROR;
+  }
+  for (i = U_ATOMIC_INCREMENT(&pool->next_shard); U_ATOMIC_TEST_AND_SET(&pool->shards[i%U_POOL_SHARDS].lock); i++);
+  shard = &pool->shards[i%U_POOL_SHARDS];
+  context->next_pooled = shard->contexts;
+  U_ATOMIC_STORE(&shard->contexts, context);
+  U_ATOMIC_CLEAR(&shard->lock);
+  return U_OK;
+}
+
+void ulfius_pool_clean(struct _u_pool * pool) {
+  struct _u_request_context * context, * next;
+  size_t i;
+
+  if (pool != NULL) {
+    for (i=0; i<U_POOL_SHARDS; i++) {
+      for (context = pool->shards[i].contexts; context != NULL; context = next) {
+        next = context->next_pooled;
+        ulfius_request_context_free(context);
+      }
+      pool->shards[i].contexts = NULL;
+    }
+    pool->retained = 0;
+  }
+}
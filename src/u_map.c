@@ -24,62 +24,634 @@
  *
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <u_private.h>
 #include <ulfius.h>
 
-int u_map_init(struct _u_map * u_map) {
-  if (u_map != NULL) {
-    u_map->nb_values = 0;
-    u_map->values = NULL;
-    u_map->lengths = NULL;
-    u_map->keys = o_malloc(sizeof(char *));
-    if (u_map->keys == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->keys");
-      return U_ERROR_MEMORY;
+/** Allocated size of the values of a u_map, 0 if it's length + 1, stored right after its lengths array **/
+#define U_MAP_SIZES(u_map) ((u_map)->lengths + (u_map)->capacity)
+
+/** Ownership flags of the entries of a u_map, stored right after its sizes array **/
+#define U_MAP_FLAGS(u_map) ((unsigned char *)(U_MAP_SIZES(u_map) + (u_map)->capacity))
+
+/** Known header name of the entries of a u_map, u_known_header + 1 or 0, stored right after its flags array **/
+#define U_MAP_KNOWN(u_map) (U_MAP_FLAGS(u_map) + (u_map)->capacity)
+
+/** Return true if the entry at position in u_map was removed **/
+#define U_MAP_IS_REMOVED(u_map, position) (U_MAP_FLAGS(u_map)[position]&U_MAP_REMOVED)
+
+/** Key and value of the removed entries until the map is compacted **/
+static char u_map_removed_string[] = "";
+
+/** Slot of a key hash in the perfect hash table of the known header names **/
+#define U_MAP_KNOWN_SLOT(hash) (((hash) * 507767U) >> 25)
+
+/**
+ * Known header names, indexed by u_known_header, with their u_map_hash
+ */
+static const struct {
+  const char * name;
+  unsigned int hash;
+} u_map_known_headers[U_HDR_COUNT] = {
+  {"Accept", 136609321U},
+  {"Accept-Charset", 3664010344U},
+  {"Accept-Encoding", 3379649177U},
+  {"Accept-Language", 1979086614U},
+  {"Access-Control-Allow-Origin", 2710797292U},
+  {"Access-Control-Request-Headers", 3599549072U},
+  {"Access-Control-Request-Method", 2417078055U},
+  {"Allow", 2930878514U},
+  {"Authorization", 2436257726U},
+  {"Cache-Control", 1355326669U},
+  {"Connection", 951688921U},
+  {"Content-Disposition", 3889184348U},
+  {"Content-Encoding", 65203592U},
+  {"Content-Length", 1308181789U},
+  {"Content-Type", 4244048277U},
+  {"Cookie", 2007449791U},
+  {"Date", 3564297305U},
+  {"ETag", 113792960U},
+  {"Expect", 2530896728U},
+  {"Expires", 1049544579U},
+  {"Forwarded", 1485178027U},
+  {"Host", 2952701295U},
+  {"If-Match", 3597694698U},
+  {"If-Modified-Since", 2213050793U},
+  {"If-None-Match", 2536202615U},
+  {"If-Range", 2340978238U},
+  {"If-Unmodified-Since", 3794814858U},
+  {"Keep-Alive", 3784235904U},
+  {"Last-Modified", 3226950251U},
+  {"Location", 200649126U},
+  {"Origin", 3649018447U},
+  {"Pragma", 435832357U},
+  {"Proxy-Authorization", 2686392507U},
+  {"Range", 4208725202U},
+  {"Referer", 3969579366U},
+  {"Sec-WebSocket-Accept", 3796718979U},
+  {"Sec-WebSocket-Extensions", 994837441U},
+  {"Sec-WebSocket-Key", 3400920102U},
+  {"Sec-WebSocket-Protocol", 3585702139U},
+  {"Sec-WebSocket-Version", 84575969U},
+  {"Server", 1085029842U},
+  {"Set-Cookie", 1848371000U},
+  {"TE", 1011170994U},
+  {"Trailer", 2171596256U},
+  {"Transfer-Encoding", 3719590988U},
+  {"Upgrade", 3700935799U},
+  {"User-Agent", 606444526U},
+  {"Vary", 1085005381U},
+  {"Via", 1762798611U},
+  {"WWW-Authenticate", 779865858U},
+  {"X-Forwarded-For", 2914187656U},
+  {"X-Forwarded-Host", 679899239U},
+  {"X-Forwarded-Proto", 783462201U},
+  {"X-Requested-With", 1565851153U},
+};
+
+/**
+ * Perfect hash table of the known header names, a slot contains the u_known_header + 1 of a name or 0
+ */
+static const unsigned char u_map_known_slots[128] = {
+  0, 0, 19, 18, 39, 0, 29, 20, 0, 6, 0, 24, 51, 0, 14, 27,
+  47, 34, 0, 26, 0, 15, 16, 44, 0, 11, 0, 52, 0, 36, 0, 0,
+  0, 41, 21, 0, 0, 42, 25, 33, 0, 22, 0, 0, 0, 8, 0, 48,
+  37, 46, 43, 0, 0, 38, 35, 28, 9, 0, 0, 1, 0, 17, 30, 0,
+  0, 0, 0, 31, 5, 0, 0, 0, 0, 0, 0, 0, 0, 49, 13, 0,
+  0, 0, 50, 0, 0, 0, 0, 0, 3, 0, 0, 0, 32, 0, 0, 54,
+  10, 0, 0, 0, 0, 0, 0, 0, 53, 0, 12, 23, 0, 0, 0, 45,
+  0, 40, 0, 0, 0, 0, 2, 0, 0, 7, 0, 0, 0, 4, 0, 0
+};
+
+/**
+ * Case-insensitive FNV-1a hash of a key
+ */
+static unsigned int u_map_hash(const char * key) {
+  unsigned int hash = 2166136261U;
+  unsigned char c;
+
+  for (; *key != '\0'; key++) {
+    c = (unsigned char)*key;
+    if (c >= 'A' && c <= 'Z') {
+      c = (unsigned char)(c + ('a' - 'A'));
     }
-    u_map->keys[0] = NULL;
+    hash = (hash ^ c) * 16777619U;
+  }
+  return hash;
+}
 
-    u_map->values = o_malloc(sizeof(char *));
-    if (u_map->values == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
-      o_free(u_map->keys);
-      u_map->keys = NULL;
-      return U_ERROR_MEMORY;
+/**
+ * Return the u_known_header + 1 of a key with its u_map_hash, 0 if the key isn't a known header name
+ */
+static unsigned char u_map_known_id(const char * key, unsigned int hash) {
+  unsigned char known = u_map_known_slots[U_MAP_KNOWN_SLOT(hash)];
+
+  if (known && u_map_known_headers[known-1].hash == hash && 0 == o_strcasecmp(u_map_known_headers[known-1].name, key)) {
+    return known;
+  }
+  return 0;
+}
+
+/**
+ * Add the key at position in the hash index
+ * The index must have at least one free slot
+ */
+static void u_map_index_insert(struct _u_map_index * index, unsigned int hash, int position) {
+  size_t slot = hash & (index->size - 1);
+
+  while (index->slots[slot].position != U_MAP_SLOT_EMPTY) {
+    slot = (slot + 1) & (index->size - 1);
+  }
+  index->slots[slot].hash = hash;
+  index->slots[slot].position = position;
+}
+
+/**
+ * Build the hash index of the keys of u_map, with twice as many slots as the map capacity
+ * If the allocation fails, the map remains usable without index
+ */
+static void u_map_build_index(struct _u_map * u_map) {
+  struct _u_map_index * index;
+  size_t size = u_map->capacity * 2, i;
+
+  o_free(u_map->index);
+  u_map->index = NULL;
+  if ((index = o_malloc(sizeof(struct _u_map_index) + size*sizeof(struct _u_map_slot))) != NULL) {
+    index->size = size;
+    for (i=0; i<size; i++) {
+      index->slots[i].position = U_MAP_SLOT_EMPTY;
     }
-    u_map->values[0] = NULL;
+    for (i=0; i<(size_t)u_map->nb_values; i++) {
+      if (!U_MAP_IS_REMOVED(u_map, i)) {
+        u_map_index_insert(index, u_map_hash(u_map->keys[i]), (int)i);
+      }
+    }
+    u_map->index = index;
+  } else {
+    y_log_message(Y_LOG_LEVEL_WARNING, "Ulfius - Error allocating memory for u_map->index, keys are not indexed");
+  }
+}
+
+/**
+ * Return the position of the key in u_map, -1 if not found
+ * If case_insensitive is true, return the position of the first key inserted
+ * among the keys matching case-insensitively
+ */
+static int u_map_find(const struct _u_map * u_map, const char * key, int case_insensitive) {
+  const struct _u_map_index * index = (const struct _u_map_index *)u_map->index;
+  unsigned int hash;
+  size_t slot;
+  int i, position = -1;
+
+  if (index == NULL) {
+    for (i=0; i<u_map->nb_values; i++) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == (case_insensitive?o_strcasecmp(u_map->keys[i], key):o_strcmp(u_map->keys[i], key))) {
+        return i;
+      }
+    }
+  } else {
+    // The slots of the removed entries are kept until the map is compacted
+    hash = u_map_hash(key);
+    for (slot = hash & (index->size - 1); index->slots[slot].position != U_MAP_SLOT_EMPTY; slot = (slot + 1) & (index->size - 1)) {
+      i = index->slots[slot].position;
+      if (index->slots[slot].hash == hash && !U_MAP_IS_REMOVED(u_map, i) && (position == -1 || i < position)) {
+        if (!case_insensitive) {
+          // The keys are unique
+          if (0 == o_strcmp(u_map->keys[i], key)) {
+            return i;
+          }
+        } else if (0 == o_strcasecmp(u_map->keys[i], key)) {
+          position = i;
+        }
+      }
+    }
+  }
+  return position;
+}
+
+/**
+ * Return the position of the first key inserted matching the known header name in u_map, -1 if not found
+ */
+static int u_map_find_known(const struct _u_map * u_map, u_known_header header) {
+  const struct _u_map_index * index = (const struct _u_map_index *)u_map->index;
+  unsigned char known = (unsigned char)(header + 1);
+  size_t slot;
+  int i, position = -1;
+
+  if (index == NULL) {
+    for (i=0; i<u_map->nb_values; i++) {
+      if (U_MAP_KNOWN(u_map)[i] == known) {
+        return i;
+      }
+    }
+  } else {
+    for (slot = u_map_known_headers[header].hash & (index->size - 1); index->slots[slot].position != U_MAP_SLOT_EMPTY; slot = (slot + 1) & (index->size - 1)) {
+      i = index->slots[slot].position;
+      if (U_MAP_KNOWN(u_map)[i] == known && (position == -1 || i < position)) {
+        position = i;
+      }
+    }
+  }
+  return position;
+}
+
+/**
+ * Move the keys, values, lengths, flags and known arrays of u_map to a single allocation of capacity entries
+ * return U_OK on success
+ */
+static int u_map_resize_entries(struct _u_map * u_map, size_t capacity) {
+  char ** entries = o_malloc(capacity*(2*sizeof(char *)+2*sizeof(size_t)+2*sizeof(unsigned char)));
+
+  if (entries == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map entries");
+    return U_ERROR_MEMORY;
+  }
+  if (u_map->keys != NULL) {
+    // The NULL terminators are copied too
+    memcpy(entries, u_map->keys, ((size_t)u_map->nb_values+1)*sizeof(char *));
+    memcpy(entries+capacity, u_map->values, ((size_t)u_map->nb_values+1)*sizeof(char *));
+    memcpy(entries+2*capacity, u_map->lengths, ((size_t)u_map->nb_values+1)*sizeof(size_t));
+    memcpy((size_t *)(entries+2*capacity)+capacity, U_MAP_SIZES(u_map), ((size_t)u_map->nb_values+1)*sizeof(size_t));
+    memcpy((size_t *)(entries+2*capacity)+2*capacity, U_MAP_FLAGS(u_map), (size_t)u_map->nb_values+1);
+    memcpy((unsigned char *)((size_t *)(entries+2*capacity)+2*capacity)+capacity, U_MAP_KNOWN(u_map), (size_t)u_map->nb_values+1);
+    o_free(u_map->keys);
+  } else {
+    entries[0] = NULL;
+    entries[capacity] = NULL;
+    ((size_t *)(entries+2*capacity))[0] = 0;
+    ((size_t *)(entries+2*capacity))[capacity] = 0;
+    ((unsigned char *)((size_t *)(entries+2*capacity)+2*capacity))[0] = 0;
+    ((unsigned char *)((size_t *)(entries+2*capacity)+2*capacity))[capacity] = 0;
+  }
+  u_map->keys = entries;
+  u_map->values = entries+capacity;
+  u_map->lengths = (size_t *)(entries+2*capacity);
+  u_map->capacity = capacity;
+  return U_OK;
+}
+
+/**
+ * Remove the entries marked as removed from the arrays of u_map
+ * The other entries keep their order
+ */
+static void u_map_compact(struct _u_map * u_map) {
+  int i, j;
+
+  for (i=0, j=0; i<u_map->nb_values; i++) {
+    if (!U_MAP_IS_REMOVED(u_map, i)) {
+      if (i != j) {
+        u_map->keys[j] = u_map->keys[i];
+        u_map->values[j] = u_map->values[i];
+        u_map->lengths[j] = u_map->lengths[i];
+        U_MAP_SIZES(u_map)[j] = U_MAP_SIZES(u_map)[i];
+        U_MAP_FLAGS(u_map)[j] = U_MAP_FLAGS(u_map)[i];
+        U_MAP_KNOWN(u_map)[j] = U_MAP_KNOWN(u_map)[i];
+      }
+      j++;
+    }
+  }
+  u_map->nb_values = j;
+  u_map->nb_removed = 0;
+  u_map->keys[j] = NULL;
+  u_map->values[j] = NULL;
+  u_map->lengths[j] = 0;
+  U_MAP_SIZES(u_map)[j] = 0;
+  U_MAP_FLAGS(u_map)[j] = 0;
+  U_MAP_KNOWN(u_map)[j] = 0;
+  // The positions of the entries have changed
+  if (u_map->index != NULL) {
+    u_map_build_index(u_map);
+  }
+}
+
+/**
+ * Compact u_map when at least half of its entries are removed
+ */
+static void u_map_check_compact(struct _u_map * u_map) {
+  if (u_map->nb_removed && u_map->nb_removed*2 >= u_map->nb_values) {
+    u_map_compact(u_map);
+  }
+}
+
+/**
+ * Make room for count more values in u_map, the capacity is doubled until they fit
+ * return U_OK on success
+ */
+static int u_map_reserve(struct _u_map * u_map, size_t count) {
+  size_t capacity = u_map->capacity?u_map->capacity:U_MAP_INITIAL_CAPACITY;
+
+  // One more entry is needed for the NULL terminators
+  if ((size_t)u_map->nb_values + count < u_map->capacity) {
+    return U_OK;
+  }
+  // The removed entries are reused before the map grows
+  if (u_map->nb_removed) {
+    u_map_compact(u_map);
+    if ((size_t)u_map->nb_values + count < u_map->capacity) {
+      return U_OK;
+    }
+  }
+  while ((size_t)u_map->nb_values + count >= capacity) {
+    capacity *= 2;
+  }
+  if (u_map_resize_entries(u_map, capacity) != U_OK) {
+    return U_ERROR_MEMORY;
+  }
+  if (u_map->index != NULL) {
+    u_map_build_index(u_map);
+  }
+  return U_OK;
+}
+
+/**
+ * Allocate size bytes for a key or a value of u_map
+ * Short strings are stored one after the other in the slab of the map,
+ * the slab grows with blocks twice as large as the previous one
+ * Longer strings have their own allocation
+ */
+static char * u_map_alloc_string(struct _u_map * u_map, size_t size) {
+  struct _u_map_slab * slab = (struct _u_map_slab *)u_map->slab, * new_slab;
+  size_t slab_size;
+  char * str;
 
-    u_map->lengths = o_malloc(sizeof(size_t));
-    if (u_map->lengths == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->lengths");
-      o_free(u_map->keys);
-      o_free(u_map->values);
-      u_map->keys = NULL;
-      u_map->values = NULL;
+  if (size > U_MAP_INLINE_SIZE) {
+    str = o_malloc(size);
+  } else {
+    if (slab == NULL || slab->size - slab->used < size) {
+      slab_size = slab!=NULL?slab->size*2:U_MAP_SLAB_FIRST_SIZE;
+      if ((new_slab = o_malloc(sizeof(struct _u_map_slab) + slab_size)) == NULL) {
+        return NULL;
+      }
+      new_slab->next = slab;
+      new_slab->size = slab_size;
+      new_slab->used = 0;
+      u_map->slab = slab = new_slab;
+    }
+    str = slab->data + slab->used;
+    slab->used += size;
+  }
+  return str;
+}
+
+/**
+ * Duplicate length bytes of str in u_map and add a trailing '\0'
+ */
+static char * u_map_dup_string(struct _u_map * u_map, const char * str, size_t length) {
+  char * dup = u_map_alloc_string(u_map, length+1);
+
+  if (dup != NULL) {
+    memcpy(dup, str, length);
+    dup[length] = '\0';
+  }
+  return dup;
+}
+
+/**
+ * Return true if str is stored in the slab of u_map
+ */
+static int u_map_is_inline(const struct _u_map * u_map, const char * str) {
+  const struct _u_map_slab * slab;
+
+  for (slab = (const struct _u_map_slab *)u_map->slab; slab != NULL; slab = slab->next) {
+    if ((uintptr_t)str >= (uintptr_t)slab->data && (uintptr_t)str < (uintptr_t)slab->data + slab->size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Free a key or a value of u_map, unless it's stored in the slab
+ */
+static void u_map_free_string(struct _u_map * u_map, char * str) {
+  if (!u_map_is_inline(u_map, str)) {
+    o_free(str);
+  }
+}
+
+/**
+ * Free the key and the value of the entry at index in u_map, unless they are borrowed
+ */
+static void u_map_free_entry(struct _u_map * u_map, int index) {
+  if (!(U_MAP_FLAGS(u_map)[index]&U_MAP_BORROWED_KEY)) {
+    u_map_free_string(u_map, u_map->keys[index]);
+  }
+  if (!(U_MAP_FLAGS(u_map)[index]&U_MAP_BORROWED_VALUE)) {
+    u_map_free_string(u_map, u_map->values[index]);
+  }
+}
+
+/**
+ * Free the key and the value of the entry at position in u_map and mark the entry as removed
+ * The entry stays in the arrays until the map is compacted, so the other entries don't move
+ */
+static void u_map_remove_entry(struct _u_map * u_map, int position) {
+  u_map_free_entry(u_map, position);
+  u_map->keys[position] = u_map_removed_string;
+  u_map->values[position] = u_map_removed_string;
+  u_map->lengths[position] = 0;
+  U_MAP_SIZES(u_map)[position] = 0;
+  U_MAP_FLAGS(u_map)[position] = U_MAP_REMOVED|U_MAP_BORROWED_KEY|U_MAP_BORROWED_VALUE;
+  U_MAP_KNOWN(u_map)[position] = 0;
+  u_map->nb_removed++;
+}
+
+/**
+ * Add a new entry at the end of u_map, u_map_reserve must have been called before
+ */
+static void u_map_append_entry(struct _u_map * u_map, char * key, char * value, size_t length, unsigned char flags) {
+  int i = u_map->nb_values;
+  unsigned int hash = u_map_hash(key);
+
+  u_map->keys[i] = key;
+  u_map->keys[i+1] = NULL;
+  u_map->values[i] = value;
+  u_map->values[i+1] = NULL;
+  u_map->lengths[i] = length;
+  u_map->lengths[i+1] = 0;
+  U_MAP_SIZES(u_map)[i] = 0;
+  U_MAP_SIZES(u_map)[i+1] = 0;
+  U_MAP_FLAGS(u_map)[i] = flags;
+  U_MAP_FLAGS(u_map)[i+1] = 0;
+  // The known header names are interned when the key is added
+  U_MAP_KNOWN(u_map)[i] = u_map_known_id(key, hash);
+  U_MAP_KNOWN(u_map)[i+1] = 0;
+  u_map->nb_values++;
+
+  if (u_map->index != NULL) {
+    u_map_index_insert((struct _u_map_index *)u_map->index, hash, i);
+  } else if (u_map->nb_values > U_MAP_INDEX_THRESHOLD) {
+    u_map_build_index(u_map);
+  }
+}
+
+/**
+ * Free the strings of u_map, then its slab blocks
+ * The current slab block is kept for the next values if keep_slab is true
+ */
+static void u_map_free_strings(struct _u_map * u_map, int keep_slab) {
+  struct _u_map_slab * slab, * next;
+  int i;
+
+  for (i=0; i<u_map->nb_values; i++) {
+    u_map_free_entry(u_map, i);
+  }
+  slab = (struct _u_map_slab *)u_map->slab;
+  if (keep_slab && slab != NULL) {
+    slab->used = 0;
+    next = slab->next;
+    slab->next = NULL;
+    slab = next;
+  } else {
+    u_map->slab = NULL;
+  }
+  for (; slab != NULL; slab = next) {
+    next = slab->next;
+    o_free(slab);
+  }
+}
+
+/**
+ * Return true if the value at position in the base of u_map isn't overridden by a value of u_map
+ */
+static int u_map_base_visible(const struct _u_map * u_map, int position) {
+  return !U_MAP_IS_REMOVED(u_map->base, position) && u_map_find(u_map, u_map->base->keys[position], 0) == -1;
+}
+
+/**
+ * Copy the values of the base of u_map that aren't overridden before the values of u_map, then detach the base
+ * The keys and values of the base are duplicated, so the base may be unfrozen or free'd afterwards,
+ * the values keep the order given by u_map_iter_next
+ * return U_OK on success
+ */
+static int u_map_detach_base(struct _u_map * u_map) {
+  const struct _u_map * base = u_map->base;
+  unsigned char * visible = NULL;
+  char ** dup = NULL;
+  size_t count = 0, nb_entries;
+  int i, j, ret = U_OK;
+
+  if (base != NULL && base->nb_values) {
+    if ((visible = o_malloc((size_t)base->nb_values)) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map base");
       return U_ERROR_MEMORY;
     }
-    u_map->lengths[0] = 0;
+    for (i=0; i<base->nb_values; i++) {
+      visible[i] = (unsigned char)u_map_base_visible(u_map, i);
+      count += visible[i];
+    }
+    if (count && ((dup = o_malloc(2*count*sizeof(char *))) == NULL || u_map_reserve(u_map, count) != U_OK)) {
+      o_free(visible);
+      o_free(dup);
+      return U_ERROR_MEMORY;
+    }
+    // The keys and values are duplicated before u_map is modified, so u_map is unchanged on error
+    for (i=0, j=0; count && i<base->nb_values; i++) {
+      if (visible[i]) {
+        dup[2*j] = u_map_dup_string(u_map, base->keys[i], o_strlen(base->keys[i]));
+        dup[2*j+1] = u_map_dup_string(u_map, base->values[i], base->lengths[i]);
+        if (dup[2*j] == NULL || dup[2*j+1] == NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map base values");
+          for (j=2*j+1; j>=0; j--) {
+            if (dup[j] != NULL) {
+              u_map_free_string(u_map, dup[j]);
+            }
+          }
+          ret = U_ERROR_MEMORY;
+          break;
+        }
+        j++;
+      }
+    }
+    if (count && ret == U_OK) {
+      // The values of u_map, with their NULL terminators, move after the values of the base
+      nb_entries = (size_t)u_map->nb_values+1;
+      memmove(u_map->keys+count, u_map->keys, nb_entries*sizeof(char *));
+      memmove(u_map->values+count, u_map->values, nb_entries*sizeof(char *));
+      memmove(u_map->lengths+count, u_map->lengths, nb_entries*sizeof(size_t));
+      memmove(U_MAP_SIZES(u_map)+count, U_MAP_SIZES(u_map), nb_entries*sizeof(size_t));
+      memmove(U_MAP_FLAGS(u_map)+count, U_MAP_FLAGS(u_map), nb_entries);
+      memmove(U_MAP_KNOWN(u_map)+count, U_MAP_KNOWN(u_map), nb_entries);
+      for (i=0, j=0; i<base->nb_values; i++) {
+        if (visible[i]) {
+          u_map->keys[j] = dup[2*j];
+          u_map->values[j] = dup[2*j+1];
+          u_map->lengths[j] = base->lengths[i];
+          U_MAP_SIZES(u_map)[j] = 0;
+          U_MAP_FLAGS(u_map)[j] = 0;
+          U_MAP_KNOWN(u_map)[j] = U_MAP_KNOWN(base)[i];
+          j++;
+        }
+      }
+      u_map->nb_values += (int)count;
+      if (u_map->index != NULL || u_map->nb_values > U_MAP_INDEX_THRESHOLD) {
+        u_map_build_index(u_map);
+      }
+    }
+    o_free(visible);
+    o_free(dup);
+  }
+  if (ret == U_OK) {
+    u_map->base = NULL;
+  }
+  return ret;
+}
 
+/**
+ * Check that u_map can be modified, the base of u_map is detached if detach_base is true
+ * return U_OK on success
+ */
+static int u_map_prepare_write(struct _u_map * u_map, int detach_base) {
+  if (u_map->frozen) {
+    return U_ERROR_PARAMS;
+  } else if (detach_base && u_map->base != NULL) {
+    return u_map_detach_base(u_map);
+  } else {
     return U_OK;
+  }
+}
+
+int u_map_init(struct _u_map * u_map) {
+  if (u_map != NULL) {
+    u_map->nb_values = 0;
+    u_map->nb_removed = 0;
+    u_map->capacity = 0;
+    u_map->index = NULL;
+    u_map->slab = NULL;
+    u_map->base = NULL;
+    u_map->frozen = 0;
+    u_map->enum_keys = NULL;
+    u_map->enum_values = NULL;
+    u_map->keys = NULL;
+    u_map->values = NULL;
+    u_map->lengths = NULL;
+    return u_map_resize_entries(u_map, U_MAP_INITIAL_CAPACITY);
   } else {
     return U_ERROR_PARAMS;
   }
 }
 
 int u_map_clean(struct _u_map * u_map) {
-  int i;
   if (u_map != NULL) {
-    for (i=0; i<u_map->nb_values; i++) {
-      o_free(u_map->keys[i]);
-      o_free(u_map->values[i]);
-    }
+    u_map_free_strings(u_map, 0);
+    // The values and the lengths share the allocation of the keys
     o_free(u_map->keys);
-    o_free(u_map->values);
-    o_free(u_map->lengths);
+    o_free(u_map->index);
+    o_free(u_map->enum_keys);
+    o_free(u_map->enum_values);
+    u_map->enum_keys = NULL;
+    u_map->enum_values = NULL;
     u_map->keys = NULL;
     u_map->values = NULL;
     u_map->lengths = NULL;
+    u_map->index = NULL;
+    u_map->nb_values = 0;
+    u_map->nb_removed = 0;
+    u_map->capacity = 0;
+    u_map->base = NULL;
+    u_map->frozen = 0;
     return U_OK;
   } else {
     return U_ERROR_PARAMS;
@@ -109,22 +681,105 @@ int u_map_clean_enum(char ** array) {
   }
 }
 
+/**
+ * Return the keys, or the values if values is true, of u_map and its base
+ * If u_map has no base and no removed values, its arrays are returned as is,
+ * otherwise the visible keys or values are gathered in an array kept in u_map until the next enum or u_map_clean,
+ * the keys, the values and the arrays of u_map aren't modified
+ * return NULL on error
+ */
+static const char ** u_map_enum(const struct _u_map * u_map, int values) {
+  struct _u_map * enum_map = (struct _u_map *)u_map;
+  char *** cache, ** array;
+  int i, j = 0, nb_base;
+
+  if (u_map == NULL) {
+    return NULL;
+  } else if (u_map->base == NULL && !u_map->nb_removed) {
+    // A frozen map always takes this path, so it can be enumerated by several threads
+    return (const char **)(values?u_map->values:u_map->keys);
+  }
+  nb_base = u_map->base!=NULL?u_map->base->nb_values:0;
+  if ((array = o_malloc(((size_t)(nb_base+u_map->nb_values)+1)*sizeof(char *))) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map_enum");
+    return NULL;
+  }
+  // Same order as u_map_iter_next
+  for (i=0; i<nb_base+u_map->nb_values; i++) {
+    if (i < nb_base && u_map_base_visible(u_map, i)) {
+      array[j++] = values?u_map->base->values[i]:u_map->base->keys[i];
+    } else if (i >= nb_base && !U_MAP_IS_REMOVED(u_map, i-nb_base)) {
+      array[j++] = values?u_map->values[i-nb_base]:u_map->keys[i-nb_base];
+    }
+  }
+  array[j] = NULL;
+  // Only the array of the previous enum is replaced, the values of the map aren't changed
+  cache = values?&enum_map->enum_values:&enum_map->enum_keys;
+  o_free(*cache);
+  *cache = array;
+  return (const char **)array;
+}
+
 const char ** u_map_enum_keys(const struct _u_map * u_map) {
-  return (const char **)u_map->keys;
+  return u_map_enum(u_map, 0);
 }
 
 const char ** u_map_enum_values(const struct _u_map * u_map) {
-  return (const char **)u_map->values;
+  return u_map_enum(u_map, 1);
 }
 
-int u_map_has_key(const struct _u_map * u_map, const char * key) {
-  int i;
-  if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcmp(u_map->keys[i], key)) {
+int u_map_iter_begin(const struct _u_map * u_map, struct _u_map_iter * iter) {
+  if (iter != NULL) {
+    iter->u_map = u_map;
+    iter->position = 0;
+    iter->key = NULL;
+    iter->value = NULL;
+    iter->length = 0;
+    return u_map!=NULL?U_OK:U_ERROR_PARAMS;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
+/**
+ * Set the current value of iter to the value at position in u_map
+ */
+static void u_map_iter_set(struct _u_map_iter * iter, const struct _u_map * u_map, int position) {
+  iter->key = u_map->keys[position];
+  iter->value = u_map->lengths[position]?u_map->values[position]:NULL;
+  iter->length = u_map->lengths[position];
+}
+
+int u_map_iter_next(struct _u_map_iter * iter) {
+  const struct _u_map * u_map;
+  int i, nb_base;
+
+  if (iter != NULL && (u_map = iter->u_map) != NULL) {
+    // The values of the base that aren't overridden come first, then the values of the map
+    // The removed values are skipped, the map isn't compacted, so it can be const
+    nb_base = u_map->base!=NULL?u_map->base->nb_values:0;
+    for (i=iter->position; i<nb_base+u_map->nb_values; i++) {
+      if (i < nb_base && u_map_base_visible(u_map, i)) {
+        iter->position = i+1;
+        u_map_iter_set(iter, u_map->base, i);
+        return 1;
+      } else if (i >= nb_base && !U_MAP_IS_REMOVED(u_map, i-nb_base)) {
+        iter->position = i+1;
+        u_map_iter_set(iter, u_map, i-nb_base);
         return 1;
       }
     }
+    iter->position = nb_base+u_map->nb_values;
+    iter->key = NULL;
+    iter->value = NULL;
+    iter->length = 0;
+  }
+  return 0;
+}
+
+int u_map_has_key(const struct _u_map * u_map, const char * key) {
+  if (u_map != NULL && key != NULL) {
+    return u_map_find(u_map, key, 0) != -1 || u_map_has_key(u_map->base, key);
   }
   return 0;
 }
@@ -137,7 +792,12 @@ int u_map_has_value_binary(const struct _u_map * u_map, const char * value, size
   int i;
   if (u_map != NULL && value != NULL) {
     for (i=0; u_map->values[i] != NULL; i++) {
-      if (0 == memcmp(u_map->values[i], value, length)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == memcmp(u_map->values[i], value, length)) {
+        return 1;
+      }
+    }
+    for (i=0; u_map->base != NULL && i<u_map->base->nb_values; i++) {
+      if (0 == memcmp(u_map->base->values[i], value, length) && u_map_base_visible(u_map, i)) {
         return 1;
       }
     }
@@ -145,6 +805,32 @@ int u_map_has_value_binary(const struct _u_map * u_map, const char * value, size
   return 0;
 }
 
+/**
+ * Replace the value of the entry at index in u_map by length bytes of value
+ * value is borrowed if borrow is true, otherwise it's duplicated
+ * return U_OK on success
+ */
+static int u_map_replace_value(struct _u_map * u_map, int index, const char * value, size_t length, int borrow) {
+  char * new_value = (char *)value;
+
+  if (!borrow && (new_value = u_map_dup_string(u_map, value, length)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
+    return U_ERROR_MEMORY;
+  }
+  if (!(U_MAP_FLAGS(u_map)[index]&U_MAP_BORROWED_VALUE)) {
+    u_map_free_string(u_map, u_map->values[index]);
+  }
+  u_map->values[index] = new_value;
+  u_map->lengths[index] = length;
+  U_MAP_SIZES(u_map)[index] = 0;
+  if (borrow) {
+    U_MAP_FLAGS(u_map)[index] |= U_MAP_BORROWED_VALUE;
+  } else {
+    U_MAP_FLAGS(u_map)[index] &= (unsigned char)~U_MAP_BORROWED_VALUE;
+  }
+  return U_OK;
+}
+
 int u_map_put(struct _u_map * u_map, const char * key, const char * value) {
   if (value != NULL) {
     return u_map_put_binary(u_map, key, value, 0, o_strlen(value)+1);
@@ -154,88 +840,109 @@ int u_map_put(struct _u_map * u_map, const char * key, const char * value) {
 }
 
 int u_map_put_binary(struct _u_map * u_map, const char * key, const char * value, uint64_t offset, size_t length) {
-  size_t i;
+  int i, j;
+  size_t size, allocated;
   char * dup_key, * dup_value;
-  if (u_map != NULL && key != NULL && !o_strnullempty(key) && (offset+length+1) <= SIZE_MAX) {
-    for (i=0; i < (size_t)u_map->nb_values; i++) {
-      if (0 == o_strcmp(u_map->keys[i], key)) {
-        // Key already exist, extend and/or replace value
-        if (u_map->lengths[i] < (offset + length)) {
-          u_map->values[i] = o_realloc(u_map->values[i], (size_t)(offset + length + 1));
-          if (u_map->values[i] == NULL) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
-            return U_ERROR_MEMORY;
-          }
+  if (u_map != NULL && !u_map->frozen && key != NULL && !o_strnullempty(key) && (offset+length+1) <= SIZE_MAX) {
+    i = u_map_find(u_map, key, 0);
+    if (i == -1 && u_map->base != NULL && (j = u_map_find(u_map->base, key, 0)) != -1) {
+      // The value of the base is overridden by a borrowed copy, copied below before it's modified,
+      // the key is duplicated, so the entry doesn't depend on the base after it's detached
+      if (u_map_reserve(u_map, 1) != U_OK || (dup_key = u_map_dup_string(u_map, u_map->base->keys[j], o_strlen(u_map->base->keys[j]))) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for dup_key");
+        return U_ERROR_MEMORY;
+      }
+      u_map_append_entry(u_map, dup_key, u_map->base->values[j], u_map->base->lengths[j], U_MAP_BORROWED_VALUE);
+      i = u_map->nb_values-1;
+    }
+    if (i != -1) {
+      // Key already exist, extend and/or replace value
+      allocated = U_MAP_SIZES(u_map)[i]?U_MAP_SIZES(u_map)[i]:u_map->lengths[i]+1;
+      if (value != NULL && (allocated < (offset + length + 1) || U_MAP_FLAGS(u_map)[i]&U_MAP_BORROWED_VALUE)) {
+        size = u_map->lengths[i] < (offset + length)?(size_t)(offset + length + 1):u_map->lengths[i] + 1;
+        if (allocated < size) {
+          // The value grows geometrically, so appending chunks at increasing offsets is amortized linear
+          size = (allocated <= SIZE_MAX/2 && allocated*2 > size)?allocated*2:size;
         }
-        if (value != NULL) {
-          memcpy(u_map->values[i]+offset, value, length);
-          if (u_map->lengths[i] < (offset + length)) {
-            u_map->lengths[i] = (size_t)(offset + length);
-            *(u_map->values[i]+offset+length) = '\0';
+        if (U_MAP_FLAGS(u_map)[i]&U_MAP_BORROWED_VALUE || u_map_is_inline(u_map, u_map->values[i])) {
+          // A borrowed value is copied before it's modified, a value stored in the slab can't grow in place
+          dup_value = u_map_alloc_string(u_map, size);
+          if (dup_value != NULL) {
+            memcpy(dup_value, u_map->values[i], u_map->lengths[i]);
+            dup_value[u_map->lengths[i]] = '\0';
           }
         } else {
-          o_free(u_map->values[i]);
-          u_map->values[i] = o_strdup("");
-          u_map->lengths[i] = 0;
+          dup_value = o_realloc(u_map->values[i], size);
         }
-        return U_OK;
+        if (dup_value == NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
+          return U_ERROR_MEMORY;
+        }
+        u_map->values[i] = dup_value;
+        U_MAP_SIZES(u_map)[i] = size;
+        U_MAP_FLAGS(u_map)[i] &= (unsigned char)~U_MAP_BORROWED_VALUE;
       }
-    }
-    if (u_map->values[i] == NULL) {
+      if (value != NULL) {
+        memcpy(u_map->values[i]+offset, value, length);
+        if (u_map->lengths[i] < (offset + length)) {
+          u_map->lengths[i] = (size_t)(offset + length);
+          *(u_map->values[i]+offset+length) = '\0';
+        }
+      } else {
+        if ((dup_value = u_map_dup_string(u_map, "", 0)) == NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
+          return U_ERROR_MEMORY;
+        }
+        if (!(U_MAP_FLAGS(u_map)[i]&U_MAP_BORROWED_VALUE)) {
+          u_map_free_string(u_map, u_map->values[i]);
+        }
+        u_map->values[i] = dup_value;
+        u_map->lengths[i] = 0;
+        U_MAP_SIZES(u_map)[i] = 0;
+        U_MAP_FLAGS(u_map)[i] &= (unsigned char)~U_MAP_BORROWED_VALUE;
+      }
+    } else {
       // Not found, add key/value
-      dup_key = o_strdup(key);
+      if (u_map_reserve(u_map, 1) != U_OK) {
+        return U_ERROR_MEMORY;
+      }
+      dup_key = u_map_dup_string(u_map, key, o_strlen(key));
       if (dup_key == NULL) {
         y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for dup_key");
         return U_ERROR_MEMORY;
       }
       if (value != NULL) {
-        dup_value = o_malloc((size_t)(offset + length + 1));
-        if (dup_value == NULL) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for dup_value");
-          o_free(dup_key);
-          return U_ERROR_MEMORY;
+        dup_value = u_map_alloc_string(u_map, (size_t)(offset + length + 1));
+        if (dup_value != NULL) {
+          memcpy((dup_value + offset), value, length);
+          *(dup_value + offset + length) = '\0';
         }
-        memcpy((dup_value + offset), value, length);
-        *(dup_value + offset + length) = '\0';
       } else {
-        dup_value = o_strdup("");
-      }
-
-      // Append key
-      for (i = 0; u_map->keys[i] != NULL; i++);
-      u_map->keys = o_realloc(u_map->keys, (i + 2)*sizeof(char *));
-      if (u_map->keys == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->keys");
-        o_free(dup_key);
-        o_free(dup_value);
-        return U_ERROR_MEMORY;
+        dup_value = u_map_dup_string(u_map, "", 0);
       }
-      u_map->keys[i] = (char *)dup_key;
-      u_map->keys[i+1] = NULL;
-
-      // Append value
-      u_map->values = o_realloc(u_map->values, (i + 2)*sizeof(char *));
-      if (u_map->values == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
-        o_free(dup_key);
-        o_free(dup_value);
+      if (dup_value == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for dup_value");
+        u_map_free_string(u_map, dup_key);
         return U_ERROR_MEMORY;
       }
-      u_map->values[i] = dup_value;
-      u_map->values[i+1] = NULL;
+      u_map_append_entry(u_map, dup_key, dup_value, (size_t)(offset + length), 0);
+    }
+    return U_OK;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
 
-      // Append length
-      u_map->lengths = o_realloc(u_map->lengths, (i + 2)*sizeof(size_t));
-      if (u_map->lengths == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->lengths");
-        o_free(dup_key);
-        o_free(dup_value);
-        return U_ERROR_MEMORY;
-      }
-      u_map->lengths[i] = (size_t)(offset + length);
-      u_map->lengths[i+1] = 0;
+int u_map_put_borrowed(struct _u_map * u_map, const char * key, const char * value) {
+  int i;
 
-      u_map->nb_values++;
+  if (u_map != NULL && !u_map->frozen && key != NULL && !o_strnullempty(key) && value != NULL) {
+    if ((i = u_map_find(u_map, key, 0)) != -1) {
+      u_map_replace_value(u_map, i, value, o_strlen(value)+1, 1);
+    } else if (u_map_reserve(u_map, 1) == U_OK) {
+      u_map_append_entry(u_map, (char *)key, (char *)value, o_strlen(value)+1, U_MAP_BORROWED_KEY|U_MAP_BORROWED_VALUE);
+    } else {
+      return U_ERROR_MEMORY;
     }
     return U_OK;
   } else {
@@ -244,44 +951,37 @@ int u_map_put_binary(struct _u_map * u_map, const char * key, const char * value
 }
 
 int u_map_remove_from_key(struct _u_map * u_map, const char * key) {
-  int i, res, found = 0;
+  int i;
 
   if (u_map == NULL || key == NULL) {
     return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
+  } else if ((i = u_map_find(u_map, key, 0)) != -1) {
+    u_map_remove_entry(u_map, i);
+    u_map_check_compact(u_map);
+    return U_OK;
   } else {
-    for (i = u_map->nb_values-1; i >= 0; i--) {
-      if (0 == o_strcmp(u_map->keys[i], key)) {
-        found = 1;
-        res = u_map_remove_at(u_map, i);
-        if (res != U_OK) {
-          return res;
-        }
-      }
-    }
-    if (found) {
-      return U_OK;
-    } else {
-      return U_ERROR_NOT_FOUND;
-    }
+    return U_ERROR_NOT_FOUND;
   }
 }
 
 int u_map_remove_from_key_case(struct _u_map * u_map, const char * key) {
-  int i, res, found = 0;
+  int i, found = 0;
 
   if (u_map == NULL || key == NULL) {
     return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
   } else {
     for (i = u_map->nb_values-1; i >= 0; i--) {
-      if (0 == o_strcasecmp(u_map->keys[i], key)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == o_strcasecmp(u_map->keys[i], key)) {
         found = 1;
-        res = u_map_remove_at(u_map, i);
-        if (res != U_OK) {
-          return res;
-        }
+        u_map_remove_entry(u_map, i);
       }
     }
     if (found) {
+      u_map_check_compact(u_map);
       return U_OK;
     } else {
       return U_ERROR_NOT_FOUND;
@@ -294,21 +994,21 @@ int u_map_remove_from_value(struct _u_map * u_map, const char * value) {
 }
 
 int u_map_remove_from_value_binary(struct _u_map * u_map, const char * value, size_t length) {
-  int i, res, found = 0;
+  int i, found = 0;
 
   if (u_map == NULL || value == NULL) {
     return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
   } else {
     for (i = u_map->nb_values-1; i >= 0; i--) {
-      if (0 == memcmp(u_map->values[i], value, length)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == memcmp(u_map->values[i], value, length)) {
         found = 1;
-        res = u_map_remove_at(u_map, i);
-        if (res != U_OK) {
-          return res;
-        }
+        u_map_remove_entry(u_map, i);
       }
     }
     if (found) {
+      u_map_check_compact(u_map);
       return U_OK;
     } else {
       return U_ERROR_NOT_FOUND;
@@ -317,21 +1017,21 @@ int u_map_remove_from_value_binary(struct _u_map * u_map, const char * value, si
 }
 
 int u_map_remove_from_value_case(struct _u_map * u_map, const char * value) {
-  int i, res, found = 0;
+  int i, found = 0;
 
   if (u_map == NULL || value == NULL) {
     return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
   } else {
     for (i = u_map->nb_values-1; i >= 0; i--) {
-      if (0 == o_strcasecmp(u_map->values[i], value)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == o_strcasecmp(u_map->values[i], value)) {
         found = 1;
-        res = u_map_remove_at(u_map, i);
-        if (res != U_OK) {
-          return res;
-        }
+        u_map_remove_entry(u_map, i);
       }
     }
     if (found) {
+      u_map_check_compact(u_map);
       return U_OK;
     } else {
       return U_ERROR_NOT_FOUND;
@@ -340,66 +1040,88 @@ int u_map_remove_from_value_case(struct _u_map * u_map, const char * value) {
 }
 
 int u_map_remove_at(struct _u_map * u_map, const int index) {
-  int i;
+  int ret;
+
   if (u_map == NULL || index < 0) {
     return U_ERROR_PARAMS;
-  } else if (index >= u_map->nb_values) {
+  } else if ((ret = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return ret;
+  } else if (index >= u_map->nb_values - u_map->nb_removed) {
     return U_ERROR_NOT_FOUND;
   } else {
-    o_free(u_map->keys[index]);
-    o_free(u_map->values[index]);
-    for (i = index; i < u_map->nb_values; i++) {
-      u_map->keys[i] = u_map->keys[i + 1];
-      u_map->values[i] = u_map->values[i + 1];
-      u_map->lengths[i] = u_map->lengths[i + 1];
-    }
-    u_map->keys = o_realloc(u_map->keys, (((size_t)u_map->nb_values)*sizeof(char *)));
-    if (u_map->keys == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->keys");
-      return U_ERROR_MEMORY;
+    // index is a position among the values left, the map is compacted so it's a position in the arrays too
+    if (u_map->nb_removed) {
+      u_map_compact(u_map);
     }
-    u_map->values = o_realloc(u_map->values, (((size_t)u_map->nb_values)*sizeof(char *)));
-    if (u_map->values == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->values");
-      return U_ERROR_MEMORY;
+    u_map_remove_entry(u_map, index);
+    u_map_check_compact(u_map);
+    return U_OK;
+  }
+}
+
+int u_map_remove_keys(struct _u_map * u_map, const char ** keys) {
+  int i, position, found = 0;
+
+  if (u_map == NULL || keys == NULL) {
+    return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
+  } else {
+    for (i=0; keys[i] != NULL; i++) {
+      if ((position = u_map_find(u_map, keys[i], 0)) != -1) {
+        found = 1;
+        u_map_remove_entry(u_map, position);
+      }
     }
-    u_map->lengths = o_realloc(u_map->lengths, (((size_t)u_map->nb_values)*sizeof(char *)));
-    if (u_map->lengths == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map->lengths");
-      return U_ERROR_MEMORY;
+    if (found) {
+      // The map is compacted once for all the keys
+      u_map_check_compact(u_map);
+      return U_OK;
+    } else {
+      return U_ERROR_NOT_FOUND;
     }
+  }
+}
 
-    u_map->nb_values--;
-    return U_OK;
+int u_map_remove_keys_case(struct _u_map * u_map, const char ** keys) {
+  int i, position, found = 0;
+
+  if (u_map == NULL || keys == NULL) {
+    return U_ERROR_PARAMS;
+  } else if ((i = u_map_prepare_write(u_map, 1)) != U_OK) {
+    return i;
+  } else {
+    for (i=0; keys[i] != NULL; i++) {
+      // The first key matching is removed until there's none left
+      while ((position = u_map_find(u_map, keys[i], 1)) != -1) {
+        found = 1;
+        u_map_remove_entry(u_map, position);
+      }
+    }
+    if (found) {
+      u_map_check_compact(u_map);
+      return U_OK;
+    } else {
+      return U_ERROR_NOT_FOUND;
+    }
   }
 }
 
 const char * u_map_get(const struct _u_map * u_map, const char * key) {
   int i;
-  if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcmp(u_map->keys[i], key)) {
-        if (u_map->lengths[i] > 0) {
-          return u_map->values[i];
-        } else {
-          return NULL;
-        }
-      }
-    }
-    return NULL;
+  if (u_map != NULL && key != NULL && (i = u_map_find(u_map, key, 0)) != -1) {
+    return u_map->lengths[i] > 0?u_map->values[i]:NULL;
+  } else if (u_map != NULL && key != NULL) {
+    // The base is looked up only if the map has no value for the key, otherwise the value of the base would be overridden
+    return u_map_get(u_map->base, key);
   } else {
     return NULL;
   }
 }
 
 int u_map_has_key_case(const struct _u_map * u_map, const char * key) {
-  int i;
   if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcasecmp(u_map->keys[i], key)) {
-        return 1;
-      }
-    }
+    return u_map_find(u_map, key, 1) != -1 || u_map_has_key_case(u_map->base, key);
   }
   return 0;
 }
@@ -408,7 +1130,12 @@ int u_map_has_value_case(const struct _u_map * u_map, const char * value) {
   int i;
   if (u_map != NULL && value != NULL) {
     for (i=0; u_map->values[i] != NULL; i++) {
-      if (0 == o_strcasecmp(u_map->values[i], value)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == o_strcasecmp(u_map->values[i], value)) {
+        return 1;
+      }
+    }
+    for (i=0; u_map->base != NULL && i<u_map->base->nb_values; i++) {
+      if (0 == o_strcasecmp(u_map->base->values[i], value) && u_map_base_visible(u_map, i)) {
         return 1;
       }
     }
@@ -418,13 +1145,10 @@ int u_map_has_value_case(const struct _u_map * u_map, const char * value) {
 
 const char * u_map_get_case(const struct _u_map * u_map, const char * key) {
   int i;
-  if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcasecmp(u_map->keys[i], key)) {
-        return u_map->values[i];
-      }
-    }
-    return NULL;
+  if (u_map != NULL && key != NULL && (i = u_map_find(u_map, key, 1)) != -1) {
+    return u_map->values[i];
+  } else if (u_map != NULL && key != NULL) {
+    return u_map_get_case(u_map->base, key);
   } else {
     return NULL;
   }
@@ -432,13 +1156,10 @@ const char * u_map_get_case(const struct _u_map * u_map, const char * key) {
 
 ssize_t u_map_get_length(const struct _u_map * u_map, const char * key) {
   int i;
-  if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcmp(u_map->keys[i], key)) {
-        return (ssize_t)u_map->lengths[i];
-      }
-    }
-    return -1;
+  if (u_map != NULL && key != NULL && (i = u_map_find(u_map, key, 0)) != -1) {
+    return (ssize_t)u_map->lengths[i];
+  } else if (u_map != NULL && key != NULL) {
+    return u_map_get_length(u_map->base, key);
   } else {
     return -1;
   }
@@ -446,13 +1167,10 @@ ssize_t u_map_get_length(const struct _u_map * u_map, const char * key) {
 
 ssize_t u_map_get_case_length(const struct _u_map * u_map, const char * key) {
   int i;
-  if (u_map != NULL && key != NULL) {
-    for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcasecmp(u_map->keys[i], key)) {
-        return (ssize_t)u_map->lengths[i];
-      }
-    }
-    return -1;
+  if (u_map != NULL && key != NULL && (i = u_map_find(u_map, key, 1)) != -1) {
+    return (ssize_t)u_map->lengths[i];
+  } else if (u_map != NULL && key != NULL) {
+    return u_map_get_case_length(u_map->base, key);
   } else {
     return -1;
   }
@@ -460,8 +1178,6 @@ ssize_t u_map_get_case_length(const struct _u_map * u_map, const char * key) {
 
 struct _u_map * u_map_copy(const struct _u_map * source) {
   struct _u_map * copy = NULL;
-  const char ** keys, * value;
-  int i;
   if (source != NULL) {
     copy = o_malloc(sizeof(struct _u_map));
     if (copy == NULL) {
@@ -473,41 +1189,124 @@ struct _u_map * u_map_copy(const struct _u_map * source) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_init for u_map_copy.copy");
       return NULL;
     }
-    keys = u_map_enum_keys(source);
-    for (i=0; keys != NULL && keys[i] != NULL; i++) {
-      value = u_map_get(source, keys[i]);
-      if (u_map_put_binary(copy, keys[i], value, 0, source->lengths[i]) != U_OK) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_put_binary for u_map_copy.copy");
-        u_map_clean_full(copy);
-        return NULL;
-      }
+    if (u_map_merge(copy, source, U_MAP_MERGE_OVERWRITE) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_merge for u_map_copy.copy");
+      u_map_clean_full(copy);
+      return NULL;
     }
   }
   return copy;
 }
 
 int u_map_copy_into(struct _u_map * dest, const struct _u_map * source) {
-  const char ** keys;
-  int i, res;
-
   if (source != NULL && dest != NULL) {
-    keys = u_map_enum_keys(source);
-    for (i=0; keys != NULL && keys[i] != NULL; i++) {
-      res = u_map_put(dest, keys[i], u_map_get(source, keys[i]));
-      if (res != U_OK) {
-        return res;
+    return u_map_merge(dest, source, U_MAP_MERGE_OVERWRITE);
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
+/**
+ * Merge the values of source into dest, except the values overridden by a value of shadow if shadow isn't NULL
+ * dest must have room for all the values of source
+ * return U_OK on success
+ */
+static int u_map_merge_entries(struct _u_map * dest, const struct _u_map * source, const struct _u_map * shadow, int check_existing, int flags) {
+  int i, j, borrow = flags&U_MAP_MERGE_BORROW;
+  char * key, * value;
+
+  for (i=0; i<source->nb_values; i++) {
+    if (U_MAP_IS_REMOVED(source, i) || (shadow != NULL && u_map_find(shadow, source->keys[i], 0) != -1)) {
+      continue;
+    } else if (check_existing && (j = u_map_find(dest, source->keys[i], 0)) != -1) {
+      if (!(flags&U_MAP_MERGE_SKIP_EXISTING) && u_map_replace_value(dest, j, source->values[i], source->lengths[i], borrow) != U_OK) {
+        return U_ERROR_MEMORY;
       }
+    } else if ((flags&U_MAP_MERGE_SKIP_EXISTING) && u_map_has_key(dest->base, source->keys[i])) {
+      continue;
+    } else if (borrow) {
+      u_map_append_entry(dest, source->keys[i], source->values[i], source->lengths[i], U_MAP_BORROWED_KEY|U_MAP_BORROWED_VALUE);
+    } else {
+      key = u_map_dup_string(dest, source->keys[i], o_strlen(source->keys[i]));
+      value = u_map_dup_string(dest, source->values[i], source->lengths[i]);
+      if (key == NULL || value == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_map_merge");
+        u_map_free_string(dest, key);
+        u_map_free_string(dest, value);
+        return U_ERROR_MEMORY;
+      }
+      u_map_append_entry(dest, key, value, source->lengths[i], 0);
+    }
+  }
+  return U_OK;
+}
+
+int u_map_merge(struct _u_map * dest, const struct _u_map * source, int flags) {
+  size_t count;
+  int check_existing;
+
+  if (dest == NULL || source == NULL || dest == source || dest->frozen) {
+    return U_ERROR_PARAMS;
+  }
+  // dest grows once for all the values of source and its base
+  count = (size_t)source->nb_values + (source->base!=NULL?(size_t)source->base->nb_values:0);
+  if (count && u_map_reserve(dest, count) != U_OK) {
+    return U_ERROR_MEMORY;
+  }
+  // The keys of source are unique, they are looked up only if dest had values before
+  check_existing = dest->nb_values > 0;
+  if (source->base != NULL && u_map_merge_entries(dest, source->base, source, check_existing, flags) != U_OK) {
+    return U_ERROR_MEMORY;
+  }
+  return u_map_merge_entries(dest, source, NULL, check_existing, flags);
+}
+
+int u_map_freeze(struct _u_map * u_map) {
+  int ret;
+
+  if (u_map == NULL) {
+    return U_ERROR_PARAMS;
+  } else if (!u_map->frozen) {
+    // A frozen map has no base and no removed values, so the functions reading it never modify it
+    if ((ret = u_map_detach_base(u_map)) != U_OK) {
+      return ret;
+    }
+    if (u_map->nb_removed) {
+      u_map_compact(u_map);
     }
+    u_map->frozen = 1;
+  }
+  return U_OK;
+}
+
+int u_map_unfreeze(struct _u_map * u_map) {
+  if (u_map != NULL) {
+    u_map->frozen = 0;
     return U_OK;
   } else {
     return U_ERROR_PARAMS;
   }
 }
 
+int u_map_set_base(struct _u_map * u_map, const struct _u_map * base) {
+  if (u_map == NULL || u_map->frozen || u_map == base || (base != NULL && !base->frozen)) {
+    return U_ERROR_PARAMS;
+  } else {
+    u_map->base = base;
+    return U_OK;
+  }
+}
+
 int u_map_count(const struct _u_map * source) {
+  int i, count;
+
   if (source != NULL) {
     if (source->nb_values >= 0) {
-      return source->nb_values;
+      count = source->nb_values - source->nb_removed;
+      for (i=0; source->base != NULL && i<source->base->nb_values; i++) {
+        count += u_map_base_visible(source, i);
+      }
+      return count;
     }
   }
   return -1;
@@ -517,7 +1316,50 @@ int u_map_count_keys_case(const struct _u_map * u_map, const char * key) {
   int i, count = 0;
   if (u_map != NULL && key != NULL) {
     for (i=0; u_map->keys[i] != NULL; i++) {
-      if (0 == o_strcasecmp(u_map->keys[i], key)) {
+      if (!U_MAP_IS_REMOVED(u_map, i) && 0 == o_strcasecmp(u_map->keys[i], key)) {
+        count++;
+      }
+    }
+    for (i=0; u_map->base != NULL && i<u_map->base->nb_values; i++) {
+      if (0 == o_strcasecmp(u_map->base->keys[i], key) && u_map_base_visible(u_map, i)) {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+const char * u_map_get_known(const struct _u_map * u_map, u_known_header header) {
+  int i;
+  if (u_map != NULL && header >= 0 && header < U_HDR_COUNT && (i = u_map_find_known(u_map, header)) != -1) {
+    return u_map->values[i];
+  } else if (u_map != NULL) {
+    return u_map_get_known(u_map->base, header);
+  } else {
+    return NULL;
+  }
+}
+
+/**
+ * Return the number of keys matching the known header name in u_map,
+ * except the keys overridden by a key of shadow if shadow isn't NULL
+ */
+static int u_map_count_known_entries(const struct _u_map * u_map, u_known_header header, const struct _u_map * shadow) {
+  const struct _u_map_index * index;
+  unsigned char known = (unsigned char)(header + 1);
+  size_t slot;
+  int i, count = 0;
+
+  if ((index = (const struct _u_map_index *)u_map->index) == NULL) {
+    for (i=0; i<u_map->nb_values; i++) {
+      if (U_MAP_KNOWN(u_map)[i] == known && (shadow == NULL || u_map_find(shadow, u_map->keys[i], 0) == -1)) {
+        count++;
+      }
+    }
+  } else {
+    for (slot = u_map_known_headers[header].hash & (index->size - 1); index->slots[slot].position != U_MAP_SLOT_EMPTY; slot = (slot + 1) & (index->size - 1)) {
+      i = index->slots[slot].position;
+      if (U_MAP_KNOWN(u_map)[i] == known && (shadow == NULL || u_map_find(shadow, u_map->keys[i], 0) == -1)) {
         count++;
       }
     }
@@ -525,9 +1367,38 @@ int u_map_count_keys_case(const struct _u_map * u_map, const char * key) {
   return count;
 }
 
+int u_map_count_known(const struct _u_map * u_map, u_known_header header) {
+  int count = 0;
+
+  if (u_map != NULL && header >= 0 && header < U_HDR_COUNT) {
+    count = u_map_count_known_entries(u_map, header, NULL);
+    if (u_map->base != NULL) {
+      count += u_map_count_known_entries(u_map->base, header, u_map);
+    }
+  }
+  return count;
+}
+
 int u_map_empty(struct _u_map * u_map) {
-  int ret = u_map_clean(u_map);
-  if (ret == U_OK) {
+  int ret;
+  if (u_map != NULL && u_map->frozen) {
+    return U_ERROR_PARAMS;
+  } else if (u_map != NULL && u_map->keys != NULL && u_map->capacity <= U_MAP_MAX_KEPT_CAPACITY) {
+    // The arrays and the current slab block are kept for the next values
+    u_map_free_strings(u_map, ((struct _u_map_slab *)u_map->slab)==NULL || ((struct _u_map_slab *)u_map->slab)->size <= U_MAP_MAX_KEPT_SLAB_SIZE);
+    u_map->nb_values = 0;
+    u_map->nb_removed = 0;
+    u_map->keys[0] = NULL;
+    u_map->values[0] = NULL;
+    u_map->lengths[0] = 0;
+    U_MAP_SIZES(u_map)[0] = 0;
+    U_MAP_FLAGS(u_map)[0] = 0;
+    U_MAP_KNOWN(u_map)[0] = 0;
+    o_free(u_map->index);
+    u_map->index = NULL;
+    u_map->base = NULL;
+    return U_OK;
+  } else if ((ret = u_map_clean(u_map)) == U_OK) {
     return u_map_init(u_map);
   } else {
     return ret;
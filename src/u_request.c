@@ -35,159 +35,6 @@
 #define strtok_r strtok_s
 #endif
 
-/**
- * Splits the url to an array of char *
- */
-static char ** ulfius_split_url(const char * prefix, const char * url) {
-  char * saveptr = NULL, * cur_word = NULL, ** to_return = o_malloc(sizeof(char*)), * url_cpy = NULL, * url_cpy_addr = NULL;
-  size_t counter = 1;
-
-  if (to_return != NULL) {
-    to_return[0] = NULL;
-    if (prefix != NULL) {
-      url_cpy = url_cpy_addr = o_strdup(prefix);
-      cur_word = strtok_r( url_cpy, ULFIUS_URL_SEPARATOR, &saveptr );
-      while (cur_word != NULL) {
-        to_return = o_realloc(to_return, (counter+1)*sizeof(char*));
-        if (to_return == NULL) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for ulfius_split_url.to_return");
-          break;
-        }
-        to_return[counter-1] = o_strdup(cur_word);
-        if (to_return[counter-1] == NULL) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for ulfius_split_url.to_return[counter-1]");
-          break;
-        }
-        to_return[counter] = NULL;
-        counter++;
-        cur_word = strtok_r( NULL, ULFIUS_URL_SEPARATOR, &saveptr );
-      }
-      o_free(url_cpy_addr);
-      url_cpy_addr = NULL;
-    }
-    if (url != NULL) {
-      url_cpy = url_cpy_addr = o_strdup(url);
-      cur_word = strtok_r( url_cpy, ULFIUS_URL_SEPARATOR, &saveptr );
-      while (cur_word != NULL) {
-        if (0 != o_strcmp("", cur_word) && cur_word[0] != '?') {
-          to_return = o_realloc(to_return, (counter+1)*sizeof(char*));
-          if (to_return == NULL) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for ulfius_split_url.to_return");
-            break;
-          }
-          to_return[counter-1] = o_strdup(cur_word);
-          if (to_return[counter-1] == NULL) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for ulfius_split_url.to_return[counter-1]");
-            break;
-          }
-          to_return[counter] = NULL;
-          counter++;
-        }
-        cur_word = strtok_r( NULL, ULFIUS_URL_SEPARATOR, &saveptr );
-      }
-      o_free(url_cpy_addr);
-      url_cpy_addr = NULL;
-    }
-  } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for ulfius_split_url.to_return");
-  }
-  return to_return;
-}
-
-/**
- * Compare two endoints by their priorities
- * Used by qsort to compare endpoints
- */
-static int compare_endpoint_priorities(const void * a, const void * b) {
-  struct _u_endpoint * e1 = *(struct _u_endpoint **)a, * e2 = *(struct _u_endpoint **)b;
-
-  if (e1->priority < e2->priority) {
-    return -1;
-  } else if (e1->priority > e2->priority) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
-
-/**
- * ulfius_url_format_match
- * return true if splitted_url matches splitted_url_format
- * false otherwise
- */
-static int ulfius_url_format_match(const char ** splitted_url, const char ** splitted_url_format) {
-  int i;
-
-  for (i=0; splitted_url_format[i] != NULL; i++) {
-    if (splitted_url_format[i][0] == '*' && splitted_url_format[i+1] == NULL) {
-      return 1;
-    }
-    if (splitted_url[i] == NULL || (splitted_url_format[i][0] != '@' && splitted_url_format[i][0] != ':' && 0 != o_strcmp(splitted_url_format[i], splitted_url[i]))) {
-      return 0;
-    }
-  }
-  return (splitted_url[i] == NULL && splitted_url_format[i] == NULL);
-}
-
-/**
- * ulfius_endpoint_match
- * return the endpoint array matching the url called with the proper http method
- * the returned array always has its last value to NULL
- * return NULL on memory error
- * returned value must be free'd after use
- */
-struct _u_endpoint ** ulfius_endpoint_match(const char * method, const char * url, struct _u_endpoint * endpoint_list) {
-  char ** splitted_url, ** splitted_url_format;
-  struct _u_endpoint ** endpoint_returned = o_malloc(sizeof(struct _u_endpoint *));
-  int i;
-  size_t count = 0;
-
-  if (endpoint_returned == NULL) {
-    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for endpoint_returned");
-  } else {
-    endpoint_returned[0] = NULL;
-    if (method != NULL && url != NULL && endpoint_list != NULL) {
-      splitted_url = ulfius_split_url(url, NULL);
-      for (i=0; (splitted_url != NULL && !ulfius_equals_endpoints(&(endpoint_list[i]), ulfius_empty_endpoint())); i++) {
-        if (0 == o_strcasecmp(endpoint_list[i].http_method, method) || endpoint_list[i].http_method[0] == '*') {
-          splitted_url_format = ulfius_split_url(endpoint_list[i].url_prefix, endpoint_list[i].url_format);
-          if (splitted_url_format != NULL && ulfius_url_format_match((const char **)splitted_url, (const char **)splitted_url_format)) {
-            endpoint_returned = o_realloc(endpoint_returned, (count+2)*sizeof(struct _u_endpoint *));
-            if (endpoint_returned != NULL) {
-              endpoint_returned[count] = o_malloc(sizeof(struct _u_endpoint));
-              if (endpoint_returned[count] != NULL) {
-                if (ulfius_copy_endpoint(endpoint_returned[count], (endpoint_list + i)) != U_OK) {
-                  y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_copy_endpoint for endpoint_returned[%zu]", count);
-                }
-              } else {
-                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for endpoint_returned[%zu]", count);
-              }
-              endpoint_returned[count + 1] = NULL;
-            } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error reallocating memory for endpoint_returned");
-            }
-            count++;
-            u_map_clean_enum(splitted_url_format);
-            splitted_url_format = NULL;
-          }
-          u_map_clean_enum(splitted_url_format);
-          splitted_url_format = NULL;
-        }
-      }
-      u_map_clean_enum(splitted_url);
-      splitted_url = NULL;
-    }
-  }
-  /*
-   * only sort if endpoint_returned is != NULL
-   * can be NULL either after initial o_malloc() or after o_realloc()
-   */
-  if (endpoint_returned != NULL) {
-    qsort(endpoint_returned, count, sizeof(struct endpoint_list *), &compare_endpoint_priorities);
-  }
-  return endpoint_returned;
-}
-
 /**
  * ulfius_parse_url
  * fills map with the keys/values defined in the url that are described in the endpoint format url
@@ -259,6 +106,41 @@ int ulfius_parse_url(const char * url, const struct _u_endpoint * endpoint, stru
   }
 }
 
+/**
+ * Set the request elements other than the maps to their initial values
+ */
+static void ulfius_init_request_values(struct _u_request * request) {
+  request->auth_basic_user = NULL;
+  request->auth_basic_password = NULL;
+  request->http_protocol = NULL;
+  request->http_verb = NULL;
+  request->http_url = NULL;
+  request->url_path = NULL;
+  request->proxy = NULL;
+#if MHD_VERSION >= 0x00095208
+  request->network_type = U_USE_ALL;
+#endif
+  request->timeout = 0L;
+  request->check_server_certificate = 1;
+  request->check_server_certificate_flag = U_SSL_VERIFY_PEER|U_SSL_VERIFY_HOSTNAME;
+  request->check_proxy_certificate = 1;
+  request->check_proxy_certificate_flag = U_SSL_VERIFY_PEER|U_SSL_VERIFY_HOSTNAME;
+  request->follow_redirect = 0;
+  request->ca_path = NULL;
+  request->client_address = NULL;
+  request->binary_body = NULL;
+  request->binary_body_length = 0;
+  request->callback_position = 0;
+  request->arena = NULL;
+  request->body_handle = NULL;
+#ifndef U_DISABLE_GNUTLS
+  request->client_cert = NULL;
+  request->client_cert_file = NULL;
+  request->client_key_file = NULL;
+  request->client_key_password = NULL;
+#endif
+}
+
 /**
  * ulfius_init_request
  * Initialize a request structure by allocating inner elements
@@ -266,47 +148,25 @@ int ulfius_parse_url(const char * url, const struct _u_endpoint * endpoint, stru
  */
 int ulfius_init_request(struct _u_request * request) {
   if (request != NULL) {
+    ulfius_init_request_values(request);
     request->map_url = o_malloc(sizeof(struct _u_map));
-    request->auth_basic_user = NULL;
-    request->auth_basic_password = NULL;
     request->map_header = o_malloc(sizeof(struct _u_map));
     request->map_cookie = o_malloc(sizeof(struct _u_map));
     request->map_post_body = o_malloc(sizeof(struct _u_map));
+    request->map_upload_file = o_malloc(sizeof(struct _u_map));
+    // Initialize the allocated maps first so ulfius_clean_request can clean them on error
+    u_map_init(request->map_url);
+    u_map_init(request->map_header);
+    u_map_init(request->map_cookie);
+    u_map_init(request->map_post_body);
+    u_map_init(request->map_upload_file);
     if (request->map_post_body == NULL || request->map_cookie == NULL ||
-        request->map_url == NULL || request->map_header == NULL) {
+        request->map_url == NULL || request->map_header == NULL ||
+        request->map_upload_file == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for request->map*");
       ulfius_clean_request(request);
       return U_ERROR_MEMORY;
     }
-    u_map_init(request->map_url);
-    u_map_init(request->map_header);
-    u_map_init(request->map_cookie);
-    u_map_init(request->map_post_body);
-    request->http_protocol = NULL;
-    request->http_verb = NULL;
-    request->http_url = NULL;
-    request->url_path = NULL;
-    request->proxy = NULL;
-#if MHD_VERSION >= 0x00095208
-    request->network_type = U_USE_ALL;
-#endif
-    request->timeout = 0L;
-    request->check_server_certificate = 1;
-    request->check_server_certificate_flag = U_SSL_VERIFY_PEER|U_SSL_VERIFY_HOSTNAME;
-    request->check_proxy_certificate = 1;
-    request->check_proxy_certificate_flag = U_SSL_VERIFY_PEER|U_SSL_VERIFY_HOSTNAME;
-    request->follow_redirect = 0;
-    request->ca_path = NULL;
-    request->client_address = NULL;
-    request->binary_body = NULL;
-    request->binary_body_length = 0;
-    request->callback_position = 0;
-#ifndef U_DISABLE_GNUTLS
-    request->client_cert = NULL;
-    request->client_cert_file = NULL;
-    request->client_key_file = NULL;
-    request->client_key_password = NULL;
-#endif
     return U_OK;
   } else {
     return U_ERROR_PARAMS;
@@ -335,6 +195,7 @@ int ulfius_clean_request(struct _u_request * request) {
     u_map_clean_full(request->map_header);
     u_map_clean_full(request->map_cookie);
     u_map_clean_full(request->map_post_body);
+    u_map_clean_full(request->map_upload_file);
     o_free(request->binary_body);
     request->http_protocol = NULL;
     request->http_verb = NULL;
@@ -345,6 +206,7 @@ int ulfius_clean_request(struct _u_request * request) {
     request->map_header = NULL;
     request->map_cookie = NULL;
     request->map_post_body = NULL;
+    request->map_upload_file = NULL;
     request->binary_body = NULL;
 #ifndef U_DISABLE_GNUTLS
     gnutls_x509_crt_deinit(request->client_cert);
@@ -372,6 +234,45 @@ int ulfius_clean_request_full(struct _u_request * request) {
   }
 }
 
+/**
+ * ulfius_reset_request
+ * Reset a request initialized with ulfius_init_request
+ * the inner maps are emptied but kept for the next use
+ * return U_OK on success
+ */
+int ulfius_reset_request(struct _u_request * request) {
+  if (request != NULL) {
+    o_free(request->http_protocol);
+    o_free(request->http_verb);
+    o_free(request->http_url);
+    o_free(request->url_path);
+    o_free(request->proxy);
+    o_free(request->auth_basic_user);
+    o_free(request->auth_basic_password);
+    o_free(request->client_address);
+    o_free(request->ca_path);
+    o_free(request->binary_body);
+#ifndef U_DISABLE_GNUTLS
+    gnutls_x509_crt_deinit(request->client_cert);
+    o_free(request->client_cert_file);
+    o_free(request->client_key_file);
+    o_free(request->client_key_password);
+#endif
+    ulfius_init_request_values(request);
+    if (u_map_empty(request->map_url) != U_OK ||
+        u_map_empty(request->map_header) != U_OK ||
+        u_map_empty(request->map_cookie) != U_OK ||
+        u_map_empty(request->map_post_body) != U_OK ||
+        u_map_empty(request->map_upload_file) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error emptying request->map*");
+      return U_ERROR_MEMORY;
+    }
+    return U_OK;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
 /**
  * ulfius_copy_request
  * Copy the source request elements into the dest request
@@ -449,6 +350,16 @@ int ulfius_copy_request(struct _u_request * dest, const struct _u_request * sour
       ret = U_ERROR_MEMORY;
     }
 
+    if (ret == U_OK && u_map_clean(dest->map_upload_file) == U_OK && u_map_init(dest->map_upload_file) == U_OK) {
+      if (u_map_copy_into(dest->map_upload_file, source->map_upload_file) != U_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_copy_into dest->map_upload_file");
+        ret = U_ERROR;
+      }
+    } else if (ret == U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error reinit dest->map_upload_file");
+      ret = U_ERROR_MEMORY;
+    }
+
     if (ret == U_OK) {
       if (source->binary_body_length) {
         dest->binary_body_length = source->binary_body_length;
@@ -789,13 +700,28 @@ struct _u_request * ulfius_duplicate_request(const struct _u_request * request)
   return new_request;
 }
 
+void * ulfius_request_arena_alloc(const struct _u_request * request, size_t size) {
+  if (request != NULL && request->arena != NULL) {
+    return ulfius_arena_alloc((struct _u_arena *)request->arena, size);
+  } else {
+    return NULL;
+  }
+}
+
+char * ulfius_request_arena_strdup(const struct _u_request * request, const char * str) {
+  if (request != NULL && request->arena != NULL) {
+    return ulfius_arena_strdup((struct _u_arena *)request->arena, str);
+  } else {
+    return NULL;
+  }
+}
+
 char * ulfius_export_request_http(const struct _u_request * request) {
   char * out = NULL, * host, * key_esc = NULL, * value_esc = NULL, * body = NULL, fp = '?', np = '&', * url = NULL, * auth_basic;
-  const char * value = NULL, ** keys = NULL;
+  struct _u_map_iter iter;
   struct yuarel y_url;
   int has_params = 0, i;
   struct _o_datum dat = {0, NULL};
-  ssize_t len = 0;
 
   if (request != NULL && request->http_url != NULL) {
     if (!yuarel_parse(&y_url, request->http_url)) {
@@ -806,15 +732,14 @@ char * ulfius_export_request_http(const struct _u_request * request) {
       }
       if (u_map_count(request->map_url) > 0) {
         // Append url parameters
-        keys = u_map_enum_keys(request->map_url);
+        u_map_iter_begin(request->map_url, &iter);
 
         // Append parameters from map_url
-        for (i=0; keys != NULL && keys[i] != NULL; i++) {
-          key_esc = ulfius_url_encode(keys[i]);
+        while (u_map_iter_next(&iter)) {
+          key_esc = ulfius_url_encode(iter.key);
           if (key_esc != NULL) {
-            value = u_map_get(request->map_url, keys[i]);
-            if (value != NULL) {
-              value_esc = ulfius_url_encode(value);
+            if (iter.value != NULL) {
+              value_esc = ulfius_url_encode(iter.value);
               if (value_esc != NULL) {
                 if (!has_params) {
                   url = mstrcatf(url, "%c%s=%s", fp, key_esc, value_esc);
@@ -824,7 +749,7 @@ char * ulfius_export_request_http(const struct _u_request * request) {
                 }
                 o_free(value_esc);
               } else {
-                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for url parameter value %s=%s", keys[i], value);
+                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for url parameter value %s=%s", iter.key, iter.value);
               }
             } else {
               if (!has_params) {
@@ -836,7 +761,7 @@ char * ulfius_export_request_http(const struct _u_request * request) {
             }
             o_free(key_esc);
           } else {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for url key %s", keys[i]);
+            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for url key %s", iter.key);
           }
         }
       }
@@ -847,7 +772,7 @@ char * ulfius_export_request_http(const struct _u_request * request) {
         out = msprintf("GET /%s HTTP/1.1\r\n", url);
       }
       o_free(url);
-      if (!u_map_has_key_case(request->map_header, "Host")) {
+      if (u_map_get_known(request->map_header, U_HDR_HOST) == NULL) {
         if (y_url.port) {
           host = msprintf("%s:%d", y_url.host, y_url.port);
         } else {
@@ -857,39 +782,37 @@ char * ulfius_export_request_http(const struct _u_request * request) {
         o_free(host);
       }
       
-      keys = u_map_enum_keys(request->map_header);
-      for (i=0; keys != NULL && keys[i] != NULL; i++) {
-        value = u_map_get(request->map_header, keys[i]);
-        if (value != NULL) {
-          out = mstrcatf(out, "%s: %s\r\n", keys[i], value);
+      u_map_iter_begin(request->map_header, &iter);
+      while (u_map_iter_next(&iter)) {
+        if (iter.value != NULL) {
+          out = mstrcatf(out, "%s: %s\r\n", iter.key, iter.value);
         } else {
-          out = mstrcatf(out, "%s:\r\n", keys[i]);
+          out = mstrcatf(out, "%s:\r\n", iter.key);
         }
       }
       if (u_map_count(request->map_cookie)) {
-        keys = u_map_enum_keys(request->map_cookie);
-        for (i=0; keys != NULL && keys[i] != NULL; i++) {
-          value = u_map_get(request->map_cookie, keys[i]);
-          if (value != NULL) {
-            value_esc = ulfius_url_encode(value);
+        u_map_iter_begin(request->map_cookie, &iter);
+        while (u_map_iter_next(&iter)) {
+          if (iter.value != NULL) {
+            value_esc = ulfius_url_encode(iter.value);
             if (value_esc != NULL) {
-              out = mstrcatf(out, "Cookie: %s=%s\r\n", keys[i], value_esc);
+              out = mstrcatf(out, "Cookie: %s=%s\r\n", iter.key, value_esc);
               o_free(value_esc);
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for cookie parameter value %s=%s", keys[i], value);
+              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for cookie parameter value %s=%s", iter.key, iter.value);
             }
           } else {
-            out = mstrcatf(out, "Cookie: %s\r\n", keys[i]);
+            out = mstrcatf(out, "Cookie: %s\r\n", iter.key);
           }
         }
       }
-      if (!u_map_has_key_case(request->map_header, "Content-Length") && request->binary_body_length) {
+      if (u_map_get_known(request->map_header, U_HDR_CONTENT_LENGTH) == NULL && request->binary_body_length) {
         out = mstrcatf(out, "Content-Length: %zu\r\n", request->binary_body_length);
       }
-      if (!u_map_has_key_case(request->map_header, ULFIUS_HTTP_HEADER_CONTENT) && u_map_count(request->map_post_body)) {
+      if (u_map_get_known(request->map_header, U_HDR_CONTENT_TYPE) == NULL && u_map_count(request->map_post_body)) {
         out = mstrcatf(out, "Content-type: %s\r\n", MHD_HTTP_POST_ENCODING_FORM_URLENCODED);
       }
-      if (!u_map_has_key_case(request->map_header, "Authorization") && request->auth_basic_user != NULL && request->auth_basic_password != NULL) {
+      if (u_map_get_known(request->map_header, U_HDR_AUTHORIZATION) == NULL && request->auth_basic_user != NULL && request->auth_basic_password != NULL) {
         auth_basic = msprintf("%s:%s", request->auth_basic_user, request->auth_basic_password);
         if (o_base64_encode_alloc((const unsigned char *)auth_basic, o_strlen(auth_basic), &dat)) {
           out = mstrcatf(out, "Authorization: Basic %.*s\r\n", (int)dat.size, dat.data);
@@ -906,31 +829,29 @@ char * ulfius_export_request_http(const struct _u_request * request) {
       } else if (u_map_count(request->map_post_body)) {
         if (NULL == u_map_get(request->map_header, ULFIUS_HTTP_HEADER_CONTENT) ||
             NULL != o_strstr(u_map_get(request->map_header, ULFIUS_HTTP_HEADER_CONTENT), MHD_HTTP_POST_ENCODING_FORM_URLENCODED)) {
-          keys = u_map_enum_keys(request->map_post_body);
-          for (i=0; keys != NULL && keys[i] != NULL; i++) {
+          u_map_iter_begin(request->map_post_body, &iter);
+          for (i=0; u_map_iter_next(&iter); i++) {
             if (i) {
               body = mstrcatf(body, "&");
             } else {
               body = o_strdup("");
             }
-            key_esc = ulfius_url_encode(keys[i]);
+            key_esc = ulfius_url_encode(iter.key);
             if (key_esc) {
-              value = u_map_get(request->map_post_body, keys[i]);
-              len = u_map_get_length(request->map_post_body, keys[i]);
-              if (value != NULL && len > 0 && utf8_check(value, (size_t)len) == NULL) {
-                value_esc = ulfius_url_encode(value);
+              if (iter.value != NULL && utf8_check(iter.value, iter.length) == NULL) {
+                value_esc = ulfius_url_encode(iter.value);
                 if (value_esc != NULL) {
                   body = mstrcatf(body, "%s=%s", key_esc, value_esc);
                   o_free(value_esc);
                 } else {
-                  y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for post parameter value %s=%s", key_esc, value);
+                  y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for post parameter value %s=%s", key_esc, iter.value);
                 }
               } else {
-                body = mstrcatf(body, "%c%s", fp, keys[i]);
+                body = mstrcatf(body, "%c%s", fp, iter.key);
               }
               o_free(key_esc);
             } else {
-              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for post parameter key %s", keys[i]);
+              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_url_encode for post parameter key %s", iter.key);
             }
           }
           out = mstrcatf(out, "Content-Length: %zu\r\n", o_strlen(body));
@@ -977,7 +898,7 @@ int ulfius_set_json_body_request(struct _u_request * request, json_t * j_body) {
  * json_error: structure to store json_error_t if specified
  */
 json_t * ulfius_get_json_body_request(const struct _u_request * request, json_error_t * json_error) {
-  if (request != NULL && request->map_header != NULL && 1 == u_map_count_keys_case(request->map_header, ULFIUS_HTTP_HEADER_CONTENT) && NULL != o_strstr(u_map_get_case(request->map_header, ULFIUS_HTTP_HEADER_CONTENT), ULFIUS_HTTP_ENCODING_JSON)) {
+  if (request != NULL && request->map_header != NULL && 1 == u_map_count_known(request->map_header, U_HDR_CONTENT_TYPE) && NULL != o_strstr(u_map_get_known(request->map_header, U_HDR_CONTENT_TYPE), ULFIUS_HTTP_ENCODING_JSON)) {
     return json_loadb((const char*)request->binary_body, request->binary_body_length, JSON_DECODE_ANY, json_error);
   } else if (json_error != NULL) {
     json_error->line     = 1;
@@ -989,9 +910,9 @@ json_t * ulfius_get_json_body_request(const struct _u_request * request, json_er
     } else if (NULL == request->map_header) {
       json_error->column = 26;
       snprintf(json_error->text, (JSON_ERROR_TEXT_LENGTH - 1), "Request header not set.");
-    } else if (NULL == o_strstr(u_map_get_case(request->map_header, ULFIUS_HTTP_HEADER_CONTENT), ULFIUS_HTTP_ENCODING_JSON)) {
+    } else if (NULL == o_strstr(u_map_get_known(request->map_header, U_HDR_CONTENT_TYPE), ULFIUS_HTTP_ENCODING_JSON)) {
       json_error->column = 57;
-      snprintf(json_error->text, (JSON_ERROR_TEXT_LENGTH - 1), "HEADER content not valid. Expected containging '%s' in header - received '%s'.", ULFIUS_HTTP_ENCODING_JSON, u_map_get_case(request->map_header, ULFIUS_HTTP_HEADER_CONTENT));
+      snprintf(json_error->text, (JSON_ERROR_TEXT_LENGTH - 1), "HEADER content not valid. Expected containging '%s' in header - received '%s'.", ULFIUS_HTTP_ENCODING_JSON, u_map_get_known(request->map_header, U_HDR_CONTENT_TYPE));
     }
   }
   return NULL;
@@ -151,8 +151,7 @@ static char * ulfius_generate_cookie_header(const struct _u_cookie * cookie) {
 }
 
 int ulfius_set_response_header(struct MHD_Response * response, const struct _u_map * response_map_header) {
-  const char ** header_keys = NULL;
-  const char * header_value;
+  struct _u_map_iter iter;
   int i = -1;
 #if MHD_VERSION >= 0x00097002
   enum MHD_Result ret = MHD_NO;
@@ -160,11 +159,10 @@ int ulfius_set_response_header(struct MHD_Response * response, const struct _u_m
   int ret = MHD_NO;
 #endif
   if (response != NULL && response_map_header != NULL) {
-    header_keys = u_map_enum_keys(response_map_header);
-    for (i=0; header_keys != NULL && header_keys[i] != NULL; i++) {
-      header_value = u_map_get(response_map_header, header_keys[i]);
-      if (header_value != NULL) {
-        ret = MHD_add_response_header (response, header_keys[i], header_value);
+    u_map_iter_begin(response_map_header, &iter);
+    for (i=0; u_map_iter_next(&iter); i++) {
+      if (iter.value != NULL) {
+        ret = MHD_add_response_header (response, iter.key, iter.value);
         if (ret == MHD_NO) {
           i = -1;
           break;
@@ -330,6 +328,45 @@ int ulfius_copy_cookie(struct _u_cookie * dest, const struct _u_cookie * source)
   return U_ERROR_PARAMS;
 }
 
+/**
+ * Set the response elements other than the header map and the websocket handle to their initial values
+ */
+static void ulfius_init_response_values(struct _u_response * response) {
+  response->status = 200;
+  response->auth_realm = NULL;
+  response->map_cookie = NULL;
+  response->nb_cookies = 0;
+  response->protocol = NULL;
+  response->binary_body = NULL;
+  response->binary_body_length = 0;
+  response->stream_callback = NULL;
+  response->stream_size = U_STREAM_SIZE_UNKNOWN;
+  response->stream_block_size = ULFIUS_STREAM_BLOCK_SIZE_DEFAULT;
+  response->stream_callback_free = NULL;
+  response->stream_user_data = NULL;
+  response->timeout = 0;
+  response->shared_data = NULL;
+  response->free_shared_data = NULL;
+  response->suspend_handle = NULL;
+}
+
+#ifndef U_DISABLE_WEBSOCKET
+/**
+ * Set the websocket handle elements other than the extension list to their initial values
+ */
+static void ulfius_init_websocket_handle_values(struct _websocket_handle * websocket_handle) {
+  websocket_handle->websocket_protocol = NULL;
+  websocket_handle->websocket_extensions = NULL;
+  websocket_handle->websocket_manager_callback = NULL;
+  websocket_handle->websocket_manager_user_data = NULL;
+  websocket_handle->websocket_incoming_message_callback = NULL;
+  websocket_handle->websocket_incoming_user_data = NULL;
+  websocket_handle->websocket_onclose_callback = NULL;
+  websocket_handle->websocket_onclose_user_data = NULL;
+  websocket_handle->rsv_expected = 0;
+}
+#endif
+
 int ulfius_clean_response(struct _u_response * response) {
   unsigned int i;
   if (response != NULL) {
@@ -354,6 +391,7 @@ int ulfius_clean_response(struct _u_response * response) {
       pointer_list_clean_free(((struct _websocket_handle *)response->websocket_handle)->websocket_extension_list, &ulfius_free_websocket_extension_pointer_list);
       o_free(((struct _websocket_handle *)response->websocket_handle)->websocket_extension_list);
       o_free(response->websocket_handle);
+      response->websocket_handle = NULL;
     }
 #endif
     return U_OK;
@@ -373,7 +411,7 @@ int ulfius_clean_response_full(struct _u_response * response) {
 
 int ulfius_init_response(struct _u_response * response) {
   if (response != NULL) {
-    response->status = 200;
+    ulfius_init_response_values(response);
     response->map_header = o_malloc(sizeof(struct _u_map));
     if (response->map_header == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response->map_header");
@@ -382,35 +420,13 @@ int ulfius_init_response(struct _u_response * response) {
     if (u_map_init(response->map_header) != U_OK) {
       return U_ERROR_PARAMS;
     }
-    response->auth_realm = NULL;
-    response->map_cookie = NULL;
-    response->nb_cookies = 0;
-    response->protocol = NULL;
-    response->binary_body = NULL;
-    response->binary_body_length = 0;
-    response->stream_callback = NULL;
-    response->stream_size = U_STREAM_SIZE_UNKNOWN;
-    response->stream_block_size = ULFIUS_STREAM_BLOCK_SIZE_DEFAULT;
-    response->stream_callback_free = NULL;
-    response->stream_user_data = NULL;
-    response->timeout = 0;
-    response->shared_data = NULL;
-    response->free_shared_data = NULL;
 #ifndef U_DISABLE_WEBSOCKET
     response->websocket_handle = o_malloc(sizeof(struct _websocket_handle));
     if (response->websocket_handle == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response->websocket_handle");
       return U_ERROR_MEMORY;
     }
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_protocol = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_extensions = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_manager_callback = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_manager_user_data = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_incoming_message_callback = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_incoming_user_data = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_onclose_callback = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->websocket_onclose_user_data = NULL;
-    ((struct _websocket_handle *)response->websocket_handle)->rsv_expected = 0;
+    ulfius_init_websocket_handle_values((struct _websocket_handle *)response->websocket_handle);
     if ((((struct _websocket_handle *)response->websocket_handle)->websocket_extension_list = o_malloc(sizeof(struct _pointer_list))) == NULL) {
       o_free(response->websocket_handle);
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response->websocket_handle->websocket_extension_list");
@@ -424,6 +440,45 @@ int ulfius_init_response(struct _u_response * response) {
   }
 }
 
+int ulfius_reset_response(struct _u_response * response) {
+  unsigned int i;
+#ifndef U_DISABLE_WEBSOCKET
+  struct _websocket_handle * websocket_handle;
+#endif
+  if (response != NULL) {
+    o_free(response->protocol);
+    for (i=0; i<response->nb_cookies; i++) {
+      ulfius_clean_cookie(&response->map_cookie[i]);
+    }
+    o_free(response->auth_realm);
+    o_free(response->map_cookie);
+    o_free(response->binary_body);
+    ulfius_init_response_values(response);
+    if (u_map_empty(response->map_header) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error emptying response->map_header");
+      return U_ERROR_MEMORY;
+    }
+#ifndef U_DISABLE_WEBSOCKET
+    if ((websocket_handle = (struct _websocket_handle *)response->websocket_handle) != NULL) {
+      o_free(websocket_handle->websocket_protocol);
+      o_free(websocket_handle->websocket_extensions);
+      ulfius_init_websocket_handle_values(websocket_handle);
+      // The extension list is given to the websocket manager on a successful upgrade
+      if (websocket_handle->websocket_extension_list != NULL) {
+        pointer_list_clean_free(websocket_handle->websocket_extension_list, &ulfius_free_websocket_extension_pointer_list);
+      } else if ((websocket_handle->websocket_extension_list = o_malloc(sizeof(struct _pointer_list))) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response->websocket_handle->websocket_extension_list");
+        return U_ERROR_MEMORY;
+      }
+      pointer_list_init(websocket_handle->websocket_extension_list);
+    }
+#endif
+    return U_OK;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
 int ulfius_copy_response(struct _u_response * dest, const struct _u_response * source) {
   unsigned int i;
   if (dest != NULL && source != NULL) {
@@ -708,7 +763,7 @@ int ulfius_set_json_body_response(struct _u_response * response, const unsigned
  * json_error: structure to store json_error_t if specified
  */
 json_t * ulfius_get_json_body_response(struct _u_response * response, json_error_t * json_error) {
-  if (response != NULL && response->map_header != NULL && 1 == u_map_count_keys_case(response->map_header, ULFIUS_HTTP_HEADER_CONTENT) && NULL != o_strstr(u_map_get_case(response->map_header, ULFIUS_HTTP_HEADER_CONTENT), ULFIUS_HTTP_ENCODING_JSON)) {
+  if (response != NULL && response->map_header != NULL && 1 == u_map_count_known(response->map_header, U_HDR_CONTENT_TYPE) && NULL != o_strstr(u_map_get_known(response->map_header, U_HDR_CONTENT_TYPE), ULFIUS_HTTP_ENCODING_JSON)) {
     return json_loadb((char *)response->binary_body, response->binary_body_length, JSON_DECODE_ANY, json_error);
   }
   return NULL;
@@ -725,30 +780,29 @@ int ulfius_add_header_to_response(struct _u_response * response, const char * ke
 
 char * ulfius_export_response_http(const struct _u_response * response) {
   char * out = NULL, * header;
-  const char * value = NULL, ** keys = NULL;
+  struct _u_map_iter iter;
   unsigned int i;
 
   if (response != NULL) {
     out = msprintf("HTTP/1.1 %ld\r\n", response->status);
       
-    keys = u_map_enum_keys(response->map_header);
-    for (i=0; keys != NULL && keys[i] != NULL; i++) {
-      value = u_map_get(response->map_header, keys[i]);
-      if (value != NULL) {
-        out = mstrcatf(out, "%s: %s\r\n", keys[i], value);
+    u_map_iter_begin(response->map_header, &iter);
+    while (u_map_iter_next(&iter)) {
+      if (iter.value != NULL) {
+        out = mstrcatf(out, "%s: %s\r\n", iter.key, iter.value);
       } else {
-        out = mstrcatf(out, "%s:\r\n", keys[i]);
+        out = mstrcatf(out, "%s:\r\n", iter.key);
       }
     }
 
-    if (response->nb_cookies && !u_map_has_key_case(response->map_header, "Set-Cookie")) {
+    if (response->nb_cookies && u_map_get_known(response->map_header, U_HDR_SET_COOKIE) == NULL) {
       for (i=0; i<response->nb_cookies; i++) {
         header = ulfius_generate_cookie_header(&response->map_cookie[i]);
         out = mstrcatf(out, "Set-Cookie: %s\r\n", header);
         o_free(header);
       }
     }
-    if (response->binary_body_length && u_map_get_case(response->map_header, "Content-Length") == NULL) {
+    if (response->binary_body_length && u_map_get_known(response->map_header, U_HDR_CONTENT_LENGTH) == NULL) {
       out = mstrcatf(out, "Content-Length: %zu\r\n", response->binary_body_length);
     }
     out = mstrcatf(out, "\r\n");
@@ -0,0 +1,800 @@
+/**
+ *
+ * Ulfius Framework
+ *
+ * REST framework library
+ *
+ * u_router.c: endpoint routing table functions definitions
+ *
+ * Copyright 2015-2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <u_private.h>
+#include <ulfius.h>
+
+/**
+ * Returns the next non empty segment of url and moves url after it
+ * If skip_query is true, segments starting with '?' are ignored too
+ * Return NULL when there is no more segment
+ */
+static const char * ulfius_router_next_segment(const char ** url, size_t * len, int skip_query) {
+  const char * segment;
+
+  while (*url != NULL && **url != '\0') {
+    while (**url == '/') {
+      (*url)++;
+    }
+    segment = *url;
+    while (**url != '\0' && **url != '/') {
+      (*url)++;
+    }
+    *len = (size_t)(*url - segment);
+    if (*len && (!skip_query || segment[0] != '?')) {
+      return segment;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns the next segment of an endpoint url, url_prefix first, then url_format
+ * This is the same segment list as the one used by ulfius before the routing table
+ */
+static const char * ulfius_router_next_endpoint_segment(const char ** prefix, const char ** format, size_t * len) {
+  const char * segment = ulfius_router_next_segment(prefix, len, 0);
+
+  if (segment == NULL) {
+    segment = ulfius_router_next_segment(format, len, 1);
+  }
+  return segment;
+}
+
+/**
+ * Compare a segment with a static node segment
+ * Used to keep the static children sorted and to look them up by dichotomy
+ */
+static int ulfius_router_compare_segment(const char * segment, size_t len, const struct _u_route_node * node) {
+  int cmp = memcmp(segment, node->segment, len<node->segment_len?len:node->segment_len);
+
+  if (cmp) {
+    return cmp;
+  } else if (len < node->segment_len) {
+    return -1;
+  } else if (len > node->segment_len) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+/**
+ * Look for the static child of node matching segment
+ * index is set to the position of the child if found, or the position where to insert it otherwise
+ */
+static struct _u_route_node * ulfius_router_find_child(const struct _u_route_node * node, const char * segment, size_t len, size_t * index) {
+  size_t low = 0, high = node->nb_children, mid;
+  int cmp;
+
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    cmp = ulfius_router_compare_segment(segment, len, node->children[mid]);
+    if (!cmp) {
+      if (index != NULL) {
+        *index = mid;
+      }
+      return node->children[mid];
+    } else if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  if (index != NULL) {
+    *index = low;
+  }
+  return NULL;
+}
+
+static struct _u_route_node * ulfius_router_new_node(const char * segment, size_t len) {
+  struct _u_route_node * node = o_malloc(sizeof(struct _u_route_node));
+
+  if (node != NULL) {
+    memset(node, 0, sizeof(struct _u_route_node));
+    if (segment != NULL) {
+      if ((node->segment = o_strndup(segment, len)) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for node->segment");
+        o_free(node);
+        node = NULL;
+      } else {
+        node->segment_len = len;
+      }
+    }
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for node");
+  }
+  return node;
+}
+
+static void ulfius_router_clean_node(struct _u_route_node * node) {
+  size_t i;
+
+  if (node != NULL) {
+    for (i=0; i<node->nb_children; i++) {
+      ulfius_router_clean_node(node->children[i]);
+      o_free(node->children[i]);
+    }
+    ulfius_router_clean_node(node->param_child);
+    o_free(node->param_child);
+    o_free(node->children);
+    o_free(node->segment);
+    o_free(node->endpoints);
+    o_free(node->wildcards);
+  }
+}
+
+/**
+ * Get the static child of node matching segment, create it if it doesn't exist
+ */
+static struct _u_route_node * ulfius_router_get_child(struct _u_route_node * node, const char * segment, size_t len) {
+  struct _u_route_node * child, ** children;
+  size_t index = 0;
+
+  if ((child = ulfius_router_find_child(node, segment, len, &index)) == NULL) {
+    if ((children = o_realloc(node->children, (node->nb_children+1)*sizeof(struct _u_route_node *))) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for node->children");
+    } else {
+      node->children = children;
+      if ((child = ulfius_router_new_node(segment, len)) != NULL) {
+        memmove(node->children+index+1, node->children+index, (node->nb_children-index)*sizeof(struct _u_route_node *));
+        node->children[index] = child;
+        node->nb_children++;
+      }
+    }
+  }
+  return child;
+}
+
+static int ulfius_router_append_endpoint(const struct _u_endpoint *** endpoints, size_t * nb_endpoints, const struct _u_endpoint * endpoint) {
+  const struct _u_endpoint ** new_endpoints = o_realloc(*endpoints, ((*nb_endpoints)+1)*sizeof(struct _u_endpoint *));
+
+  if (new_endpoints != NULL) {
+    new_endpoints[*nb_endpoints] = endpoint;
+    *endpoints = new_endpoints;
+    (*nb_endpoints)++;
+    return U_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for node endpoints");
+    return U_ERROR_MEMORY;
+  }
+}
+
+static void ulfius_router_clean_params(struct _u_route_params * params) {
+  size_t i;
+
+  for (i=0; i<params->nb_params; i++) {
+    o_free(params->params[i].key);
+  }
+  o_free(params->params);
+  params->params = NULL;
+  params->nb_params = 0;
+}
+
+/**
+ * Parse the url parameters of an endpoint
+ * The segments are counted the same way ulfius_parse_url does,
+ * url_prefix segments first, then url_format segments
+ */
+static int ulfius_router_parse_params(const struct _u_endpoint * endpoint, struct _u_route_params * params) {
+  const char * prefix = endpoint->url_prefix, * format = endpoint->url_format, * segment;
+  struct _u_route_param * new_params;
+  size_t len = 0, index = 0;
+
+  while (ulfius_router_next_segment(&prefix, &len, 0) != NULL) {
+    index++;
+  }
+  while ((segment = ulfius_router_next_segment(&format, &len, 0)) != NULL) {
+    if (segment[0] == ':' || segment[0] == '@') {
+      if ((new_params = o_realloc(params->params, (params->nb_params+1)*sizeof(struct _u_route_param))) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for params->params");
+        return U_ERROR_MEMORY;
+      }
+      params->params = new_params;
+      params->params[params->nb_params].segment_index = index;
+      if ((params->params[params->nb_params].key = o_strndup(segment+1, len-1)) == NULL) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for params->params[%zu].key", params->nb_params);
+        return U_ERROR_MEMORY;
+      }
+      params->nb_params++;
+    }
+    index++;
+  }
+  return U_OK;
+}
+
+static int ulfius_router_equals_params(const struct _u_route_params * params1, const struct _u_route_params * params2) {
+  size_t i;
+
+  if (params1->nb_params != params2->nb_params) {
+    return 0;
+  }
+  for (i=0; i<params1->nb_params; i++) {
+    if (params1->params[i].segment_index != params2->params[i].segment_index || 0 != o_strcmp(params1->params[i].key, params2->params[i].key)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Use the url parameters set of an endpoint of the same node if they are equal,
+ * so chained callbacks with the same url format share their parameters values
+ */
+static void ulfius_router_share_params(struct _u_router * router, const struct _u_endpoint ** node_endpoints, size_t nb_node_endpoints, size_t index) {
+  const struct _u_route_params * params;
+  size_t i;
+
+  for (i=0; i<nb_node_endpoints; i++) {
+    params = router->endpoint_params[node_endpoints[i] - router->endpoint_list];
+    if (ulfius_router_equals_params(params, &router->params[index])) {
+      ulfius_router_clean_params(&router->params[index]);
+      router->endpoint_params[index] = params;
+      break;
+    }
+  }
+}
+
+/**
+ * Add the endpoint router->endpoint_list[index] in the tree, one node per url segment
+ * A last segment starting with '*' is a wildcard and matches the rest of the url
+ * Segments starting with ':' or '@' match any url segment
+ */
+static int ulfius_router_insert(struct _u_router * router, size_t index) {
+  struct _u_route_node * node = &router->root;
+  const struct _u_endpoint * endpoint = &router->endpoint_list[index];
+  const char * prefix = endpoint->url_prefix, * format = endpoint->url_format, * segment, * next_segment;
+  size_t len = 0, next_len = 0;
+
+  segment = ulfius_router_next_endpoint_segment(&prefix, &format, &len);
+  while (segment != NULL) {
+    next_segment = ulfius_router_next_endpoint_segment(&prefix, &format, &next_len);
+    if (next_segment == NULL && segment[0] == '*') {
+      ulfius_router_share_params(router, node->wildcards, node->nb_wildcards, index);
+      return ulfius_router_append_endpoint(&node->wildcards, &node->nb_wildcards, endpoint);
+    } else if (segment[0] == ':' || segment[0] == '@') {
+      if (node->param_child == NULL && (node->param_child = ulfius_router_new_node(NULL, 0)) == NULL) {
+        return U_ERROR_MEMORY;
+      }
+      node = node->param_child;
+    } else if ((node = ulfius_router_get_child(node, segment, len)) == NULL) {
+      return U_ERROR_MEMORY;
+    }
+    segment = next_segment;
+    len = next_len;
+  }
+  ulfius_router_share_params(router, node->endpoints, node->nb_endpoints, index);
+  return ulfius_router_append_endpoint(&node->endpoints, &node->nb_endpoints, endpoint);
+}
+
+/**
+ * Compare two endoints by their priorities
+ * Endpoints with the same priority keep their declaration order
+ */
+static int ulfius_router_compare_priorities(const void * a, const void * b) {
+  const struct _u_endpoint * e1 = *(const struct _u_endpoint **)a, * e2 = *(const struct _u_endpoint **)b;
+
+  if (e1->priority < e2->priority) {
+    return -1;
+  } else if (e1->priority > e2->priority) {
+    return 1;
+  } else if (e1 < e2) {
+    return -1;
+  } else if (e1 > e2) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+struct _u_router * ulfius_router_compile(const struct _u_endpoint * endpoint_list, size_t nb_endpoints, size_t cache_size) {
+  struct _u_router * router = o_malloc(sizeof(struct _u_router));
+  const struct _u_endpoint ** sorted_list = NULL;
+  size_t i;
+  int ret = U_OK;
+
+  if (router == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for router");
+    return NULL;
+  }
+  memset(router, 0, sizeof(struct _u_router));
+  if ((router->endpoint_list = o_malloc((nb_endpoints+1)*sizeof(struct _u_endpoint))) == NULL ||
+      (router->params = o_malloc((nb_endpoints+1)*sizeof(struct _u_route_params))) == NULL ||
+      (router->endpoint_params = o_malloc((nb_endpoints+1)*sizeof(struct _u_route_params *))) == NULL ||
+      (nb_endpoints && (sorted_list = o_malloc(nb_endpoints*sizeof(struct _u_endpoint *))) == NULL)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for router->endpoint_list");
+    o_free(router->endpoint_list);
+    o_free(router->params);
+    o_free(router->endpoint_params);
+    o_free(router);
+    return NULL;
+  }
+  memset(router->endpoint_list, 0, (nb_endpoints+1)*sizeof(struct _u_endpoint));
+  memset(router->params, 0, (nb_endpoints+1)*sizeof(struct _u_route_params));
+  if (cache_size) {
+    router->nb_cache_sets = (cache_size+U_ROUTE_CACHE_WAYS-1)/U_ROUTE_CACHE_WAYS;
+    if ((router->cache_sets = o_malloc(router->nb_cache_sets*sizeof(struct _u_route_cache_set))) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for router->cache_sets");
+      ret = U_ERROR_MEMORY;
+    } else {
+      memset(router->cache_sets, 0, router->nb_cache_sets*sizeof(struct _u_route_cache_set));
+    }
+  }
+
+  // The router owns a copy of the endpoints sorted by priority,
+  // so an endpoint address in router->endpoint_list is also its rank in a match result
+  for (i=0; i<nb_endpoints; i++) {
+    sorted_list[i] = &endpoint_list[i];
+  }
+  qsort(sorted_list, nb_endpoints, sizeof(struct _u_endpoint *), &ulfius_router_compare_priorities);
+  for (i=0; i<nb_endpoints && ret == U_OK; i++) {
+    if ((ret = ulfius_copy_endpoint(&router->endpoint_list[i], sorted_list[i])) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_copy_endpoint for router->endpoint_list[%zu]", i);
+    } else {
+      router->nb_endpoints++;
+      if (router->endpoint_list[i].body_callback != NULL) {
+        router->nb_body_callbacks++;
+      }
+      router->endpoint_params[i] = &router->params[i];
+      if ((ret = ulfius_router_parse_params(&router->endpoint_list[i], &router->params[i])) == U_OK) {
+        ret = ulfius_router_insert(router, i);
+      }
+    }
+  }
+  o_free(sorted_list);
+
+  if (ret != U_OK) {
+    ulfius_router_free(router);
+    router = NULL;
+  }
+  return router;
+}
+
+void ulfius_router_free(struct _u_router * router) {
+  size_t i, j;
+
+  if (router != NULL) {
+    for (i=0; i<router->nb_cache_sets; i++) {
+      for (j=0; j<U_ROUTE_CACHE_WAYS; j++) {
+        o_free(router->cache_sets[i].entries[j].method);
+      }
+    }
+    o_free(router->cache_sets);
+    ulfius_router_clean_node(&router->root);
+    for (i=0; i<router->nb_endpoints; i++) {
+      ulfius_clean_endpoint(&router->endpoint_list[i]);
+      ulfius_router_clean_params(&router->params[i]);
+    }
+    o_free(router->endpoint_list);
+    o_free(router->params);
+    o_free(router->endpoint_params);
+    o_free(router);
+  }
+}
+
+void ulfius_router_lock(struct _u_router_handler * handler) {
+  while (U_ATOMIC_TEST_AND_SET(&handler->write_lock));
+}
+
+void ulfius_router_unlock(struct _u_router_handler * handler) {
+  U_ATOMIC_CLEAR(&handler->write_lock);
+}
+
+/**
+ * Free the retired routing tables that can't be used by any reader anymore
+ * The epoch can move forward only when no reader is registered with the parity of the next epoch,
+ * so when the epoch has moved forward twice since a routing table was retired,
+ * all the readers that could use it have released it
+ * Must be called with the write lock held
+ */
+static void ulfius_router_reclaim(struct _u_router_handler * handler) {
+  struct _u_router * retired = U_ATOMIC_LOAD(&handler->retired), ** previous = &handler->retired, * next;
+  size_t epoch, i;
+
+  if (retired != NULL) {
+    for (i=0; i<2; i++) {
+      epoch = U_ATOMIC_LOAD(&handler->epoch);
+      if (!U_ATOMIC_LOAD(&handler->readers[(epoch+1)&1])) {
+        U_ATOMIC_STORE(&handler->epoch, epoch+1);
+      }
+    }
+    epoch = U_ATOMIC_LOAD(&handler->epoch);
+    while (retired != NULL) {
+      next = retired->next_retired;
+      if (retired->retire_epoch + 2 <= epoch && !U_ATOMIC_LOAD(&retired->holders)) {
+        U_ATOMIC_STORE(previous, next);
+        ulfius_router_free(retired);
+      } else {
+        previous = &retired->next_retired;
+      }
+      retired = next;
+    }
+  }
+}
+
+void ulfius_router_publish(struct _u_router_handler * handler, struct _u_router * router) {
+  struct _u_router * previous = U_ATOMIC_EXCHANGE(&handler->router, router);
+
+  if (previous != NULL) {
+    previous->retire_epoch = U_ATOMIC_LOAD(&handler->epoch);
+    previous->next_retired = handler->retired;
+    U_ATOMIC_STORE(&handler->retired, previous);
+  }
+  ulfius_router_reclaim(handler);
+}
+
+struct _u_router * ulfius_router_acquire(struct _u_router_handler * handler, size_t * reader_slot) {
+  // The reader registers in the current epoch before loading the routing table,
+  // so a routing table retired meanwhile can't be free'd until the reader has released it
+  *reader_slot = U_ATOMIC_LOAD(&handler->epoch)&1;
+  U_ATOMIC_INCREMENT(&handler->readers[*reader_slot]);
+  return U_ATOMIC_LOAD(&handler->router);
+}
+
+void ulfius_router_release(struct _u_router_handler * handler, size_t reader_slot) {
+  U_ATOMIC_DECREMENT(&handler->readers[reader_slot]);
+  // Free the retired routing tables if no writer is busy, the reader never waits for the lock
+  if (U_ATOMIC_LOAD(&handler->retired) != NULL && !U_ATOMIC_TEST_AND_SET(&handler->write_lock)) {
+    ulfius_router_reclaim(handler);
+    ulfius_router_unlock(handler);
+  }
+}
+
+void ulfius_router_retain(struct _u_router_handler * handler, struct _u_router * router, size_t reader_slot) {
+  // The holder is counted before the reader is unregistered,
+  // so the routing table can't be free'd in between
+  if (router != NULL) {
+    U_ATOMIC_INCREMENT(&router->holders);
+  }
+  ulfius_router_release(handler, reader_slot);
+}
+
+void ulfius_router_drop(struct _u_router_handler * handler, struct _u_router * router) {
+  if (router != NULL) {
+    U_ATOMIC_DECREMENT(&router->holders);
+    if (U_ATOMIC_LOAD(&handler->retired) != NULL && !U_ATOMIC_TEST_AND_SET(&handler->write_lock)) {
+      ulfius_router_reclaim(handler);
+      ulfius_router_unlock(handler);
+    }
+  }
+}
+
+void ulfius_router_clean_handler(struct _u_router_handler * handler) {
+  struct _u_router * retired, * next;
+
+  if (handler != NULL) {
+    ulfius_router_free(handler->router);
+    for (retired = handler->retired; retired != NULL; retired = next) {
+      next = retired->next_retired;
+      ulfius_router_free(retired);
+    }
+    handler->router = NULL;
+    handler->retired = NULL;
+  }
+}
+
+/**
+ * Context of a match, shared by all the nodes visited
+ */
+struct _u_router_match_context {
+  const char                * method;        /* http method called */
+  const char                * url;           /* url called */
+  const struct _u_endpoint ** endpoints;     /* matching endpoints found */
+  size_t                      max_endpoints; /* size of endpoints */
+  size_t                      nb_matches;    /* number of matching endpoints, may be greater than max_endpoints */
+  struct _u_route_captures  * captures;      /* url segments captured, may be NULL */
+};
+
+static void ulfius_router_add_matches(struct _u_router_match_context * context, const struct _u_endpoint ** node_endpoints, size_t nb_node_endpoints) {
+  size_t i;
+
+  for (i=0; i<nb_node_endpoints; i++) {
+    if (0 == o_strcasecmp(node_endpoints[i]->http_method, context->method) || node_endpoints[i]->http_method[0] == '*') {
+      if (context->nb_matches < context->max_endpoints) {
+        context->endpoints[context->nb_matches] = node_endpoints[i];
+      }
+      context->nb_matches++;
+    }
+  }
+}
+
+/**
+ * Walk the tree following url, both the static child and the parametric child of a node are explored
+ * Each node is visited at most once for a given url, so an endpoint can't be matched twice
+ * The url segments are captured the first time their depth is reached
+ */
+static void ulfius_router_match_node(struct _u_router_match_context * context, const struct _u_route_node * node, const char * url, size_t depth) {
+  const struct _u_route_node * child;
+  const char * segment;
+  size_t len = 0;
+
+  ulfius_router_add_matches(context, node->wildcards, node->nb_wildcards);
+  if ((segment = ulfius_router_next_segment(&url, &len, 0)) == NULL) {
+    ulfius_router_add_matches(context, node->endpoints, node->nb_endpoints);
+  } else {
+    if (context->captures != NULL && depth == context->captures->nb_segments && depth < U_ROUTER_MATCH_STACK_SIZE) {
+      context->captures->segments[depth].offset = (size_t)(segment - context->url);
+      context->captures->segments[depth].len = len;
+      context->captures->nb_segments++;
+    }
+    if ((child = ulfius_router_find_child(node, segment, len, NULL)) != NULL) {
+      ulfius_router_match_node(context, child, url, depth+1);
+    }
+    if (node->param_child != NULL) {
+      ulfius_router_match_node(context, node->param_child, url, depth+1);
+    }
+  }
+}
+
+size_t ulfius_router_match(const struct _u_router * router, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t max_endpoints, struct _u_route_captures * captures) {
+  struct _u_router_match_context context;
+  const struct _u_endpoint * endpoint;
+  size_t i, j;
+
+  if (captures != NULL) {
+    captures->nb_segments = 0;
+  }
+  if (router != NULL && method != NULL && url != NULL) {
+    context.method = method;
+    context.url = url;
+    context.endpoints = endpoints;
+    context.max_endpoints = max_endpoints;
+    context.nb_matches = 0;
+    context.captures = captures;
+    ulfius_router_match_node(&context, &router->root, url, 0);
+    // Sort by rank, the result list is usually very small
+    for (i=1; i<context.nb_matches && i<max_endpoints; i++) {
+      endpoint = endpoints[i];
+      for (j=i; j>0 && endpoints[j-1] > endpoint; j--) {
+        endpoints[j] = endpoints[j-1];
+      }
+      endpoints[j] = endpoint;
+    }
+    return context.nb_matches;
+  }
+  return 0;
+}
+
+/**
+ * FNV-1a hash of method and url
+ */
+static size_t ulfius_router_hash(const char * method, const char * url) {
+  size_t hash = 2166136261u;
+
+  for (; *method; method++) {
+    hash = (hash ^ (unsigned char)*method) * 16777619u;
+  }
+  hash = hash * 16777619u;
+  for (; *url; url++) {
+    hash = (hash ^ (unsigned char)*url) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Look for method and url in the cache set
+ * Return 1 and fills endpoints if found, 0 if not found or if the set is locked
+ */
+static int ulfius_router_cache_get(struct _u_route_cache_set * set, size_t hash, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t max_endpoints, size_t * nb_endpoints) {
+  struct _u_route_cache_entry * entry;
+  size_t i, j;
+  int found = 0;
+
+  if (!U_ATOMIC_TEST_AND_SET(&set->lock)) {
+    for (i=0; i<U_ROUTE_CACHE_WAYS && !found; i++) {
+      entry = &set->entries[i];
+      if (entry->method != NULL && entry->hash == hash && 0 == o_strcmp(entry->method, method) && 0 == o_strcmp(entry->url, url)) {
+        for (j=0; j<entry->nb_endpoints && j<max_endpoints; j++) {
+          endpoints[j] = entry->endpoints[j];
+        }
+        *nb_endpoints = entry->nb_endpoints;
+        entry->referenced = 1;
+        found = 1;
+      }
+    }
+    U_ATOMIC_CLEAR(&set->lock);
+  }
+  return found;
+}
+
+/**
+ * Store the match result of method and url in the cache set
+ * A free entry is used if any, otherwise the CLOCK hand moves until it finds an entry not referenced since its last pass
+ * Nothing is stored if the set is locked
+ */
+static void ulfius_router_cache_put(struct _u_route_cache_set * set, size_t hash, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t nb_endpoints) {
+  struct _u_route_cache_entry * entry = NULL, * candidate;
+  size_t i, method_len, url_len;
+  char * buffer;
+
+  if (nb_endpoints <= U_ROUTE_CACHE_MAX_ENDPOINTS && !U_ATOMIC_TEST_AND_SET(&set->lock)) {
+    for (i=0; i<U_ROUTE_CACHE_WAYS; i++) {
+      candidate = &set->entries[i];
+      if (candidate->method == NULL) {
+        if (entry == NULL) {
+          entry = candidate;
+        }
+      } else if (candidate->hash == hash && 0 == o_strcmp(candidate->method, method) && 0 == o_strcmp(candidate->url, url)) {
+        // Already stored by another request
+        U_ATOMIC_CLEAR(&set->lock);
+        return;
+      }
+    }
+    while (entry == NULL) {
+      candidate = &set->entries[set->hand];
+      set->hand = (unsigned char)((set->hand+1)%U_ROUTE_CACHE_WAYS);
+      if (candidate->referenced) {
+        candidate->referenced = 0;
+      } else {
+        entry = candidate;
+      }
+    }
+    method_len = o_strlen(method);
+    url_len = o_strlen(url);
+    if ((buffer = o_malloc(method_len+url_len+2)) != NULL) {
+      o_free(entry->method);
+      memcpy(buffer, method, method_len+1);
+      memcpy(buffer+method_len+1, url, url_len+1);
+      entry->method = buffer;
+      entry->url = buffer+method_len+1;
+      entry->hash = hash;
+      entry->referenced = 1;
+      entry->nb_endpoints = nb_endpoints;
+      for (i=0; i<nb_endpoints; i++) {
+        entry->endpoints[i] = endpoints[i];
+      }
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for route cache entry");
+    }
+    U_ATOMIC_CLEAR(&set->lock);
+  }
+}
+
+size_t ulfius_router_lookup(struct _u_router_handler * handler, struct _u_router * router, const char * method, const char * url, const struct _u_endpoint ** endpoints, size_t max_endpoints, struct _u_route_captures * captures) {
+  struct _u_route_cache_set * set;
+  size_t hash, nb_matches = 0;
+
+  if (router != NULL && router->nb_cache_sets && method != NULL && url != NULL) {
+    hash = ulfius_router_hash(method, url);
+    set = &router->cache_sets[hash%router->nb_cache_sets];
+    if (ulfius_router_cache_get(set, hash, method, url, endpoints, max_endpoints, &nb_matches)) {
+      if (captures != NULL) {
+        captures->nb_segments = 0;
+      }
+      U_ATOMIC_INCREMENT(&handler->cache_hits);
+    } else {
+      U_ATOMIC_INCREMENT(&handler->cache_misses);
+      nb_matches = ulfius_router_match(router, method, url, endpoints, max_endpoints, captures);
+      if (nb_matches <= max_endpoints) {
+        ulfius_router_cache_put(set, hash, method, url, endpoints, nb_matches);
+      }
+    }
+    return nb_matches;
+  } else {
+    return ulfius_router_match(router, method, url, endpoints, max_endpoints, captures);
+  }
+}
+
+const struct _u_route_params * ulfius_router_get_params(const struct _u_router * router, const struct _u_endpoint * endpoint) {
+  if (router != NULL && endpoint >= router->endpoint_list && endpoint < router->endpoint_list + router->nb_endpoints) {
+    return router->endpoint_params[endpoint - router->endpoint_list];
+  } else {
+    return NULL;
+  }
+}
+
+/**
+ * Return the url segment at index, from the captured segments if possible
+ */
+static const char * ulfius_router_get_segment(const char * url, const struct _u_route_captures * captures, size_t index, size_t * len) {
+  const char * segment;
+  size_t i = 0;
+
+  if (captures != NULL && captures->nb_segments) {
+    if (index < captures->nb_segments) {
+      *len = captures->segments[index].len;
+      return url + captures->segments[index].offset;
+    }
+    i = captures->nb_segments;
+    url += captures->segments[i-1].offset + captures->segments[i-1].len;
+  }
+  while ((segment = ulfius_router_next_segment(&url, len, 0)) != NULL && i < index) {
+    i++;
+  }
+  return segment;
+}
+
+/**
+ * Converts a hex character to its integer value
+ */
+static char ulfius_router_from_hex(char ch) {
+  return (char)(isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10);
+}
+
+/**
+ * Returns a url-decoded copy of the len first bytes of segment
+ * Same decoding as ulfius_url_decode
+ */
+static char * ulfius_router_decode_segment(const char * segment, size_t len) {
+  char * buf = o_malloc(len+1), * pbuf = buf;
+  size_t i;
+
+  if (buf != NULL) {
+    for (i=0; i<len; i++) {
+      if (segment[i] == '%') {
+        if (i+2 < len) {
+          *pbuf++ = (char)(ulfius_router_from_hex(segment[i+1]) << 4 | ulfius_router_from_hex(segment[i+2]));
+          i += 2;
+        }
+      } else if (segment[i] == '+') {
+        *pbuf++ = ' ';
+      } else {
+        *pbuf++ = segment[i];
+      }
+    }
+    *pbuf = '\0';
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating resources for buf (ulfius_router_decode_segment)");
+  }
+  return buf;
+}
+
+int ulfius_router_parse_url(const struct _u_route_params * params, const char * url, const struct _u_route_captures * captures, struct _u_map * map, int check_utf8) {
+  const char * segment;
+  char * value, * concat_url_param;
+  size_t i, len = 0;
+  int ret = U_OK;
+
+  if (params == NULL || url == NULL || map == NULL) {
+    return U_ERROR_PARAMS;
+  }
+  for (i=0; i<params->nb_params && ret == U_OK; i++) {
+    if ((segment = ulfius_router_get_segment(url, captures, params->params[i].segment_index, &len)) == NULL) {
+      // The url is shorter than the endpoint url, the next parameters are missing too
+      break;
+    } else if ((value = ulfius_router_decode_segment(segment, len)) == NULL) {
+      ret = U_ERROR_MEMORY;
+    } else {
+      if (!check_utf8 || utf8_check(value, o_strlen(value)) == NULL) {
+        if (u_map_has_key(map, params->params[i].key)) {
+          if ((concat_url_param = msprintf("%s,%s", u_map_get(map, params->params[i].key), value)) == NULL) {
+            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating resources for concat_url_param");
+            ret = U_ERROR_MEMORY;
+          } else {
+            ret = u_map_put(map, params->params[i].key, concat_url_param);
+            o_free(concat_url_param);
+          }
+        } else {
+          ret = u_map_put(map, params->params[i].key, value);
+        }
+      }
+      o_free(value);
+    }
+  }
+  return ret;
+}
@@ -287,7 +287,7 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
   CURL * curl_handle = NULL;
   struct curl_slist * header_list = NULL, * cookies_list = NULL;
   char * key_esc = NULL, * value_esc = NULL, * cookie = NULL, * cookies = NULL, * header = NULL, fp = '?', np = '&', * url = NULL;
-  const char * value = NULL, ** keys = NULL;
+  struct _u_map_iter iter;
   int i, has_params = 0, ret, exit_loop;
   struct _u_request * copy_request = NULL;
   struct _u_response_header u_response_header = {NULL, 0, 0};
@@ -420,16 +420,15 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
           has_params = (o_strchr(url, '?') != NULL);
           if (u_map_count(copy_request->map_url) > 0) {
             // Append url parameters
-            keys = u_map_enum_keys(copy_request->map_url);
+            u_map_iter_begin(copy_request->map_url, &iter);
 
             exit_loop = 0;
             // Append parameters from map_url
-            for (i=0; !exit_loop && keys != NULL && keys[i] != NULL; i++) {
-              key_esc = curl_easy_escape(curl_handle, keys[i], 0);
+            for (i=0; !exit_loop && u_map_iter_next(&iter); i++) {
+              key_esc = curl_easy_escape(curl_handle, iter.key, 0);
               if (key_esc != NULL) {
-                value = u_map_get(copy_request->map_url, keys[i]);
-                if (value != NULL) {
-                  value_esc = curl_easy_escape(curl_handle, value, 0);
+                if (iter.value != NULL) {
+                  value_esc = curl_easy_escape(curl_handle, iter.value, 0);
                   if (value_esc != NULL) {
                     if (!has_params) {
                       url = mstrcatf(url, "%c%s=%s", fp, key_esc, value_esc);
@@ -439,7 +438,7 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
                     }
                     curl_free(value_esc);
                   } else {
-                    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for url parameter value %s=%s", keys[i], value);
+                    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for url parameter value %s=%s", iter.key, iter.value);
                     exit_loop = 1;
                   }
                 } else {
@@ -452,7 +451,7 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
                 }
                 curl_free(key_esc);
               } else {
-                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for url key %s", keys[i]);
+                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for url key %s", iter.key);
                 exit_loop = 1;
               }
             }
@@ -467,15 +466,14 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
             copy_request->binary_body = NULL;
             copy_request->binary_body_length = 0;
             // Append MHD_HTTP_POST_ENCODING_FORM_URLENCODED post parameters
-            keys = u_map_enum_keys(copy_request->map_post_body);
+            u_map_iter_begin(copy_request->map_post_body, &iter);
             exit_loop = 0;
-            for (i=0; !exit_loop && keys != NULL && keys[i] != NULL; i++) {
+            for (i=0; !exit_loop && u_map_iter_next(&iter); i++) {
               // Build parameter
-              key_esc = curl_easy_escape(curl_handle, keys[i], 0);
+              key_esc = curl_easy_escape(curl_handle, iter.key, 0);
               if (key_esc != NULL) {
-                value = u_map_get(copy_request->map_post_body, keys[i]);
-                if (value != NULL) {
-                  value_esc = curl_easy_escape(curl_handle, value, 0);
+                if (iter.value != NULL) {
+                  value_esc = curl_easy_escape(curl_handle, iter.value, 0);
                   if (value_esc != NULL) {
                     if (!i) {
                       copy_request->binary_body = (unsigned char *)mstrcatf((char *)copy_request->binary_body, "%s=%s", key_esc, value_esc);
@@ -484,7 +482,7 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
                     }
                     copy_request->binary_body_length = o_strlen((const char *)copy_request->binary_body);
                   } else {
-                    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for body parameter value %s=%s", keys[i], value);
+                    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for body parameter value %s=%s", iter.key, iter.value);
                     exit_loop = 1;
                   }
                   o_free(value_esc);
@@ -497,7 +495,7 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
                   copy_request->binary_body_length = o_strlen((const char *)copy_request->binary_body);
                 }
               } else {
-                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for body key %s", keys[i]);
+                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_easy_escape for body key %s", iter.key);
                 exit_loop = 1;
               }
               o_free(key_esc);
@@ -540,20 +538,19 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
 
           if (u_map_count(copy_request->map_header) > 0) {
             // Append map headers
-            keys = u_map_enum_keys(copy_request->map_header);
+            u_map_iter_begin(copy_request->map_header, &iter);
             exit_loop = 0;
-            for (i=0; !exit_loop && keys != NULL && keys[i] != NULL; i++) {
+            for (i=0; !exit_loop && u_map_iter_next(&iter); i++) {
               // Build parameter
-              value = u_map_get(copy_request->map_header, keys[i]);
-              if (value != NULL) {
-                header = msprintf("%s:%s", keys[i], value);
+              if (iter.value != NULL) {
+                header = msprintf("%s:%s", iter.key, iter.value);
                 if ((header_list = curl_slist_append(header_list, header)) == NULL) {
                   y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_slist_append for header_list (1)");
                   exit_loop = 1;
                 }
                 o_free(header);
               } else {
-                header = msprintf("%s:", keys[i]);
+                header = msprintf("%s:", iter.key);
                 if ((header_list = curl_slist_append(header_list, header)) == NULL) {
                   y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error curl_slist_append for header_list (2)");
                   exit_loop = 1;
@@ -569,15 +566,14 @@ int ulfius_send_http_streaming_request_max_header(const struct _u_request * requ
 
           if (copy_request->map_cookie != NULL && u_map_count(copy_request->map_cookie) > 0) {
             // Append cookies
-            keys = u_map_enum_keys(copy_request->map_cookie);
+            u_map_iter_begin(copy_request->map_cookie, &iter);
             exit_loop = 0;
-            for (i=0; !exit_loop && keys != NULL && keys[i] != NULL; i++) {
+            for (i=0; !exit_loop && u_map_iter_next(&iter); i++) {
               // Build parameter
-              value = u_map_get(copy_request->map_cookie, keys[i]);
-              if (value != NULL) {
-                cookie = msprintf("%s=%s", keys[i], value);
+              if (iter.value != NULL) {
+                cookie = msprintf("%s=%s", iter.key, iter.value);
               } else {
-                cookie = msprintf("%s:", keys[i]);
+                cookie = msprintf("%s:", iter.key);
               }
               if (cookies == NULL) {
                 cookies = o_strdup(cookie);
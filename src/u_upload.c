@@ -0,0 +1,403 @@
+/**
+ *
+ * Ulfius Framework
+ *
+ * REST framework library
+ *
+ * u_upload.c: files uploaded in multipart/form-data bodies written in the upload directory
+ *
+ * Copyright 2015-2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <u_private.h>
+#include <ulfius.h>
+#if !defined(_WIN32) && !defined(U_WITH_FREERTOS)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(U_WITH_FREERTOS)
+
+/**
+ * Write all the data in the file, a write interrupted or incomplete goes on
+ * return U_OK on success
+ */
+static int ulfius_upload_file_write_all(int fd, const unsigned char * data, size_t size) {
+  ssize_t written;
+
+  while (size) {
+    if ((written = write(fd, data, size)) < 0) {
+      if (errno != EINTR) {
+        return U_ERROR;
+      }
+    } else {
+      data += written;
+      size -= (size_t)written;
+    }
+  }
+  return U_OK;
+}
+
+/**
+ * Free a file in progress, the file is closed, and removed if remove_file is set
+ */
+static void ulfius_upload_file_free(struct _u_upload_file * upload_file, int remove_file) {
+  if (upload_file != NULL) {
+    if (upload_file->fd >= 0) {
+      close(upload_file->fd);
+    }
+    if (remove_file && upload_file->path != NULL) {
+      unlink(upload_file->path);
+    }
+#ifndef U_DISABLE_GNUTLS
+    if (upload_file->hash != NULL) {
+      gnutls_hash_deinit(upload_file->hash, NULL);
+    }
+#endif
+    // The buffer is allocated with posix_memalign
+    free(upload_file->buffer);
+    o_free(upload_file->key);
+    o_free(upload_file->filename);
+    o_free(upload_file->path);
+    o_free(upload_file);
+  }
+}
+
+/**
+ * Create a file in the upload directory for a new file part
+ * the file name sent by the client isn't used in the path
+ * return the new file on success, NULL on error
+ */
+static struct _u_upload_file * ulfius_upload_file_new(const struct _u_instance * u_instance, const char * key, const char * filename) {
+  struct _u_upload_file * upload_file = o_malloc(sizeof(struct _u_upload_file));
+  void * buffer = NULL;
+#ifdef O_DIRECT
+  int fd_flags;
+#endif
+
+  if (upload_file == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for upload_file");
+    return NULL;
+  }
+  memset(upload_file, 0, sizeof(struct _u_upload_file));
+  upload_file->fd = -1;
+  // The buffer is aligned and its size is a multiple of the alignment, so it can be written with O_DIRECT
+  upload_file->buffer_size = u_instance->upload_file_buffer_size?u_instance->upload_file_buffer_size:U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE;
+  upload_file->buffer_size = ((upload_file->buffer_size+U_UPLOAD_FILE_ALIGNMENT-1)/U_UPLOAD_FILE_ALIGNMENT)*U_UPLOAD_FILE_ALIGNMENT;
+  if (posix_memalign(&buffer, U_UPLOAD_FILE_ALIGNMENT, upload_file->buffer_size)) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for upload_file->buffer");
+    ulfius_upload_file_free(upload_file, 0);
+    return NULL;
+  }
+  upload_file->buffer = buffer;
+  upload_file->key = o_strdup(key);
+  upload_file->filename = o_strdup(filename);
+  upload_file->path = msprintf("%s/ulfius-upload-XXXXXX", u_instance->upload_file_directory);
+  if (upload_file->key == NULL || upload_file->filename == NULL || upload_file->path == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for upload_file values");
+    ulfius_upload_file_free(upload_file, 0);
+    return NULL;
+  }
+  if ((upload_file->fd = mkstemp(upload_file->path)) < 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error creating upload file in %s", u_instance->upload_file_directory);
+    ulfius_upload_file_free(upload_file, 0);
+    return NULL;
+  }
+#ifdef O_DIRECT
+  // Some file systems don't support O_DIRECT, the file is written through the page cache then
+  if (u_instance->upload_file_flags & U_UPLOAD_FILE_DIRECT) {
+    if ((fd_flags = fcntl(upload_file->fd, F_GETFL)) != -1 && fcntl(upload_file->fd, F_SETFL, fd_flags|O_DIRECT) != -1) {
+      upload_file->direct = 1;
+    } else {
+      y_log_message(Y_LOG_LEVEL_DEBUG, "Ulfius - O_DIRECT not available for %s", upload_file->path);
+    }
+  }
+#endif
+#ifndef U_DISABLE_GNUTLS
+  if (gnutls_hash_init(&upload_file->hash, GNUTLS_DIG_SHA256) < 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error gnutls_hash_init");
+    upload_file->hash = NULL;
+    ulfius_upload_file_free(upload_file, 1);
+    return NULL;
+  }
+#endif
+  return upload_file;
+}
+
+/**
+ * Close and remove the file in progress, its path isn't tracked anymore
+ * the file in progress is always the last path tracked
+ */
+static void ulfius_upload_file_discard(struct connection_info_struct * con_info) {
+  if (con_info->upload_file != NULL) {
+    ulfius_upload_file_free(con_info->upload_file, 1);
+    con_info->upload_file = NULL;
+    if (con_info->nb_upload_file_paths) {
+      con_info->nb_upload_file_paths--;
+      o_free(con_info->upload_file_paths[con_info->nb_upload_file_paths]);
+      con_info->upload_file_paths[con_info->nb_upload_file_paths] = NULL;
+    }
+  }
+}
+
+/**
+ * Keep the path of the file created in the upload directory,
+ * so it's removed if the request isn't complete or isn't successful
+ * return U_OK on success
+ */
+static int ulfius_upload_file_track(struct connection_info_struct * con_info, const char * path) {
+  char ** paths = o_realloc(con_info->upload_file_paths, (con_info->nb_upload_file_paths+1)*sizeof(char *));
+
+  if (paths == NULL) {
+    return U_ERROR_MEMORY;
+  }
+  con_info->upload_file_paths = paths;
+  if ((con_info->upload_file_paths[con_info->nb_upload_file_paths] = o_strdup(path)) == NULL) {
+    return U_ERROR_MEMORY;
+  }
+  con_info->nb_upload_file_paths++;
+  return U_OK;
+}
+
+/**
+ * Return the name of the post parameters of a file sent in the post parameter key,
+ * the first file is given in key, the next files sent in the same post parameter in key.1, key.2, etc.
+ * return a new allocated string, NULL on error
+ */
+static char * ulfius_upload_file_param(const struct _u_map * map, const char * key) {
+  char * param = o_strdup(key);
+  size_t index = 0;
+
+  while (param != NULL && u_map_has_key(map, param)) {
+    o_free(param);
+    param = msprintf("%s.%zu", key, ++index);
+  }
+  return param;
+}
+
+/**
+ * Set the value of the post parameter param+suffix
+ * return U_OK on success
+ */
+static int ulfius_upload_file_put(struct _u_map * map, const char * param, const char * suffix, const char * value) {
+  char * name = msprintf("%s%s", param, suffix);
+  int ret;
+
+  if (name == NULL) {
+    ret = U_ERROR_MEMORY;
+  } else {
+    ret = u_map_put(map, name, value);
+  }
+  o_free(name);
+  return ret;
+}
+
+/**
+ * Remove the post parameters of a file, used when they're not all set
+ */
+static void ulfius_upload_file_remove_params(struct _u_map * map, const char * param) {
+  const char * suffixes[] = {"", "_size", "_filename", "_sha256", NULL};
+  char * name;
+  size_t i;
+
+  for (i=0; suffixes[i]!=NULL; i++) {
+    if ((name = msprintf("%s%s", param, suffixes[i])) != NULL) {
+      u_map_remove_from_key(map, name);
+      o_free(name);
+    }
+  }
+}
+
+int ulfius_upload_file_write(struct connection_info_struct * con_info, const char * key, const char * filename, const char * data, uint64_t off, size_t size) {
+  struct _u_upload_file * upload_file;
+  size_t len;
+
+  if (con_info->upload_file != NULL && (!off || o_strcmp(con_info->upload_file->key, key) || o_strcmp(con_info->upload_file->filename, filename))) {
+    // The previous file part is complete
+    if (ulfius_upload_file_complete(con_info) != U_OK) {
+      return U_ERROR;
+    }
+  }
+  if (con_info->upload_file == NULL) {
+    if ((upload_file = ulfius_upload_file_new(con_info->u_instance, key, filename)) == NULL) {
+      return U_ERROR;
+    }
+    if (ulfius_upload_file_track(con_info, upload_file->path) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for upload_file_paths");
+      ulfius_upload_file_free(upload_file, 1);
+      return U_ERROR;
+    }
+    con_info->upload_file = upload_file;
+  }
+  upload_file = con_info->upload_file;
+#ifndef U_DISABLE_GNUTLS
+  if (size && gnutls_hash(upload_file->hash, data, size) < 0) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error gnutls_hash");
+    ulfius_upload_file_discard(con_info);
+    return U_ERROR;
+  }
+#endif
+  upload_file->size += size;
+  while (size) {
+    if (!upload_file->buffer_len && !upload_file->direct && size >= upload_file->buffer_size) {
+      // A large block is written without being copied in the buffer first
+      len = size - size%upload_file->buffer_size;
+      if (ulfius_upload_file_write_all(upload_file->fd, (const unsigned char *)data, len) != U_OK) {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error writing upload file %s", upload_file->path);
+        ulfius_upload_file_discard(con_info);
+        return U_ERROR;
+      }
+    } else {
+      len = upload_file->buffer_size - upload_file->buffer_len;
+      if (len > size) {
+        len = size;
+      }
+      memcpy(upload_file->buffer + upload_file->buffer_len, data, len);
+      upload_file->buffer_len += len;
+      if (upload_file->buffer_len == upload_file->buffer_size) {
+        if (ulfius_upload_file_write_all(upload_file->fd, upload_file->buffer, upload_file->buffer_size) != U_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error writing upload file %s", upload_file->path);
+          ulfius_upload_file_discard(con_info);
+          return U_ERROR;
+        }
+        upload_file->buffer_len = 0;
+      }
+    }
+    data += len;
+    size -= len;
+  }
+  return U_OK;
+}
+
+int ulfius_upload_file_complete(struct connection_info_struct * con_info) {
+  struct _u_upload_file * upload_file = con_info->upload_file;
+  struct _u_map * map = con_info->request->map_upload_file;
+  char size_str[32], * param;
+#ifndef U_DISABLE_GNUTLS
+  unsigned char digest[32];
+  char hash_str[65];
+  size_t i;
+#endif
+#ifdef O_DIRECT
+  int fd_flags;
+#endif
+  int ret = U_OK;
+
+  if (upload_file == NULL) {
+    return U_OK;
+  }
+#ifdef O_DIRECT
+  // The end of the file isn't a multiple of the alignment, it's written without O_DIRECT
+  if (upload_file->direct && upload_file->buffer_len%U_UPLOAD_FILE_ALIGNMENT && (fd_flags = fcntl(upload_file->fd, F_GETFL)) != -1) {
+    fcntl(upload_file->fd, F_SETFL, fd_flags&~O_DIRECT);
+  }
+#endif
+  ret = ulfius_upload_file_write_all(upload_file->fd, upload_file->buffer, upload_file->buffer_len);
+  // The file descriptor isn't valid after close, even if close fails
+  if (close(upload_file->fd)) {
+    ret = U_ERROR;
+  }
+  upload_file->fd = -1;
+  if (ret != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error writing upload file %s", upload_file->path);
+    ulfius_upload_file_discard(con_info);
+    return U_ERROR;
+  }
+  snprintf(size_str, sizeof(size_str), "%" PRIu64, upload_file->size);
+  if ((param = ulfius_upload_file_param(map, upload_file->key)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for param");
+    ulfius_upload_file_discard(con_info);
+    return U_ERROR_MEMORY;
+  }
+  if (ulfius_upload_file_put(map, param, "", upload_file->path) != U_OK ||
+      ulfius_upload_file_put(map, param, "_size", size_str) != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting upload file values");
+    ret = U_ERROR_MEMORY;
+  }
+  // A file name which isn't valid utf8 is replaced with an empty string, so the values of a file are always complete
+  if (ret == U_OK && ulfius_upload_file_put(map, param, "_filename", (!con_info->u_instance->check_utf8 || utf8_check(upload_file->filename, o_strlen(upload_file->filename)) == NULL)?upload_file->filename:"") != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting upload file name");
+    ret = U_ERROR_MEMORY;
+  }
+#ifndef U_DISABLE_GNUTLS
+  gnutls_hash_deinit(upload_file->hash, digest);
+  upload_file->hash = NULL;
+  for (i=0; i<sizeof(digest); i++) {
+    snprintf(hash_str+(2*i), 3, "%02x", digest[i]);
+  }
+  if (ret == U_OK && ulfius_upload_file_put(map, param, "_sha256", hash_str) != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting upload file hash");
+    ret = U_ERROR_MEMORY;
+  }
+#endif
+  if (ret != U_OK) {
+    // The values already set are removed with the file
+    ulfius_upload_file_remove_params(map, param);
+  }
+  o_free(param);
+  if (ret == U_OK) {
+    ulfius_upload_file_free(upload_file, 0);
+    con_info->upload_file = NULL;
+  } else {
+    ulfius_upload_file_discard(con_info);
+  }
+  return ret;
+}
+
+void ulfius_upload_file_clean(struct connection_info_struct * con_info, int remove_files) {
+  size_t i;
+
+  ulfius_upload_file_discard(con_info);
+  for (i=0; i<con_info->nb_upload_file_paths; i++) {
+    if (remove_files) {
+      unlink(con_info->upload_file_paths[i]);
+    }
+    o_free(con_info->upload_file_paths[i]);
+  }
+  o_free(con_info->upload_file_paths);
+  con_info->upload_file_paths = NULL;
+  con_info->nb_upload_file_paths = 0;
+}
+
+#else
+
+int ulfius_upload_file_write(struct connection_info_struct * con_info, const char * key, const char * filename, const char * data, uint64_t off, size_t size) {
+  UNUSED(con_info);
+  UNUSED(key);
+  UNUSED(filename);
+  UNUSED(data);
+  UNUSED(off);
+  UNUSED(size);
+  y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Upload directory not available on this system");
+  return U_ERROR;
+}
+
+int ulfius_upload_file_complete(struct connection_info_struct * con_info) {
+  UNUSED(con_info);
+  return U_OK;
+}
+
+void ulfius_upload_file_clean(struct connection_info_struct * con_info, int remove_files) {
+  UNUSED(con_info);
+  UNUSED(remove_files);
+}
+
+#endif
@@ -0,0 +1,357 @@
+/**
+ *
+ * Ulfius Framework
+ *
+ * REST framework library
+ *
+ * u_utf8.c: utf8 validation of the request parameters
+ *
+ * Copyright 2015-2022 Nicolas Mora <mail@babelouest.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU GENERAL PUBLIC LICENSE for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <u_private.h>
+#include <ulfius.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(U_DISABLE_UTF8_SIMD)
+  #define U_UTF8_SIMD
+  #include <immintrin.h>
+#endif
+
+/**
+ * The utf8_check_scalar() function scans the string starting
+ * at s. It returns a pointer to the first byte of the first malformed
+ * or overlong UTF-8 sequence found, or NULL if the string contains
+ * only correct UTF-8. It also spots UTF-8 sequences that could cause
+ * trouble if converted to UTF-16, namely surrogate characters
+ * (U+D800..U+DFFF) and non-Unicode positions (U+FFFE..U+FFFF). This
+ * routine is very likely to find a malformed sequence if the input
+ * uses any other encoding than UTF-8. It therefore can be used as a
+ * very effective heuristic for distinguishing between UTF-8 and other
+ * encodings.
+ *
+ * I wrote this code mainly as a specification of functionality; there
+ * are no doubt performance optimizations possible for certain CPUs.
+ *
+ * Markus Kuhn <http://www.cl.cam.ac.uk/~mgk25/> -- 2005-03-30
+ * Nicolas Mora <mail@babelouest.org>
+ * License: http://www.cl.cam.ac.uk/~mgk25/short-license.html
+ */
+static const unsigned char * utf8_check_scalar(const char * s_orig, size_t len) {
+  const unsigned char * s = (unsigned char *)s_orig;
+  size_t i = 0;
+
+  while (i<len) {
+    if (*s < 0x80) {
+      /* 0xxxxxxx */
+      s++;
+      i++;
+    } else if ((s[0] & 0xe0) == 0xc0) {
+      /* 110XXXXx 10xxxxxx */
+      if ((i+1 >= len) ||
+          (s[1] & 0xc0) != 0x80 ||
+          (s[0] & 0xfe) == 0xc0) {                  /* overlong? */
+        return s;
+      } else {
+        s += 2;
+        i += 2;
+      }
+    } else if ((s[0] & 0xf0) == 0xe0) {
+      /* 1110XXXX 10Xxxxxx 10xxxxxx */
+      if ((i+2 >= len) ||
+          (s[1] & 0xc0) != 0x80 ||
+          (s[2] & 0xc0) != 0x80 ||
+          (s[0] == 0xe0 && (s[1] & 0xe0) == 0x80) ||                 /* overlong? */
+          (s[0] == 0xed && (s[1] & 0xe0) == 0xa0) ||                 /* surrogate? */
+          (s[0] == 0xef && s[1] == 0xbf && (s[2] & 0xfe) == 0xbe && /* U+FFFE or U+FFFF? */
+          s[2] != 0xbf && s[2] != 0xbe)) { /* Hideous hack to comply with autobahn testsuite, TODO: fix that one day (and other jokes I tell myself) */
+        return s;
+      } else {
+        s += 3;
+        i += 3;
+      }
+    } else if ((s[0] & 0xf8) == 0xf0) {
+      /* 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx */
+      if ((i+3 >= len) ||
+          (s[1] & 0xc0) != 0x80 ||
+          (s[2] & 0xc0) != 0x80 ||
+          (s[3] & 0xc0) != 0x80 ||
+          (s[0] == 0xf0 && (s[1] & 0xf0) == 0x80) ||      /* overlong? */
+          (s[0] == 0xf4 && s[1] > 0x8f) || s[0] > 0xf4) { /* > U+10FFFF? */
+        return s;
+      } else {
+        s += 4;
+        i += 4;
+      }
+    } else {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+#ifdef U_UTF8_SIMD
+
+/**
+ * Vectorized validation based on the lookup algorithm of John Keiser and Daniel Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte", Software: Practice and Experience 51 (5), 2021
+ * Each byte is checked with the 3 bytes before it, the errors of a pair of bytes
+ * are found in 3 tables indexed by the high nibble of the first byte,
+ * the low nibble of the first byte and the high nibble of the second byte
+ */
+
+/** Size of the blocks validated at once, the errors are checked after each block **/
+#define U_UTF8_BLOCK_SIZE 64
+
+#define U_UTF8_TOO_SHORT      0x01 /* 11______ 0_______ or 11______ 11______ */
+#define U_UTF8_TOO_LONG       0x02 /* 0_______ 10______ */
+#define U_UTF8_OVERLONG_3     0x04 /* 11100000 100_____ */
+#define U_UTF8_TOO_LARGE      0x08 /* 11110100 1001____ to 11111___ 101_____ */
+#define U_UTF8_SURROGATE      0x10 /* 11101101 101_____ */
+#define U_UTF8_OVERLONG_2     0x20 /* 1100000_ 10______ */
+#define U_UTF8_TOO_LARGE_1000 0x40 /* 11110101 1000____ to 11111___ 1000____ */
+#define U_UTF8_OVERLONG_4     0x40 /* 11110000 1000____ */
+#define U_UTF8_TWO_CONTS      0x80 /* 10______ 10______ */
+#define U_UTF8_CARRY          (U_UTF8_TOO_SHORT|U_UTF8_TOO_LONG|U_UTF8_TWO_CONTS)
+
+static const uint8_t utf8_byte_1_high[16] = {
+  /* 0_______ ________ ascii */
+  U_UTF8_TOO_LONG, U_UTF8_TOO_LONG, U_UTF8_TOO_LONG, U_UTF8_TOO_LONG,
+  U_UTF8_TOO_LONG, U_UTF8_TOO_LONG, U_UTF8_TOO_LONG, U_UTF8_TOO_LONG,
+  /* 10______ ________ continuation */
+  U_UTF8_TWO_CONTS, U_UTF8_TWO_CONTS, U_UTF8_TWO_CONTS, U_UTF8_TWO_CONTS,
+  /* 1100____ ________ two bytes lead */
+  U_UTF8_TOO_SHORT|U_UTF8_OVERLONG_2,
+  /* 1101____ ________ two bytes lead */
+  U_UTF8_TOO_SHORT,
+  /* 1110____ ________ three bytes lead */
+  U_UTF8_TOO_SHORT|U_UTF8_OVERLONG_3|U_UTF8_SURROGATE,
+  /* 1111____ ________ four bytes lead */
+  U_UTF8_TOO_SHORT|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000|U_UTF8_OVERLONG_4
+};
+
+static const uint8_t utf8_byte_1_low[16] = {
+  /* ____0000 ________ */
+  U_UTF8_CARRY|U_UTF8_OVERLONG_3|U_UTF8_OVERLONG_2|U_UTF8_OVERLONG_4,
+  /* ____0001 ________ */
+  U_UTF8_CARRY|U_UTF8_OVERLONG_2,
+  /* ____001_ ________ */
+  U_UTF8_CARRY,
+  U_UTF8_CARRY,
+  /* ____0100 ________ */
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE,
+  /* ____0101 ________ to ____1100 ________ */
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  /* ____1101 ________ */
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000|U_UTF8_SURROGATE,
+  /* ____111_ ________ */
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000,
+  U_UTF8_CARRY|U_UTF8_TOO_LARGE|U_UTF8_TOO_LARGE_1000
+};
+
+static const uint8_t utf8_byte_2_high[16] = {
+  /* ________ 0_______ ascii */
+  U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT,
+  U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT,
+  /* ________ 1000____ */
+  U_UTF8_TOO_LONG|U_UTF8_OVERLONG_2|U_UTF8_TWO_CONTS|U_UTF8_OVERLONG_3|U_UTF8_TOO_LARGE_1000|U_UTF8_OVERLONG_4,
+  /* ________ 1001____ */
+  U_UTF8_TOO_LONG|U_UTF8_OVERLONG_2|U_UTF8_TWO_CONTS|U_UTF8_OVERLONG_3|U_UTF8_TOO_LARGE,
+  /* ________ 101_____ */
+  U_UTF8_TOO_LONG|U_UTF8_OVERLONG_2|U_UTF8_TWO_CONTS|U_UTF8_SURROGATE|U_UTF8_TOO_LARGE,
+  U_UTF8_TOO_LONG|U_UTF8_OVERLONG_2|U_UTF8_TWO_CONTS|U_UTF8_SURROGATE|U_UTF8_TOO_LARGE,
+  /* ________ 11______ lead */
+  U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT, U_UTF8_TOO_SHORT
+};
+
+/**
+ * Highest values of the last bytes of a block that don't start a character continued in the next block
+ */
+static const uint8_t utf8_incomplete_max[32] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf
+};
+
+/**
+ * Return the errors of the 16 bytes of input, prev_input is the previous 16 bytes
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i utf8_check_sse41(__m128i input, __m128i prev_input, __m128i byte_1_high, __m128i byte_1_low, __m128i byte_2_high) {
+  const __m128i mask_0f = _mm_set1_epi8(0x0f);
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15), prev2 = _mm_alignr_epi8(input, prev_input, 14), prev3 = _mm_alignr_epi8(input, prev_input, 13),
+          special_cases, must_be_continuation;
+
+  special_cases = _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), mask_0f)),
+                                              _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, mask_0f))),
+                                _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), mask_0f)));
+  // Only the third byte after 111_____ and the fourth byte after 1111____ have their high bit set
+  must_be_continuation = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0-0x80)), _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0-0x80)));
+  return _mm_xor_si128(_mm_and_si128(must_be_continuation, _mm_set1_epi8((char)0x80)), special_cases);
+}
+
+/**
+ * Return the length of the blocks at the beginning of s without errors, with sse4.1 instructions
+ * the last character of these blocks may be incomplete
+ */
+__attribute__((target("sse4.1")))
+static size_t utf8_valid_prefix_sse41(const unsigned char * s, size_t len) {
+  const __m128i byte_1_high = _mm_loadu_si128((const __m128i *)utf8_byte_1_high),
+                byte_1_low = _mm_loadu_si128((const __m128i *)utf8_byte_1_low),
+                byte_2_high = _mm_loadu_si128((const __m128i *)utf8_byte_2_high),
+                incomplete_max = _mm_loadu_si128((const __m128i *)(utf8_incomplete_max+16));
+  __m128i input[4], prev_input = _mm_setzero_si128(), prev_incomplete = _mm_setzero_si128(), error;
+  size_t offset = 0;
+  int i;
+
+  while (offset + U_UTF8_BLOCK_SIZE <= len) {
+    for (i=0; i<4; i++) {
+      input[i] = _mm_loadu_si128((const __m128i *)(s+offset+(size_t)(16*i)));
+    }
+    if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(input[0], input[1]), _mm_or_si128(input[2], input[3])))) {
+      // An ascii block is valid if the previous block is complete
+      error = prev_incomplete;
+      prev_incomplete = _mm_setzero_si128();
+    } else {
+      error = _mm_setzero_si128();
+      for (i=0; i<4; i++) {
+        error = _mm_or_si128(error, utf8_check_sse41(input[i], prev_input, byte_1_high, byte_1_low, byte_2_high));
+        prev_input = input[i];
+      }
+      prev_incomplete = _mm_subs_epu8(input[3], incomplete_max);
+    }
+    if (!_mm_testz_si128(error, error)) {
+      break;
+    }
+    prev_input = input[3];
+    offset += U_UTF8_BLOCK_SIZE;
+  }
+  return offset;
+}
+
+/**
+ * Return the errors of the 32 bytes of input, prev_input is the previous 32 bytes
+ */
+__attribute__((target("avx2")))
+static inline __m256i utf8_check_avx2(__m256i input, __m256i prev_input, __m256i byte_1_high, __m256i byte_1_low, __m256i byte_2_high) {
+  const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+  // The bytes before input are in the high lane of prev_input and in the low lane of input
+  __m256i prev_lanes = _mm256_permute2x128_si256(prev_input, input, 0x21),
+          prev1 = _mm256_alignr_epi8(input, prev_lanes, 15), prev2 = _mm256_alignr_epi8(input, prev_lanes, 14), prev3 = _mm256_alignr_epi8(input, prev_lanes, 13),
+          special_cases, must_be_continuation;
+
+  special_cases = _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), mask_0f)),
+                                                    _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, mask_0f))),
+                                   _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), mask_0f)));
+  must_be_continuation = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0-0x80)), _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0-0x80)));
+  return _mm256_xor_si256(_mm256_and_si256(must_be_continuation, _mm256_set1_epi8((char)0x80)), special_cases);
+}
+
+/**
+ * Return the length of the blocks at the beginning of s without errors, with avx2 instructions
+ * the last character of these blocks may be incomplete
+ */
+__attribute__((target("avx2")))
+static size_t utf8_valid_prefix_avx2(const unsigned char * s, size_t len) {
+  const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_high)),
+                byte_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_low)),
+                byte_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_2_high)),
+                incomplete_max = _mm256_loadu_si256((const __m256i *)utf8_incomplete_max);
+  __m256i input[2], prev_input = _mm256_setzero_si256(), prev_incomplete = _mm256_setzero_si256(), error;
+  size_t offset = 0;
+
+  while (offset + U_UTF8_BLOCK_SIZE <= len) {
+    input[0] = _mm256_loadu_si256((const __m256i *)(s+offset));
+    input[1] = _mm256_loadu_si256((const __m256i *)(s+offset+32));
+    if (!_mm256_movemask_epi8(_mm256_or_si256(input[0], input[1]))) {
+      // An ascii block is valid if the previous block is complete
+      error = prev_incomplete;
+      prev_incomplete = _mm256_setzero_si256();
+    } else {
+      error = _mm256_or_si256(utf8_check_avx2(input[0], prev_input, byte_1_high, byte_1_low, byte_2_high),
+                              utf8_check_avx2(input[1], input[0], byte_1_high, byte_1_low, byte_2_high));
+      prev_incomplete = _mm256_subs_epu8(input[1], incomplete_max);
+    }
+    if (!_mm256_testz_si256(error, error)) {
+      break;
+    }
+    prev_input = input[1];
+    offset += U_UTF8_BLOCK_SIZE;
+  }
+  return offset;
+}
+
+typedef size_t (* utf8_valid_prefix_function)(const unsigned char * s, size_t len);
+
+/**
+ * Validator selected for the processor at the first call
+ */
+static utf8_valid_prefix_function utf8_valid_prefix = NULL;
+
+static size_t utf8_valid_prefix_none(const unsigned char * s, size_t len) {
+  UNUSED(s);
+  UNUSED(len);
+  return 0;
+}
+
+static utf8_valid_prefix_function utf8_select_valid_prefix(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &utf8_valid_prefix_avx2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    return &utf8_valid_prefix_sse41;
+  } else {
+    return &utf8_valid_prefix_none;
+  }
+}
+
+#endif
+
+const unsigned char * utf8_check(const char * s_orig, size_t len) {
+#ifdef U_UTF8_SIMD
+  const unsigned char * s = (const unsigned char *)s_orig;
+  utf8_valid_prefix_function valid_prefix;
+  size_t offset, i;
+
+  if (len >= U_UTF8_BLOCK_SIZE) {
+    if ((valid_prefix = U_ATOMIC_LOAD(&utf8_valid_prefix)) == NULL) {
+      valid_prefix = utf8_select_valid_prefix();
+      U_ATOMIC_STORE(&utf8_valid_prefix, valid_prefix);
+    }
+    offset = valid_prefix(s, len);
+    // The blocks validated may end with an incomplete character,
+    // the scalar validation goes on from its first byte, so the error returned is the same
+    for (i=offset; i>0 && offset-i<3; i--) {
+      if ((s[i-1] & 0xc0) != 0x80) {
+        if (s[i-1] >= 0xc0) {
+          offset = i-1;
+        }
+        break;
+      }
+    }
+    return utf8_check_scalar(s_orig+offset, len-offset);
+  }
+#endif
+  return utf8_check_scalar(s_orig, len);
+}
@@ -864,7 +864,7 @@ static int ulfius_websocket_connection_handshake(struct _u_request * request, st
   char * http_line, ** split_line = NULL, * key, * value, ** extension_list = NULL, * endptr = NULL;
   const char * separator;
   char buffer[U_WEBSOCKET_RESPONSE_BUFFER_LEN+1] = {0};
-  const char ** keys;
+  struct _u_map_iter iter;
   size_t buffer_len = U_WEBSOCKET_RESPONSE_BUFFER_LEN, line_len, extension_len, i, j;
   struct _websocket_extension * w_extension;
   long int content_length;
@@ -896,14 +896,14 @@ static int ulfius_websocket_connection_handshake(struct _u_request * request, st
     o_free(http_line);
   }
 
-  keys = u_map_enum_keys(request->map_header);
-  for (i=0; keys[i] != NULL; i++) {
-    http_line = msprintf("%s: %s\r\n", keys[i], u_map_get_case(request->map_header, keys[i]));
+  u_map_iter_begin(request->map_header, &iter);
+  while (u_map_iter_next(&iter)) {
+    http_line = msprintf("%s: %s\r\n", iter.key, u_map_get_case(request->map_header, iter.key));
     ulfius_websocket_send_frame(websocket->websocket_manager, (uint8_t *)http_line, o_strlen(http_line));
     o_free(http_line);
-    if (0 == o_strcmp("Sec-WebSocket-Protocol", keys[i])) {
+    if (0 == o_strcmp("Sec-WebSocket-Protocol", iter.key)) {
       check_websocket |= WEBSOCKET_RESPONSE_PROTCOL;
-    } else if (0 == o_strcmp("Sec-WebSocket-Extension", keys[i])) {
+    } else if (0 == o_strcmp("Sec-WebSocket-Extension", iter.key)) {
       check_websocket |= WEBSOCKET_RESPONSE_EXTENSION;
     }
   }
@@ -943,7 +943,7 @@ static int ulfius_websocket_connection_handshake(struct _u_request * request, st
           } else if (0 == o_strcasecmp(key, "Sec-WebSocket-Extensions")) {
             websocket->websocket_manager->extensions = o_strdup(value);
             websocket_response |= WEBSOCKET_RESPONSE_EXTENSION;
-          } else if (0 == o_strcasecmp(buffer, "Sec-WebSocket-Accept") && ulfius_check_handshake_response(u_map_get_case(request->map_header, "Sec-WebSocket-Key"), value) == U_OK) {
+          } else if (0 == o_strcasecmp(buffer, "Sec-WebSocket-Accept") && ulfius_check_handshake_response(u_map_get_known(request->map_header, U_HDR_SEC_WEBSOCKET_KEY), value) == U_OK) {
             websocket_response |= WEBSOCKET_RESPONSE_ACCEPT;
           }
           o_free(key);
@@ -32,6 +32,9 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#if !defined(_WIN32) && !defined(U_WITH_FREERTOS)
+#include <unistd.h>
+#endif
 
 /** Define mock yder functions when yder is disabled **/
 #ifdef U_DISABLE_YDER
@@ -63,6 +66,7 @@ int y_close_logs(void) {
 
 /**
  * Fill a map with the key/values specified
+ * The key/values are borrowed from the connection, they stay valid until the request is completed
  */
 #if MHD_VERSION >= 0x00097002
 static enum MHD_Result ulfius_fill_map_check_utf8(void * cls, enum MHD_ValueKind kind, const char * key, const char * value)
@@ -89,7 +93,7 @@ static int ulfius_fill_map_check_utf8(void * cls, enum MHD_ValueKind kind, const
       } else {
         return MHD_NO;
       }
-    } else if (u_map_put(((struct _u_map *)cls), key, (value==NULL?"":value)) == U_OK) {
+    } else if (u_map_put_borrowed(((struct _u_map *)cls), key, (value==NULL?"":value)) == U_OK) {
       return MHD_YES;
     } else {
       return MHD_NO;
@@ -101,6 +105,7 @@ static int ulfius_fill_map_check_utf8(void * cls, enum MHD_ValueKind kind, const
 
 /**
  * Fill a map with the key/values specified
+ * The key/values are borrowed from the connection, they stay valid until the request is completed
  */
 #if MHD_VERSION >= 0x00097002
 static enum MHD_Result ulfius_fill_map(void * cls, enum MHD_ValueKind kind, const char * key, const char * value)
@@ -126,7 +131,7 @@ static int ulfius_fill_map(void * cls, enum MHD_ValueKind kind, const char * key
     } else {
       return MHD_NO;
     }
-  } else if (u_map_put(((struct _u_map *)cls), key, (value==NULL?"":value)) == U_OK) {
+  } else if (u_map_put_borrowed(((struct _u_map *)cls), key, (value==NULL?"":value)) == U_OK) {
     return MHD_YES;
   } else {
     return MHD_NO;
@@ -194,6 +199,9 @@ static int ulfius_validate_instance(const struct _u_instance * u_instance) {
   if (u_instance == NULL ||
       u_instance->port <= 0 ||
       u_instance->port >= 65536 ||
+      (u_instance->daemon_mode != U_DAEMON_MODE_THREAD_PER_CONNECTION && u_instance->daemon_mode != U_DAEMON_MODE_THREAD_POOL) ||
+      !u_instance->post_body_storage || (u_instance->post_body_storage & ~(U_POST_BODY_RAW|U_POST_BODY_PARSED)) ||
+      !u_instance->post_processor_buffer_size ||
       ulfius_validate_endpoint_list(u_instance->endpoint_list, u_instance->nb_endpoints) != U_OK) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error, instance or has invalid parameters");
     return U_ERROR_PARAMS;
@@ -201,54 +209,79 @@ static int ulfius_validate_instance(const struct _u_instance * u_instance) {
   return U_OK;
 }
 
+/**
+ * ulfius_update_router
+ * compile the endpoint list of the instance into a new routing table
+ * and replace the previous one
+ * the write lock of u_instance->router must be held
+ * return U_OK on success
+ */
+static int ulfius_update_router(struct _u_instance * u_instance) {
+  struct _u_router * router = NULL;
+
+  if (u_instance->nb_endpoints > 0 && (router = ulfius_router_compile(u_instance->endpoint_list, (size_t)u_instance->nb_endpoints, u_instance->route_cache_size)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_router_compile");
+    return U_ERROR_MEMORY;
+  }
+  ulfius_router_publish((struct _u_router_handler *)u_instance->router, router);
+  return U_OK;
+}
+
+/**
+ * ulfius_refresh_router
+ * take the write lock of u_instance->router and update the routing table
+ * return U_OK on success
+ */
+static int ulfius_refresh_router(struct _u_instance * u_instance) {
+  int ret;
+
+  if (u_instance->router == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error, u_instance->router is not initialized");
+    return U_ERROR_PARAMS;
+  }
+  ulfius_router_lock((struct _u_router_handler *)u_instance->router);
+  ret = ulfius_update_router(u_instance);
+  ulfius_router_unlock((struct _u_router_handler *)u_instance->router);
+  return ret;
+}
+
 /**
  * Internal method used to duplicate the full url before it's manipulated and modified by MHD
+ * con_info, the request and their values live in the arena of a request context,
+ * taken from the instance pool if possible
  */
 void * ulfius_uri_logger (void * cls, const char * uri) {
-  struct connection_info_struct * con_info = o_malloc (sizeof (struct connection_info_struct));
-  UNUSED(cls);
+  struct _u_instance * u_instance = (struct _u_instance *)cls;
+  struct _u_request_context * context = NULL;
 
-  if (con_info != NULL) {
-    memset(con_info, 0, sizeof(struct connection_info_struct));
-    con_info->callback_first_iteration = 1;
-    con_info->u_instance = NULL;
-    u_map_init(&con_info->map_url_initial);
-    con_info->request = o_malloc(sizeof(struct _u_request));
-    if (con_info->request == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->request");
-      o_free(con_info);
-      return NULL;
-    }
+  if (u_instance != NULL && u_instance->pool != NULL && u_instance->pool_max_retained) {
+    context = ulfius_pool_get((struct _u_pool *)u_instance->pool);
+  }
+  if (context == NULL && (context = ulfius_request_context_new(u_instance!=NULL?u_instance->arena_block_size:U_ARENA_DEFAULT_BLOCK_SIZE)) == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info");
+    return NULL;
+  }
 
-    if (ulfius_init_request(con_info->request) != U_OK) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error initializing con_info->request");
-      ulfius_clean_request_full(con_info->request);
-      o_free(con_info);
-      return NULL;
-    }
-    con_info->request->http_url = o_strdup(uri);
-    if (o_strchr(uri, '?') != NULL) {
-      con_info->request->url_path = o_strndup(uri, (size_t)(o_strchr(uri, '?') - uri));
-    } else {
-      con_info->request->url_path = o_strdup(uri);
-    }
-    if (con_info->request->http_url == NULL || con_info->request->url_path == NULL) {
-      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->request->http_url or con_info->request->url_path");
-      ulfius_clean_request_full(con_info->request);
-      o_free(con_info);
-      return NULL;
-    }
-    con_info->max_post_param_size = 0;
+  context->con_info.u_instance = u_instance;
+  context->request.http_url = ulfius_arena_strdup(context->con_info.arena, uri);
+  if (o_strchr(uri, '?') != NULL) {
+    context->request.url_path = ulfius_arena_strndup(context->con_info.arena, uri, (size_t)(o_strchr(uri, '?') - uri));
   } else {
-    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info");
+    context->request.url_path = ulfius_arena_strdup(context->con_info.arena, uri);
   }
-  return con_info;
+  if (context->request.http_url == NULL || context->request.url_path == NULL) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->request->http_url or con_info->request->url_path");
+    ulfius_request_context_free(context);
+    return NULL;
+  }
+  return &context->con_info;
 }
 
 /**
  * ulfius_get_body_from_response
  * Extract the body data from the response if any
- * Copy it in newly allocated response_buffer and set the size in response_buffer_len
+ * The body isn't copied, its ownership is transferred to response_buffer
+ * and response->binary_body is reset, the size is set in response_buffer_len
  * return U_OK on success
  */
 static int ulfius_get_body_from_response(struct _u_response * response, void ** response_buffer, size_t * response_buffer_len) {
@@ -256,21 +289,11 @@ static int ulfius_get_body_from_response(struct _u_response * response, void **
     return U_ERROR_PARAMS;
   } else {
     if (response->binary_body != NULL && response->binary_body_length > 0) {
-      // The user sent a binary response
-      *response_buffer = o_malloc(response->binary_body_length);
-      if (*response_buffer == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response_buffer");
-        response->status = MHD_HTTP_INTERNAL_SERVER_ERROR;
-        response->binary_body = (unsigned char *)o_strdup(ULFIUS_HTTP_ERROR_BODY);
-        response->binary_body_length = o_strlen(ULFIUS_HTTP_ERROR_BODY);
-        if (response->binary_body == NULL) {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for response->binary_body");
-          return U_ERROR_MEMORY;
-        }
-      } else {
-        memcpy(*response_buffer, response->binary_body, response->binary_body_length);
-        *response_buffer_len = response->binary_body_length;
-      }
+      // The user sent a binary response, the MHD response will free it once sent
+      *response_buffer = response->binary_body;
+      *response_buffer_len = response->binary_body_length;
+      response->binary_body = NULL;
+      response->binary_body_length = 0;
     } else {
       *response_buffer = NULL;
       *response_buffer_len = 0;
@@ -303,6 +326,28 @@ void mhd_redirect_log(void * arg, const char * fmt, va_list ap) {
   va_end(args_cpy2);
 }
 
+/**
+ * ulfius_clean_suspend_state
+ * drop the routing table of a suspended request, the callback list state is free'd with the arena
+ */
+static void ulfius_clean_suspend_state(struct connection_info_struct * con_info) {
+  if (con_info->suspend_state != NULL) {
+    ulfius_router_drop((struct _u_router_handler *)con_info->u_instance->router, con_info->suspend_state->router);
+    con_info->suspend_state = NULL;
+  }
+}
+
+/**
+ * ulfius_free_request_context
+ * free the shared_data of the response, then the request context
+ */
+static void ulfius_free_request_context(struct connection_info_struct * con_info) {
+  if (con_info->response != NULL && con_info->response->free_shared_data != NULL && con_info->response->shared_data != NULL) {
+    con_info->response->free_shared_data(con_info->response->shared_data);
+  }
+  ulfius_request_context_free((struct _u_request_context *)con_info);
+}
+
 /**
  * mhd_request_completed
  * function used to clean data allocated after a web call is complete
@@ -310,6 +355,8 @@ void mhd_redirect_log(void * arg, const char * fmt, va_list ap) {
 void mhd_request_completed (void *cls, struct MHD_Connection *connection,
                         void **con_cls, enum MHD_RequestTerminationCode toe) {
   struct connection_info_struct *con_info = *con_cls;
+  struct _u_instance * u_instance;
+  int terminated = 0;
   UNUSED(toe);
   UNUSED(connection);
   UNUSED(cls);
@@ -320,11 +367,39 @@ void mhd_request_completed (void *cls, struct MHD_Connection *connection,
   if (con_info->has_post_processor && con_info->post_processor != NULL) {
     MHD_destroy_post_processor (con_info->post_processor);
   }
-  ulfius_clean_request_full(con_info->request);
-  u_map_clean(&con_info->map_url_initial);
-  con_info->request = NULL;
-  o_free(con_info);
-  con_info = NULL;
+  // The files uploaded are removed unless the request was complete and successful
+  ulfius_upload_file_clean(con_info, !con_info->upload_file_keep);
+  u_instance = con_info->u_instance;
+  // If the connection is closed while the request is suspended, the application still uses the request and the response,
+  // the request context is free'd by ulfius_resume_response or ulfius_resume_request_body instead
+  while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+  if (con_info->suspend_status == U_SUSPEND_STATUS_SUSPENDED) {
+    con_info->suspend_status = U_SUSPEND_STATUS_TERMINATED;
+    terminated = 1;
+  } else if (con_info->body_status == U_BODY_STATUS_SUSPENDED) {
+    con_info->body_status = U_BODY_STATUS_TERMINATED;
+    terminated = 1;
+  }
+  U_ATOMIC_CLEAR(&con_info->suspend_lock);
+  if (con_info->suspend_state != NULL) {
+    // The connection was closed before the suspended request was complete,
+    // the request context isn't reused in case the response is still referenced
+    ulfius_clean_suspend_state(con_info);
+    u_instance = NULL;
+  }
+  if (terminated) {
+    y_log_message(Y_LOG_LEVEL_DEBUG, "Ulfius - Connection closed while the request is suspended");
+  } else {
+    // The request context is kept for the next request if the pool isn't full
+    if (con_info->response != NULL && con_info->response->free_shared_data != NULL && con_info->response->shared_data != NULL) {
+      con_info->response->free_shared_data(con_info->response->shared_data);
+    }
+    if (u_instance == NULL || u_instance->pool == NULL || !u_instance->pool_max_retained ||
+        ulfius_request_context_recycle((struct _u_request_context *)con_info) != U_OK ||
+        ulfius_pool_put((struct _u_pool *)u_instance->pool, (struct _u_request_context *)con_info, u_instance->pool_max_retained) != U_OK) {
+      ulfius_request_context_free((struct _u_request_context *)con_info);
+    }
+  }
   *con_cls = NULL;
 }
 
@@ -362,6 +437,11 @@ static int mhd_iterate_post_data (void * coninfo_cls, enum MHD_ValueKind kind, c
     if (con_info->u_instance->file_upload_callback(con_info->request, key, filename, content_type, transfer_encoding, data, off, size, con_info->u_instance->file_upload_cls) != U_OK) {
       ret = MHD_NO;
     }
+  } else if (filename != NULL && con_info->u_instance->upload_file_directory != NULL) {
+    // The files are written only if an endpoint matches the request, otherwise they're dropped
+    if (con_info->upload_file_allowed && (con_info->upload_file_status = ulfius_upload_file_write(con_info, key, filename, data, off, size)) != U_OK) {
+      ret = MHD_NO;
+    }
   } else {
 
     do {
@@ -423,6 +503,217 @@ static int mhd_iterate_post_data (void * coninfo_cls, enum MHD_ValueKind kind, c
   return ret;
 }
 
+/**
+ * ulfius_suspend_request
+ * keep the callback list state of the request, then suspend the connection
+ * until ulfius_resume_response is called
+ * the reader of the routing table is unregistered, the routing table is retained instead
+ * return U_OK if the connection is suspended
+ * U_ERROR if ulfius_resume_response was already called, so the callback list must go on right away
+ * U_ERROR_MEMORY on error
+ */
+static int ulfius_suspend_request(struct connection_info_struct * con_info,
+                                  struct _u_router * router,
+                                  size_t reader_slot,
+                                  const struct _u_endpoint ** endpoint_list,
+                                  int endpoint_list_in_arena,
+                                  size_t nb_endpoints,
+                                  size_t index,
+                                  const struct _u_route_captures * captures) {
+  int ret;
+
+  if (con_info->suspend_state == NULL) {
+    if ((con_info->suspend_state = ulfius_arena_alloc(con_info->arena, sizeof(struct _u_suspend_state))) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->suspend_state");
+      return U_ERROR_MEMORY;
+    }
+    if (endpoint_list_in_arena) {
+      con_info->suspend_state->endpoint_list = endpoint_list;
+    } else if ((con_info->suspend_state->endpoint_list = ulfius_arena_alloc(con_info->arena, nb_endpoints*sizeof(struct _u_endpoint *))) != NULL) {
+      memcpy(con_info->suspend_state->endpoint_list, endpoint_list, nb_endpoints*sizeof(struct _u_endpoint *));
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->suspend_state->endpoint_list");
+      con_info->suspend_state = NULL;
+      return U_ERROR_MEMORY;
+    }
+    con_info->suspend_state->router = router;
+    con_info->suspend_state->nb_endpoints = nb_endpoints;
+    memcpy(&con_info->suspend_state->captures, captures, sizeof(struct _u_route_captures));
+    ulfius_router_retain((struct _u_router_handler *)con_info->u_instance->router, router, reader_slot);
+  }
+  con_info->suspend_state->index = index;
+
+  // ulfius_resume_response may be called by another thread before the connection is suspended
+  while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+  if (con_info->suspend_status == U_SUSPEND_STATUS_RESUMED) {
+    ret = U_ERROR;
+  } else {
+    con_info->suspend_status = U_SUSPEND_STATUS_SUSPENDED;
+    MHD_suspend_connection(con_info->connection);
+    ret = U_OK;
+  }
+  U_ATOMIC_CLEAR(&con_info->suspend_lock);
+  return ret;
+}
+
+/**
+ * ulfius_get_resume_callback_ret
+ * return the result given to ulfius_resume_response for the suspended callback
+ */
+static int ulfius_get_resume_callback_ret(struct connection_info_struct * con_info) {
+  int ret;
+
+  while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+  ret = con_info->resume_callback_ret;
+  con_info->suspend_status = U_SUSPEND_STATUS_NONE;
+  U_ATOMIC_CLEAR(&con_info->suspend_lock);
+  return ret;
+}
+
+/**
+ * ulfius_find_body_callback
+ * look for the first endpoint matching the request with a body_callback, before the body is read
+ * the url parameters of this endpoint are set in request->map_url, so they're available to the body_callback
+ * if the instance has an upload directory, the files are allowed to be written there only if an endpoint matches the request
+ * return U_OK on success, even if no endpoint has a body_callback
+ */
+static int ulfius_find_body_callback(struct connection_info_struct * con_info, const char * method) {
+  const struct _u_endpoint * endpoint_matches[U_ROUTER_MATCH_STACK_SIZE], ** endpoint_list = endpoint_matches;
+  struct _u_router_handler * handler = (struct _u_router_handler *)con_info->u_instance->router;
+  struct _u_router * router;
+  struct _u_route_captures captures;
+  const struct _u_route_params * params;
+  size_t nb_matches, i, reader_slot = 0;
+  int ret = U_OK;
+
+  router = ulfius_router_acquire(handler, &reader_slot);
+  if (router != NULL && (router->nb_body_callbacks || con_info->u_instance->upload_file_directory != NULL)) {
+    nb_matches = ulfius_router_lookup(handler, router, method, con_info->request->url_path, endpoint_matches, U_ROUTER_MATCH_STACK_SIZE, &captures);
+    if (nb_matches > U_ROUTER_MATCH_STACK_SIZE) {
+      if ((endpoint_list = ulfius_arena_alloc(con_info->arena, nb_matches*sizeof(struct _u_endpoint *))) != NULL) {
+        ulfius_router_match(router, method, con_info->request->url_path, endpoint_list, nb_matches, &captures);
+      } else {
+        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for endpoint_list");
+        nb_matches = 0;
+        ret = U_ERROR_MEMORY;
+      }
+    }
+    con_info->upload_file_allowed = nb_matches || (con_info->u_instance->default_endpoint != NULL && con_info->u_instance->default_endpoint->callback_function != NULL);
+    for (i=0; i<nb_matches; i++) {
+      if (endpoint_list[i]->body_callback != NULL) {
+        // The endpoint belongs to the routing table, only its body_callback and user_data are kept
+        con_info->body_callback = endpoint_list[i]->body_callback;
+        con_info->body_user_data = endpoint_list[i]->user_data;
+        con_info->request->body_handle = con_info->u_instance->allow_suspend?con_info:NULL;
+        if (u_map_merge(con_info->request->map_url, &con_info->map_url_initial, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW) != U_OK) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_merge map_url");
+          ret = U_ERROR_MEMORY;
+        } else if ((params = ulfius_router_get_params(router, endpoint_list[i])) != NULL) {
+          ret = ulfius_router_parse_url(params, con_info->request->url_path, &captures, con_info->request->map_url, con_info->u_instance->check_utf8);
+        } else {
+          ret = ulfius_parse_url(con_info->request->url_path, endpoint_list[i], con_info->request->map_url, con_info->u_instance->check_utf8);
+        }
+        break;
+      }
+    }
+  }
+  ulfius_router_release(handler, reader_slot);
+  return ret;
+}
+
+/**
+ * ulfius_reserve_request_body
+ * make sure request->binary_body can hold length bytes
+ * the body is first allocated with the size given in the Content-Length header if any, up to U_BODY_PREALLOC_MAX_SIZE,
+ * then its capacity is doubled, so a large or chunked body isn't reallocated for each chunk
+ * the capacity never exceeds the Content-Length nor max_post_body_size
+ * return U_OK on success
+ */
+static int ulfius_reserve_request_body(struct connection_info_struct * con_info, size_t length) {
+  size_t capacity = con_info->body_capacity, limit = SIZE_MAX;
+  unsigned long long content_length;
+  const char * content_length_value;
+  char * end = NULL;
+  void * body;
+
+  if (length <= capacity) {
+    return U_OK;
+  }
+  content_length_value = u_map_get_known(con_info->request->map_header, U_HDR_CONTENT_LENGTH);
+  if (content_length_value != NULL && isdigit((unsigned char)content_length_value[0])) {
+    content_length = strtoull(content_length_value, &end, 10);
+    if (*end == '\0' && content_length < SIZE_MAX) {
+      limit = (size_t)content_length;
+    }
+  }
+  if (!capacity && limit != SIZE_MAX) {
+    // A client can announce a large body and send nothing, only a small buffer is allocated before the data is received
+    capacity = limit<U_BODY_PREALLOC_MAX_SIZE?limit:U_BODY_PREALLOC_MAX_SIZE;
+  } else if (capacity <= SIZE_MAX/2) {
+    capacity *= 2;
+  }
+  if (con_info->u_instance->max_post_body_size > 0 && con_info->u_instance->max_post_body_size < limit) {
+    limit = (size_t)con_info->u_instance->max_post_body_size;
+  }
+  if (capacity > limit) {
+    capacity = limit;
+  }
+  if (capacity < length) {
+    capacity = length;
+  }
+  if ((body = o_realloc(con_info->request->binary_body, capacity)) == NULL) {
+    return U_ERROR_MEMORY;
+  }
+  if (con_info->u_instance->pool != NULL) {
+    U_ATOMIC_INCREMENT(&((struct _u_pool *)con_info->u_instance->pool)->body_reallocs);
+    U_ATOMIC_ADD(&((struct _u_pool *)con_info->u_instance->pool)->body_bytes_copied, con_info->request->binary_body_length);
+  }
+  con_info->request->binary_body = body;
+  con_info->body_capacity = capacity;
+  return U_OK;
+}
+
+/**
+ * ulfius_stream_request_body
+ * give a chunk of the request body to the body_callback
+ * if the body_callback returns U_CALLBACK_SUSPEND, the connection is suspended until ulfius_resume_request_body is called
+ * if the body_callback fails, the rest of the body is discarded and the request ends with an error 500
+ */
+static void ulfius_stream_request_body(struct connection_info_struct * con_info, const char * data, size_t size) {
+  if (con_info->body_callback_ret != U_CALLBACK_CONTINUE) {
+    return;
+  }
+  if (con_info->u_instance->max_post_body_size > 0 && con_info->body_offset + size > con_info->u_instance->max_post_body_size) {
+    size = con_info->body_offset < con_info->u_instance->max_post_body_size?(size_t)(con_info->u_instance->max_post_body_size - con_info->body_offset):0;
+  }
+  if (size) {
+    // A previous ulfius_resume_request_body without U_CALLBACK_SUSPEND is ignored
+    while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+    con_info->body_status = U_BODY_STATUS_NONE;
+    U_ATOMIC_CLEAR(&con_info->suspend_lock);
+
+    con_info->body_callback_ret = con_info->body_callback(con_info->request, data, con_info->body_offset, size, con_info->body_user_data);
+    con_info->body_offset += size;
+    if (con_info->body_callback_ret == U_CALLBACK_SUSPEND && !con_info->u_instance->allow_suspend) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error U_CALLBACK_SUSPEND is available in U_DAEMON_MODE_THREAD_POOL only, the rest of the request body is discarded");
+      con_info->body_callback_ret = U_CALLBACK_ERROR;
+    } else if (con_info->body_callback_ret == U_CALLBACK_SUSPEND) {
+      // ulfius_resume_request_body may be called by another thread before the connection is suspended
+      while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+      if (con_info->body_status == U_BODY_STATUS_RESUMED) {
+        con_info->body_status = U_BODY_STATUS_NONE;
+      } else {
+        con_info->body_status = U_BODY_STATUS_SUSPENDED;
+        MHD_suspend_connection(con_info->connection);
+      }
+      U_ATOMIC_CLEAR(&con_info->suspend_lock);
+      con_info->body_callback_ret = U_CALLBACK_CONTINUE;
+    } else if (con_info->body_callback_ret != U_CALLBACK_CONTINUE) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error body_callback, the rest of the request body is discarded");
+    }
+  }
+}
+
 #if MHD_VERSION >= 0x00096100
   #define MHD_CREATE_RESPONSE_FROM_BUFFER_PIMPED(len, buf, flag) MHD_create_response_from_buffer_with_free_callback((len), (buf), &o_free)
 #else
@@ -454,14 +745,18 @@ static int ulfius_webservice_dispatcher (void * cls,
                                          void ** con_cls)
 #endif
 {
-  struct _u_endpoint * endpoint_list = ((struct _u_instance *)cls)->endpoint_list, ** current_endpoint_list = NULL, * current_endpoint = NULL;
+  const struct _u_endpoint * endpoint_matches[U_ROUTER_MATCH_STACK_SIZE], ** current_endpoint_list = endpoint_matches, * current_endpoint = NULL;
+  struct _u_router * router = NULL;
+  struct _u_route_captures captures;
+  const struct _u_route_params * current_params = NULL, * previous_params = NULL;
   struct connection_info_struct * con_info = * con_cls;
 #if MHD_VERSION >= 0x00097002
   enum MHD_Result mhd_ret = MHD_NO;
 #else
   int mhd_ret = MHD_NO;
 #endif
-  int callback_ret = U_OK, i, close_loop = 0, inner_error = U_OK, mhd_response_flag;
+  int callback_ret = U_OK, close_loop = 0, inner_error = U_OK, mhd_response_flag, parse_ret, resumed = 0, suspend_ret;
+  size_t nb_endpoint_matches = 0, i, first_index = 0, reader_slot = 0;
 #ifndef U_DISABLE_WEBSOCKET
   // Websocket variables
   int upgrade_protocol = 0;
@@ -522,12 +817,13 @@ static int ulfius_webservice_dispatcher (void * cls,
     }
 #endif
     con_info->callback_first_iteration = 0;
+    con_info->connection = connection;
     so_client = MHD_get_connection_info (connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS)->client_addr;
     con_info->has_post_processor = 0;
     con_info->max_post_param_size = ((struct _u_instance *)cls)->max_post_param_size;
-    con_info->request->http_protocol = o_strdup(version);
-    con_info->request->http_verb = o_strdup(method);
-    con_info->request->client_address = o_malloc(sizeof(struct sockaddr));
+    con_info->request->http_protocol = ulfius_arena_strdup(con_info->arena, version);
+    con_info->request->http_verb = ulfius_arena_strdup(con_info->arena, method);
+    con_info->request->client_address = ulfius_arena_alloc(con_info->arena, sizeof(struct sockaddr));
     if (con_info->request->client_address == NULL || con_info->request->http_verb == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating client_address or http_verb");
       return MHD_NO;
@@ -542,22 +838,36 @@ static int ulfius_webservice_dispatcher (void * cls,
       MHD_get_connection_values (connection, MHD_GET_ARGUMENT_KIND, ulfius_fill_map, &con_info->map_url_initial);
       MHD_get_connection_values (connection, MHD_COOKIE_KIND, ulfius_fill_map, con_info->request->map_cookie);
     }
-    content_type = (char*)u_map_get_case(con_info->request->map_header, ULFIUS_HTTP_HEADER_CONTENT);
+    content_type = (char*)u_map_get_known(con_info->request->map_header, U_HDR_CONTENT_TYPE);
+
+    // The body of an endpoint with a body_callback is streamed, so it's neither stored nor parsed
+    if (ulfius_find_body_callback(con_info, method) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_find_body_callback");
+      return MHD_NO;
+    }
 
     // Set POST Processor if content-type is properly set
-    if (content_type != NULL &&
+    if (con_info->body_callback == NULL && con_info->u_instance->post_body_storage&U_POST_BODY_PARSED && content_type != NULL &&
        ((con_info->u_instance->allowed_post_processor&U_POST_PROCESS_URL_ENCODED && 0 == o_strncmp(MHD_HTTP_POST_ENCODING_FORM_URLENCODED, content_type, o_strlen(MHD_HTTP_POST_ENCODING_FORM_URLENCODED))) ||
         (con_info->u_instance->allowed_post_processor&U_POST_PROCESS_MULTIPART_FORMDATA && 0 == o_strncmp(MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA, content_type, o_strlen(MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA))))) {
       con_info->has_post_processor = 1;
-      con_info->post_processor = MHD_create_post_processor (connection, ULFIUS_POSTBUFFERSIZE, mhd_iterate_post_data, (void *) con_info);
+      con_info->post_processor = MHD_create_post_processor (connection, con_info->u_instance->post_processor_buffer_size, mhd_iterate_post_data, (void *) con_info);
       if (NULL == con_info->post_processor) {
-        ulfius_clean_request_full(con_info->request);
-        con_info->request = NULL;
+        con_info->has_post_processor = 0;
         y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating post_processor");
         return MHD_NO;
       }
     }
     return MHD_YES;
+  } else if (*upload_data_size != 0 && con_info->body_callback != NULL) {
+    ulfius_stream_request_body(con_info, upload_data, *upload_data_size);
+    *upload_data_size = 0;
+    return MHD_YES;
+  } else if (*upload_data_size != 0 && con_info->has_post_processor && !(con_info->u_instance->post_body_storage&U_POST_BODY_RAW)) {
+    // The form body is only parsed in request->map_post_body, it's not stored in request->binary_body
+    MHD_post_process (con_info->post_processor, upload_data, *upload_data_size);
+    *upload_data_size = 0;
+    return MHD_YES;
   } else if (*upload_data_size != 0) {
     body_len = con_info->request->binary_body_length + *upload_data_size;
     upload_data_size_current = *upload_data_size;
@@ -567,82 +877,137 @@ static int ulfius_webservice_dispatcher (void * cls,
       upload_data_size_current = ((struct _u_instance *)cls)->max_post_body_size - con_info->request->binary_body_length;
     }
 
-    if (body_len >= con_info->request->binary_body_length) {
-      con_info->request->binary_body = o_realloc(con_info->request->binary_body, body_len);
-      if (con_info->request->binary_body == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->request->binary_body");
-        return MHD_NO;
-      } else {
-        memcpy((char*)con_info->request->binary_body + con_info->request->binary_body_length, upload_data, upload_data_size_current);
-        con_info->request->binary_body_length += upload_data_size_current;
-        // Handles request binary_body
-        content_type = (char*)u_map_get_case(con_info->request->map_header, ULFIUS_HTTP_HEADER_CONTENT);
-        if (0 == o_strncmp(MHD_HTTP_POST_ENCODING_FORM_URLENCODED, content_type, o_strlen(MHD_HTTP_POST_ENCODING_FORM_URLENCODED)) ||
-            0 == o_strncmp(MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA, content_type, o_strlen(MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA))) {
-          MHD_post_process (con_info->post_processor, upload_data, *upload_data_size);
-        }
-        *upload_data_size = 0;
-        return MHD_YES;
-      }
+    if (ulfius_reserve_request_body(con_info, body_len) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for con_info->request->binary_body");
+      return MHD_NO;
     } else {
+      memcpy((char*)con_info->request->binary_body + con_info->request->binary_body_length, upload_data, upload_data_size_current);
+      con_info->request->binary_body_length += upload_data_size_current;
+      if (con_info->u_instance->pool != NULL) {
+        U_ATOMIC_ADD(&((struct _u_pool *)con_info->u_instance->pool)->body_bytes_copied, upload_data_size_current);
+      }
+      // The form body is parsed too if the post processor is set
+      if (con_info->has_post_processor) {
+        MHD_post_process (con_info->post_processor, upload_data, *upload_data_size);
+      }
+      *upload_data_size = 0;
       return MHD_YES;
     }
   } else {
-    // Check if the endpoint has one or more matches
-    current_endpoint_list = ulfius_endpoint_match(method, con_info->request->url_path, endpoint_list);
-
-    // Set to default_endpoint if no match
-    if ((current_endpoint_list == NULL || current_endpoint_list[0] == NULL) && ((struct _u_instance *)cls)->default_endpoint != NULL && ((struct _u_instance *)cls)->default_endpoint->callback_function != NULL) {
-      current_endpoint_list = o_realloc(current_endpoint_list, 2*sizeof(struct _u_endpoint *));
-      if (current_endpoint_list != NULL) {
-        if ((current_endpoint_list[0] = o_malloc(sizeof(struct _u_endpoint))) != NULL) {
-          if (ulfius_copy_endpoint(current_endpoint_list[0], ((struct _u_instance *)cls)->default_endpoint) != U_OK) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_copy_endpoint for current_endpoint_list[0]");
-          }
-        } else {
-          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for current_endpoint_list[0] of default endpoint");
+    // The last file written in the upload directory is complete with the body
+    if (con_info->upload_file != NULL && (con_info->upload_file_status = ulfius_upload_file_complete(con_info)) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_upload_file_complete");
+    }
+    if (con_info->suspend_state != NULL) {
+      // The request was suspended by a callback, then resumed by ulfius_resume_response,
+      // the callback list goes on from the suspended callback
+      router = con_info->suspend_state->router;
+      current_endpoint_list = con_info->suspend_state->endpoint_list;
+      nb_endpoint_matches = con_info->suspend_state->nb_endpoints;
+      first_index = con_info->suspend_state->index;
+      memcpy(&captures, &con_info->suspend_state->captures, sizeof(struct _u_route_captures));
+      previous_params = ulfius_router_get_params(router, current_endpoint_list[first_index]);
+      resumed = 1;
+    } else {
+      // Check if the endpoint has one or more matches
+      // The endpoints matched belong to the routing table, which remains valid until it's released
+      router = ulfius_router_acquire((struct _u_router_handler *)((struct _u_instance *)cls)->router, &reader_slot);
+      nb_endpoint_matches = ulfius_router_lookup((struct _u_router_handler *)((struct _u_instance *)cls)->router, router, method, con_info->request->url_path, endpoint_matches, U_ROUTER_MATCH_STACK_SIZE, &captures);
+      if (nb_endpoint_matches > U_ROUTER_MATCH_STACK_SIZE) {
+        if ((current_endpoint_list = ulfius_arena_alloc(con_info->arena, nb_endpoint_matches*sizeof(struct _u_endpoint *))) == NULL) {
+          y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for current_endpoint_list");
+          ulfius_router_release((struct _u_router_handler *)((struct _u_instance *)cls)->router, reader_slot);
+          return MHD_NO;
         }
-        current_endpoint_list[1] = NULL;
-      } else {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for current_endpoint_list of default endpoint");
-        return MHD_NO;
+        ulfius_router_match(router, method, con_info->request->url_path, current_endpoint_list, nb_endpoint_matches, &captures);
+      }
+
+      // Set to default_endpoint if no match
+      if (!nb_endpoint_matches && ((struct _u_instance *)cls)->default_endpoint != NULL && ((struct _u_instance *)cls)->default_endpoint->callback_function != NULL) {
+        current_endpoint_list[0] = ((struct _u_instance *)cls)->default_endpoint;
+        nb_endpoint_matches = 1;
       }
     }
 
 #if MHD_VERSION >= 0x00096100
-    mhd_response_flag = ((struct _u_instance *)cls)->mhd_response_copy_data?MHD_RESPMEM_MUST_COPY:MHD_RESPMEM_MUST_FREE;
-#else
+    // The response buffers are free'd by MHD with o_free
     mhd_response_flag = MHD_RESPMEM_MUST_FREE;
+#else
+    mhd_response_flag = ((struct _u_instance *)cls)->mhd_response_copy_data?MHD_RESPMEM_MUST_COPY:MHD_RESPMEM_MUST_FREE;
 #endif
-    if (current_endpoint_list[0] != NULL) {
-      response = o_malloc(sizeof(struct _u_response));
-      if (response == NULL) {
-        y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating response");
-        mhd_ret = MHD_NO;
-      } else if (ulfius_init_response(response) != U_OK) {
-        o_free(response);
+    if (nb_endpoint_matches) {
+      // A request context from the pool has its response initialized already
+      if (con_info->response == NULL && ulfius_init_response(&((struct _u_request_context *)con_info)->response) != U_OK) {
+        ulfius_clean_response(&((struct _u_request_context *)con_info)->response);
         y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_init_response");
         mhd_ret = MHD_NO;
       } else {
-        // Add default headers (if any) to the response header maps
-        if (((struct _u_instance *)cls)->default_headers != NULL && u_map_count(((struct _u_instance *)cls)->default_headers) > 0) {
-          u_map_clean_full(response->map_header);
-          response->map_header = u_map_copy(((struct _u_instance *)cls)->default_headers);
-        }
+        response = con_info->response = &((struct _u_request_context *)con_info)->response;
+        if (!resumed) {
+          // Add default headers (if any) to the response header maps
+          // The frozen default headers are the base of the response header map, they're not copied
+          // unless a callback function modifies one of them
+          if (((struct _u_instance *)cls)->default_headers != NULL && u_map_count(((struct _u_instance *)cls)->default_headers) > 0 &&
+              u_map_set_base(response->map_header, ((struct _u_instance *)cls)->default_headers) != U_OK) {
+            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error adding default headers to the response");
+          }
+          response->suspend_handle = con_info->u_instance->allow_suspend?con_info:NULL;
 
-        // Initialize auth variables
-        con_info->request->auth_basic_user = MHD_basic_auth_get_username_password(connection, &con_info->request->auth_basic_password);
+          // Initialize auth variables
+          con_info->request->auth_basic_user = MHD_basic_auth_get_username_password(connection, &con_info->request->auth_basic_password);
+        }
 
-        for (i=0; current_endpoint_list[i] != NULL && !close_loop; i++) {
+        for (i=first_index; i<nb_endpoint_matches && !close_loop; i++) {
           current_endpoint = current_endpoint_list[i];
-          u_map_empty(con_info->request->map_url);
-          u_map_copy_into(con_info->request->map_url, &con_info->map_url_initial);
-          if (ulfius_parse_url(con_info->request->url_path, current_endpoint, con_info->request->map_url, con_info->u_instance->check_utf8) != U_OK) {
-            y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error parsing url: ", con_info->request->url_path);
-            mhd_ret = MHD_NO;
+          if (resumed) {
+            // The suspended callback result is the one given to ulfius_resume_response
+            callback_ret = ulfius_get_resume_callback_ret(con_info);
+            resumed = 0;
+          } else {
+            current_params = ulfius_router_get_params(router, current_endpoint);
+            // Chained callbacks sharing the same url parameters set reuse the map_url of the previous callback
+            if (current_params == NULL || current_params != previous_params) {
+              u_map_empty(con_info->request->map_url);
+              if (u_map_merge(con_info->request->map_url, &con_info->map_url_initial, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW) != U_OK) {
+                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error u_map_merge map_url");
+                parse_ret = U_ERROR_MEMORY;
+              } else if (current_params != NULL) {
+                parse_ret = ulfius_router_parse_url(current_params, con_info->request->url_path, &captures, con_info->request->map_url, con_info->u_instance->check_utf8);
+              } else {
+                parse_ret = ulfius_parse_url(con_info->request->url_path, current_endpoint, con_info->request->map_url, con_info->u_instance->check_utf8);
+              }
+              if (parse_ret != U_OK) {
+                y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error parsing url: ", con_info->request->url_path);
+                mhd_ret = MHD_NO;
+              }
+              previous_params = current_params;
+            }
+            if (con_info->body_callback_ret != U_CALLBACK_CONTINUE || con_info->upload_file_status != U_OK) {
+              // The body_callback failed or a file couldn't be written in the upload directory,
+              // the callback functions aren't run and the response is an error 500
+              callback_ret = U_CALLBACK_ERROR;
+            } else {
+              // Run callback function with the input parameters filled for the current callback
+              callback_ret = current_endpoint->callback_function(con_info->request, response, current_endpoint->user_data);
+            }
+            if (callback_ret == U_CALLBACK_SUSPEND && !con_info->u_instance->allow_suspend) {
+              y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error U_CALLBACK_SUSPEND is available in U_DAEMON_MODE_THREAD_POOL only");
+              callback_ret = U_CALLBACK_ERROR;
+            } else if (callback_ret == U_CALLBACK_SUSPEND) {
+              // The callback will complete the response later, the connection is suspended until then
+              suspend_ret = ulfius_suspend_request(con_info, router, reader_slot, current_endpoint_list, current_endpoint_list != endpoint_matches, nb_endpoint_matches, i, &captures);
+              if (suspend_ret == U_OK) {
+                return MHD_YES;
+              } else if (suspend_ret == U_ERROR) {
+                callback_ret = ulfius_get_resume_callback_ret(con_info);
+              } else {
+                callback_ret = U_CALLBACK_ERROR;
+              }
+              if (con_info->suspend_state != NULL) {
+                current_endpoint_list = con_info->suspend_state->endpoint_list;
+              }
+            }
           }
-          // Run callback function with the input parameters filled for the current callback
-          callback_ret = current_endpoint->callback_function(con_info->request, response, current_endpoint->user_data);
           if (callback_ret != U_CALLBACK_IGNORE) {
             con_info->request->callback_position++;
           }
@@ -659,6 +1024,8 @@ static int ulfius_webservice_dispatcher (void * cls,
             } else if (ulfius_set_response_header(mhd_response, response->map_header) == -1 || ulfius_set_response_cookie(mhd_response, response) == -1) {
               y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting headers or cookies");
               mhd_ret = MHD_NO;
+            } else {
+              con_info->upload_file_keep = 1;
             }
             close_loop = 1;
 #ifndef U_DISABLE_WEBSOCKET
@@ -670,20 +1037,20 @@ static int ulfius_webservice_dispatcher (void * cls,
               // if the session is a valid websocket request,
               // Initiate an UPGRADE session,
               // then run the websocket callback functions with initialized data
-              if (NULL != o_strcasestr(u_map_get_case(con_info->request->map_header, "upgrade"), U_WEBSOCKET_UPGRADE_VALUE) &&
-                  1 == u_map_count_keys_case(con_info->request->map_header, "upgrade") &&
-                  NULL != u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Key") &&
-                  1 == u_map_count_keys_case(con_info->request->map_header, "Sec-WebSocket-Key") &&
-                  NULL != o_strcasestr(u_map_get_case(con_info->request->map_header, "Connection"), "Upgrade") &&
-                  1 == u_map_count_keys_case(con_info->request->map_header, "Connection") &&
+              if (NULL != o_strcasestr(u_map_get_known(con_info->request->map_header, U_HDR_UPGRADE), U_WEBSOCKET_UPGRADE_VALUE) &&
+                  1 == u_map_count_known(con_info->request->map_header, U_HDR_UPGRADE) &&
+                  NULL != u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_KEY) &&
+                  1 == u_map_count_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_KEY) &&
+                  NULL != o_strcasestr(u_map_get_known(con_info->request->map_header, U_HDR_CONNECTION), "Upgrade") &&
+                  1 == u_map_count_known(con_info->request->map_header, U_HDR_CONNECTION) &&
                   0 == o_strcmp(con_info->request->http_protocol, "HTTP/1.1") &&
-                  0 == o_strcmp(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Version"), "13") &&
-                  1 == u_map_count_keys_case(con_info->request->map_header, "Sec-WebSocket-Version") &&
+                  0 == o_strcmp(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_VERSION), "13") &&
+                  1 == u_map_count_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_VERSION) &&
                   0 == o_strcmp(con_info->request->http_verb, "GET")) {
                 int ret_protocol = U_ERROR, ret_extensions = U_OK;
                 // Check websocket_protocol and websocket_extensions to match ours
                 if (u_map_has_key(con_info->request->map_header, "Sec-WebSocket-Extensions") && (extension_len = pointer_list_size(((struct _websocket_handle *)response->websocket_handle)->websocket_extension_list))) {
-                  if (split_string(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Extensions"), ",", &extension_list)) {
+                  if (split_string(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_EXTENSIONS), ",", &extension_list)) {
                     for (x=0; extension_list[x]!=NULL; x++) {
                       for (y=0; y<extension_len; y++) {
                         struct _websocket_extension * ws_ext = (struct _websocket_extension *)pointer_list_get_at(((struct _websocket_handle *)response->websocket_handle)->websocket_extension_list, y);
@@ -724,12 +1091,12 @@ static int ulfius_webservice_dispatcher (void * cls,
                   }
                   free_string_array(extension_list);
                 } else {
-                  ret_extensions = ulfius_check_list_match(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Extensions"), ((struct _websocket_handle *)response->websocket_handle)->websocket_extensions, ",", &extension);
+                  ret_extensions = ulfius_check_list_match(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_EXTENSIONS), ((struct _websocket_handle *)response->websocket_handle)->websocket_extensions, ",", &extension);
                 }
                 if (ret_extensions == U_OK &&
-                    (ret_protocol = ulfius_check_first_match(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Protocol"), ((struct _websocket_handle *)response->websocket_handle)->websocket_protocol, ",", &protocol)) == U_OK) {
+                    (ret_protocol = ulfius_check_first_match(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_PROTOCOL), ((struct _websocket_handle *)response->websocket_handle)->websocket_protocol, ",", &protocol)) == U_OK) {
                   char websocket_accept[32] = {0};
-                  if (ulfius_generate_handshake_answer(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Key"), websocket_accept)) {
+                  if (ulfius_generate_handshake_answer(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_KEY), websocket_accept)) {
                     websocket->request = ulfius_duplicate_request(con_info->request);
                     if (websocket->request != NULL) {
                       websocket->instance = (struct _u_instance *)cls;
@@ -768,6 +1135,7 @@ static int ulfius_webservice_dispatcher (void * cls,
                         } else {
                           ulfius_instance_add_websocket_active((struct _u_instance *)cls, websocket);
                           upgrade_protocol = 1;
+                          con_info->upload_file_keep = 1;
                         }
                       }
                     } else {
@@ -807,11 +1175,11 @@ static int ulfius_webservice_dispatcher (void * cls,
                 o_free(extension);
               } else {
                 response_buffer = msprintf("%s%s%s%s%s%s",
-                                           o_strcasestr(u_map_get_case(con_info->request->map_header, "upgrade"), U_WEBSOCKET_UPGRADE_VALUE)==NULL?"No Upgrade websocket header\n":"",
-                                           o_strcasestr(u_map_get_case(con_info->request->map_header, "Connection"), "Upgrade")==NULL?"No Connection Upgrade header\n":"",
-                                           u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Key")==NULL?"No Sec-WebSocket-Key header\n":"",
+                                           o_strcasestr(u_map_get_known(con_info->request->map_header, U_HDR_UPGRADE), U_WEBSOCKET_UPGRADE_VALUE)==NULL?"No Upgrade websocket header\n":"",
+                                           o_strcasestr(u_map_get_known(con_info->request->map_header, U_HDR_CONNECTION), "Upgrade")==NULL?"No Connection Upgrade header\n":"",
+                                           u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_KEY)==NULL?"No Sec-WebSocket-Key header\n":"",
                                            o_strcmp(con_info->request->http_protocol, "HTTP/1.1")!=0?"Wrong HTTP Protocol\n":"",
-                                           o_strcmp(u_map_get_case(con_info->request->map_header, "Sec-WebSocket-Version"), "13")!=0?"Wrong websocket version\n":"",
+                                           o_strcmp(u_map_get_known(con_info->request->map_header, U_HDR_SEC_WEBSOCKET_VERSION), "13")!=0?"Wrong websocket version\n":"",
                                            o_strcmp(con_info->request->http_verb, "GET")!=0?"Method is not GET\n":"");
                 response->status = MHD_HTTP_BAD_REQUEST;
                 y_log_message(Y_LOG_LEVEL_DEBUG, "Ulfius - Error websocket connection: %s", response_buffer);
@@ -840,8 +1208,10 @@ static int ulfius_webservice_dispatcher (void * cls,
             }
 #endif
           } else {
-            if ((callback_ret == U_CALLBACK_CONTINUE || callback_ret == U_CALLBACK_IGNORE) && current_endpoint_list[i+1] == NULL) {
+            if ((callback_ret == U_CALLBACK_CONTINUE || callback_ret == U_CALLBACK_IGNORE) && i+1 == nb_endpoint_matches &&
+                (con_info->request->callback_position || ((struct _u_instance *)cls)->default_endpoint == NULL || ((struct _u_instance *)cls)->default_endpoint->callback_function == NULL)) {
               // If callback_ret is U_CALLBACK_CONTINUE or U_CALLBACK_IGNORE but callback function is the last one on the list
+              // If every callback function was ignored, the response is built after the default callback function instead
               callback_ret = U_CALLBACK_COMPLETE;
             }
             // Test callback_ret to know what to do
@@ -856,10 +1226,15 @@ static int ulfius_webservice_dispatcher (void * cls,
                   mhd_response = MHD_CREATE_RESPONSE_FROM_BUFFER_PIMPED (response_buffer_len, response_buffer, mhd_response_flag );
                   if (mhd_response == NULL) {
                     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error MHD_create_response_from_buffer");
+                    o_free(response_buffer);
+                    response_buffer = NULL;
                     mhd_ret = MHD_NO;
                   } else if (ulfius_set_response_header(mhd_response, response->map_header) == -1 || ulfius_set_response_cookie(mhd_response, response) == -1) {
                     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting headers or cookies");
                     mhd_ret = MHD_NO;
+                  } else {
+                    // The files uploaded belong to the application when the callback list is successful
+                    con_info->upload_file_keep = 1;
                   }
                 } else {
                   // Error building response, sending error 500
@@ -934,6 +1309,7 @@ static int ulfius_webservice_dispatcher (void * cls,
             MHD_destroy_response(mhd_response);
             mhd_response = NULL;
           }
+          con_info->upload_file_keep = 0;
           callback_ret = ((struct _u_instance *)cls)->default_endpoint->callback_function(con_info->request, response, ((struct _u_instance *)cls)->default_endpoint->user_data);
           // Test callback_ret to know what to do
           switch (callback_ret) {
@@ -975,6 +1351,8 @@ static int ulfius_webservice_dispatcher (void * cls,
               }
               break;
             case U_CALLBACK_ERROR:
+            case U_CALLBACK_SUSPEND:
+              // The default endpoint can't be suspended after the callback list
               close_loop = 1;
               response->status = MHD_HTTP_INTERNAL_SERVER_ERROR;
               response_buffer = o_strdup(ULFIUS_HTTP_ERROR_BODY);
@@ -994,10 +1372,14 @@ static int ulfius_webservice_dispatcher (void * cls,
                 mhd_response = MHD_CREATE_RESPONSE_FROM_BUFFER_PIMPED (response_buffer_len, response_buffer, mhd_response_flag );
                 if (mhd_response == NULL) {
                   y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error MHD_create_response_from_buffer");
+                  o_free(response_buffer);
+                  response_buffer = NULL;
                   mhd_ret = MHD_NO;
                 } else if (ulfius_set_response_header(mhd_response, response->map_header) == -1 || ulfius_set_response_cookie(mhd_response, response) == -1) {
                   y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error setting headers or cookies");
                   mhd_ret = MHD_NO;
+                } else {
+                  con_info->upload_file_keep = 1;
                 }
               } else {
                 // Error building response, sending error 500
@@ -1031,13 +1413,15 @@ static int ulfius_webservice_dispatcher (void * cls,
           } else {
             mhd_ret = MHD_queue_response (connection, (unsigned int)response->status, mhd_response);
           }
+          if (mhd_ret != MHD_YES) {
+            con_info->upload_file_keep = 0;
+          }
           MHD_destroy_response (mhd_response);
-          // Free Response parameters
+          // Free Response parameters, the response is cleaned when the request is complete
           if (response->free_shared_data != NULL && response->shared_data != NULL) {
             response->free_shared_data(response->shared_data);
           }
-          ulfius_clean_response_full(response);
-          response = NULL;
+          response->shared_data = NULL;
         }
       }
     } else {
@@ -1059,15 +1443,36 @@ static int ulfius_webservice_dispatcher (void * cls,
 #else
     (void)mhd_response_flag;
 #endif
-    for (i=0; current_endpoint_list[i] != NULL; i++) {
-      ulfius_clean_endpoint(current_endpoint_list[i]);
-      o_free(current_endpoint_list[i]);
+    if (con_info->suspend_state != NULL) {
+      ulfius_clean_suspend_state(con_info);
+    } else {
+      ulfius_router_release((struct _u_router_handler *)((struct _u_instance *)cls)->router, reader_slot);
     }
-    o_free(current_endpoint_list);
     return mhd_ret;
   }
 }
 
+/**
+ * ulfius_get_thread_pool_size
+ * return the number of worker threads to use in U_DAEMON_MODE_THREAD_POOL mode
+ * if u_instance->thread_pool_size is 0, the number of processors online is used if available
+ */
+static unsigned int ulfius_get_thread_pool_size(const struct _u_instance * u_instance) {
+#ifdef _SC_NPROCESSORS_ONLN
+  long nb_processors;
+#endif
+
+  if (u_instance->thread_pool_size) {
+    return u_instance->thread_pool_size;
+  }
+#ifdef _SC_NPROCESSORS_ONLN
+  if ((nb_processors = sysconf(_SC_NPROCESSORS_ONLN)) > 0) {
+    return (unsigned int)nb_processors;
+  }
+#endif
+  return 1;
+}
+
 /**
  * ulfius_run_mhd_daemon
  * Starts a mhd daemon for the specified instance
@@ -1075,21 +1480,40 @@ static int ulfius_webservice_dispatcher (void * cls,
  *
  */
 static struct MHD_Daemon * ulfius_run_mhd_daemon(struct _u_instance * u_instance, const char * key_pem, const char * cert_pem, const char * root_ca_perm) {
-  unsigned int mhd_flags = MHD_USE_THREAD_PER_CONNECTION | MHD_USE_ERROR_LOG;
+  unsigned int mhd_flags = MHD_USE_ERROR_LOG;
+  struct MHD_Daemon * mhd_daemon;
   int index;
 
 #ifdef DEBUG
   mhd_flags |= MHD_USE_DEBUG;
 #endif
+  if (u_instance->daemon_mode == U_DAEMON_MODE_THREAD_POOL) {
+    // A pool of worker threads polls the connections, using epoll when available
+    // The connections can be suspended by U_CALLBACK_SUSPEND in this mode only
 #if MHD_VERSION >= 0x00095300
-  mhd_flags |= MHD_USE_INTERNAL_POLLING_THREAD;
+    mhd_flags |= MHD_USE_AUTO | MHD_USE_INTERNAL_POLLING_THREAD;
+#else
+    mhd_flags |= MHD_USE_SELECT_INTERNALLY;
 #endif
+    mhd_flags |= U_MHD_SUSPEND_RESUME;
+  } else {
+    mhd_flags |= MHD_USE_THREAD_PER_CONNECTION;
+#if MHD_VERSION >= 0x00095300
+    mhd_flags |= MHD_USE_INTERNAL_POLLING_THREAD;
+#endif
+  }
 #ifndef U_DISABLE_WEBSOCKET
   mhd_flags |= MHD_ALLOW_UPGRADE;
 #endif
 
   if (u_instance->mhd_daemon == NULL) {
-    struct MHD_OptionItem mhd_ops[9];
+    struct MHD_OptionItem mhd_ops[10];
+
+    // Compile the routing table, in case endpoint_list was filled manually
+    if (ulfius_refresh_router(u_instance) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error ulfius_refresh_router");
+      return NULL;
+    }
 
     // Default options
     mhd_ops[0].option = MHD_OPTION_EXTERNAL_LOGGER;
@@ -1128,7 +1552,7 @@ static struct MHD_Daemon * ulfius_run_mhd_daemon(struct _u_instance * u_instance
 
     mhd_ops[3].option = MHD_OPTION_URI_LOG_CALLBACK;
     mhd_ops[3].value = (intptr_t)ulfius_uri_logger;
-    mhd_ops[3].ptr_value = NULL;
+    mhd_ops[3].ptr_value = (void *)u_instance;
 
     index = 4;
 
@@ -1161,15 +1585,29 @@ static struct MHD_Daemon * ulfius_run_mhd_daemon(struct _u_instance * u_instance
       index++;
     }
 
+    if (u_instance->daemon_mode == U_DAEMON_MODE_THREAD_POOL) {
+      mhd_ops[index].option = MHD_OPTION_THREAD_POOL_SIZE;
+      mhd_ops[index].value = (intptr_t)ulfius_get_thread_pool_size(u_instance);
+      mhd_ops[index].ptr_value = NULL;
+
+      index++;
+    }
+
     mhd_ops[index].option = MHD_OPTION_END;
     mhd_ops[index].value = 0;
     mhd_ops[index].ptr_value = NULL;
 
-    return MHD_start_daemon (
+    // The default headers are shared by the responses while the framework is running
+    u_map_freeze(u_instance->default_headers);
+    u_instance->allow_suspend = (mhd_flags & U_MHD_SUSPEND_RESUME) == U_MHD_SUSPEND_RESUME;
+    if ((mhd_daemon = MHD_start_daemon (
       mhd_flags, (uint16_t)u_instance->port, NULL, NULL, &ulfius_webservice_dispatcher, (void *)u_instance,
       MHD_OPTION_ARRAY, mhd_ops,
       MHD_OPTION_END
-    );
+    )) == NULL) {
+      u_map_unfreeze(u_instance->default_headers);
+    }
+    return mhd_daemon;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error, instance already started");
     return NULL;
@@ -1299,13 +1737,19 @@ int ulfius_start_framework_with_mhd_options(struct _u_instance * u_instance, uns
   } else if (mhd_ops == NULL) {
     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_start_framework_with_mhd_options - Error, mhd_ops is NULL");
     return U_ERROR_PARAMS;
+  } else if (ulfius_refresh_router(u_instance) != U_OK) {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_start_framework_with_mhd_options - Error ulfius_refresh_router");
+    return U_ERROR_MEMORY;
   } else {
+    u_map_freeze(u_instance->default_headers);
+    u_instance->allow_suspend = (mhd_flags & U_MHD_SUSPEND_RESUME) == U_MHD_SUSPEND_RESUME;
     u_instance->mhd_daemon = MHD_start_daemon (mhd_flags, (uint16_t)u_instance->port, NULL, NULL, &ulfius_webservice_dispatcher, (void *)u_instance, MHD_OPTION_ARRAY, mhd_ops, MHD_OPTION_END);
     if (u_instance->mhd_daemon != NULL) {
       u_instance->status = U_STATUS_RUNNING;
       return U_OK;
     } else {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_start_framework_with_mhd_options - Error MHD_start_daemon, aborting");
+      u_map_unfreeze(u_instance->default_headers);
       u_instance->status = U_STATUS_ERROR;
       return U_ERROR_LIBMHD;
     }
@@ -1340,6 +1784,8 @@ int ulfius_stop_framework(struct _u_instance * u_instance) {
 #endif
     MHD_stop_daemon (u_instance->mhd_daemon);
     u_instance->mhd_daemon = NULL;
+    // No response uses the default headers anymore, they can be modified again
+    u_map_unfreeze(u_instance->default_headers);
     u_instance->status = U_STATUS_STOP;
     return U_OK;
   } else if (u_instance != NULL) {
@@ -1361,6 +1807,7 @@ int ulfius_copy_endpoint(struct _u_endpoint * dest, const struct _u_endpoint * s
     dest->url_format = o_strdup(source->url_format);
     dest->callback_function = source->callback_function;
     dest->user_data = source->user_data;
+    dest->body_callback = source->body_callback;
     dest->priority = source->priority;
     if (ulfius_is_valid_endpoint(dest, 0)) {
       return U_OK;
@@ -1423,7 +1870,13 @@ void ulfius_clean_endpoint_list(struct _u_endpoint * endpoint_list) {
   }
 }
 
-int ulfius_add_endpoint(struct _u_instance * u_instance, const struct _u_endpoint * u_endpoint) {
+/**
+ * ulfius_append_endpoint
+ * add a copy of u_endpoint at the end of the endpoint list of the instance
+ * the routing table isn't updated
+ * return U_OK on success
+ */
+static int ulfius_append_endpoint(struct _u_instance * u_instance, const struct _u_endpoint * u_endpoint) {
   int res;
 
   if (u_instance != NULL && u_endpoint != NULL) {
@@ -1463,16 +1916,37 @@ int ulfius_add_endpoint(struct _u_instance * u_instance, const struct _u_endpoin
   return U_ERROR;
 }
 
+int ulfius_add_endpoint(struct _u_instance * u_instance, const struct _u_endpoint * u_endpoint) {
+  int res;
+
+  if (u_instance != NULL && u_instance->router != NULL) {
+    ulfius_router_lock((struct _u_router_handler *)u_instance->router);
+    res = ulfius_append_endpoint(u_instance, u_endpoint);
+    if (res == U_OK) {
+      res = ulfius_update_router(u_instance);
+    }
+    ulfius_router_unlock((struct _u_router_handler *)u_instance->router);
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_add_endpoint, invalid parameters");
+    res = U_ERROR_PARAMS;
+  }
+  return res;
+}
+
 int ulfius_add_endpoint_list(struct _u_instance * u_instance, const struct _u_endpoint ** u_endpoint_list) {
-  int i, res;
-  if (u_instance != NULL && u_endpoint_list != NULL) {
-    for (i=0; !ulfius_equals_endpoints(u_endpoint_list[i], ulfius_empty_endpoint()); i++) {
-      res = ulfius_add_endpoint(u_instance, u_endpoint_list[i]);
-      if (res != U_OK) {
-        return res;
-      }
+  int i, res = U_OK;
+  if (u_instance != NULL && u_instance->router != NULL && u_endpoint_list != NULL) {
+    ulfius_router_lock((struct _u_router_handler *)u_instance->router);
+    for (i=0; res == U_OK && !ulfius_equals_endpoints(u_endpoint_list[i], ulfius_empty_endpoint()); i++) {
+      res = ulfius_append_endpoint(u_instance, u_endpoint_list[i]);
     }
-    return U_OK;
+    if (res == U_OK) {
+      res = ulfius_update_router(u_instance);
+    } else {
+      ulfius_update_router(u_instance);
+    }
+    ulfius_router_unlock((struct _u_router_handler *)u_instance->router);
+    return res;
   } else {
     y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_add_endpoint_list, invalid parameters");
     return U_ERROR_PARAMS;
@@ -1484,7 +1958,8 @@ int ulfius_remove_endpoint(struct _u_instance * u_instance, const struct _u_endp
   int i, j, found = 0, ret = U_OK;
   char * trim_prefix = NULL, * trim_prefix_save = NULL, * trim_format = NULL, * trim_format_save = NULL,
        * trim_cur_prefix = NULL, * trim_cur_prefix_save = NULL, * trim_cur_format = NULL, * trim_cur_format_save = NULL;
-  if (u_instance != NULL && u_endpoint != NULL && !ulfius_equals_endpoints(u_endpoint, ulfius_empty_endpoint()) && ulfius_is_valid_endpoint(u_endpoint, 1)) {
+  if (u_instance != NULL && u_instance->router != NULL && u_endpoint != NULL && !ulfius_equals_endpoints(u_endpoint, ulfius_empty_endpoint()) && ulfius_is_valid_endpoint(u_endpoint, 1)) {
+    ulfius_router_lock((struct _u_router_handler *)u_instance->router);
     trim_prefix_save = o_strdup(u_endpoint->url_prefix);
     trim_prefix = trimcharacter(trim_prefix_save, '/');
     trim_format_save = o_strdup(u_endpoint->url_format);
@@ -1522,7 +1997,10 @@ int ulfius_remove_endpoint(struct _u_instance * u_instance, const struct _u_endp
     }
     if (!found) {
       ret = U_ERROR_NOT_FOUND;
+    } else if (ret == U_OK) {
+      ret = ulfius_update_router(u_instance);
     }
+    ulfius_router_unlock((struct _u_router_handler *)u_instance->router);
     o_free(trim_prefix_save);
     o_free(trim_format_save);
     trim_prefix_save = NULL;
@@ -1542,6 +2020,7 @@ const struct _u_endpoint * ulfius_empty_endpoint(void) {
   empty_endpoint.url_format = NULL;
   empty_endpoint.callback_function = NULL;
   empty_endpoint.user_data = NULL;
+  empty_endpoint.body_callback = NULL;
   return &empty_endpoint;
 }
 
@@ -1580,6 +2059,7 @@ int ulfius_add_endpoint_by_val(struct _u_instance * u_instance,
     endpoint.priority = priority;
     endpoint.callback_function = callback_function;
     endpoint.user_data = user_data;
+    endpoint.body_callback = NULL;
     return ulfius_add_endpoint(u_instance, &endpoint);
   } else {
     return U_ERROR_PARAMS;
@@ -1615,6 +2095,7 @@ int ulfius_set_default_endpoint(struct _u_instance * u_instance,
     u_instance->default_endpoint->url_format = NULL;
     u_instance->default_endpoint->callback_function = callback_function;
     u_instance->default_endpoint->user_data = user_data;
+    u_instance->default_endpoint->body_callback = NULL;
     u_instance->default_endpoint->priority = 0;
     return U_OK;
   } else {
@@ -1622,6 +2103,118 @@ int ulfius_set_default_endpoint(struct _u_instance * u_instance,
   }
 }
 
+int ulfius_get_route_cache_stats(const struct _u_instance * u_instance, size_t * hits, size_t * misses) {
+  if (u_instance != NULL && u_instance->router != NULL) {
+    if (hits != NULL) {
+      *hits = U_ATOMIC_LOAD(&((struct _u_router_handler *)u_instance->router)->cache_hits);
+    }
+    if (misses != NULL) {
+      *misses = U_ATOMIC_LOAD(&((struct _u_router_handler *)u_instance->router)->cache_misses);
+    }
+    return U_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_get_route_cache_stats, invalid parameters");
+    return U_ERROR_PARAMS;
+  }
+}
+
+int ulfius_get_pool_stats(const struct _u_instance * u_instance, size_t * hits, size_t * misses, size_t * retained) {
+  if (u_instance != NULL && u_instance->pool != NULL) {
+    if (hits != NULL) {
+      *hits = U_ATOMIC_LOAD(&((struct _u_pool *)u_instance->pool)->hits);
+    }
+    if (misses != NULL) {
+      *misses = U_ATOMIC_LOAD(&((struct _u_pool *)u_instance->pool)->misses);
+    }
+    if (retained != NULL) {
+      *retained = U_ATOMIC_LOAD(&((struct _u_pool *)u_instance->pool)->retained);
+    }
+    return U_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_get_pool_stats, invalid parameters");
+    return U_ERROR_PARAMS;
+  }
+}
+
+int ulfius_get_body_stats(const struct _u_instance * u_instance, size_t * reallocs, size_t * bytes_copied) {
+  if (u_instance != NULL && u_instance->pool != NULL) {
+    if (reallocs != NULL) {
+      *reallocs = U_ATOMIC_LOAD(&((struct _u_pool *)u_instance->pool)->body_reallocs);
+    }
+    if (bytes_copied != NULL) {
+      *bytes_copied = U_ATOMIC_LOAD(&((struct _u_pool *)u_instance->pool)->body_bytes_copied);
+    }
+    return U_OK;
+  } else {
+    y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - ulfius_get_body_stats, invalid parameters");
+    return U_ERROR_PARAMS;
+  }
+}
+
+int ulfius_resume_response(struct _u_response * response, int callback_ret) {
+  struct connection_info_struct * con_info;
+  int ret;
+
+  if (response != NULL && response->suspend_handle != NULL && callback_ret != U_CALLBACK_SUSPEND) {
+    con_info = (struct connection_info_struct *)response->suspend_handle;
+    while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+    if (con_info->suspend_status == U_SUSPEND_STATUS_TERMINATED) {
+      // The connection was closed while the response was suspended, nobody else uses the request context now
+      U_ATOMIC_CLEAR(&con_info->suspend_lock);
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error connection closed before the response was resumed");
+      ulfius_free_request_context(con_info);
+      return U_ERROR;
+    } else if (con_info->suspend_status == U_SUSPEND_STATUS_RESUMED) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error response already resumed");
+      ret = U_ERROR_PARAMS;
+    } else {
+      con_info->resume_callback_ret = callback_ret;
+      // If the connection isn't suspended yet, the callback list goes on as soon as the callback returns
+      if (con_info->suspend_status == U_SUSPEND_STATUS_SUSPENDED) {
+        MHD_resume_connection(con_info->connection);
+      }
+      con_info->suspend_status = U_SUSPEND_STATUS_RESUMED;
+      ret = U_OK;
+    }
+    U_ATOMIC_CLEAR(&con_info->suspend_lock);
+  } else {
+    ret = U_ERROR_PARAMS;
+  }
+  return ret;
+}
+
+int ulfius_resume_request_body(const struct _u_request * request) {
+  struct connection_info_struct * con_info;
+  int ret;
+
+  if (request != NULL && request->body_handle != NULL) {
+    con_info = (struct connection_info_struct *)request->body_handle;
+    while (U_ATOMIC_TEST_AND_SET(&con_info->suspend_lock));
+    if (con_info->body_status == U_BODY_STATUS_TERMINATED) {
+      // The connection was closed while the request body was suspended, nobody else uses the request context now
+      U_ATOMIC_CLEAR(&con_info->suspend_lock);
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error connection closed before the request body was resumed");
+      ulfius_free_request_context(con_info);
+      return U_ERROR;
+    } else if (con_info->body_status == U_BODY_STATUS_SUSPENDED) {
+      con_info->body_status = U_BODY_STATUS_NONE;
+      MHD_resume_connection(con_info->connection);
+      ret = U_OK;
+    } else if (con_info->body_status == U_BODY_STATUS_NONE) {
+      // If the connection isn't suspended yet, it won't be when the body_callback returns
+      con_info->body_status = U_BODY_STATUS_RESUMED;
+      ret = U_OK;
+    } else {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error request body already resumed");
+      ret = U_ERROR_PARAMS;
+    }
+    U_ATOMIC_CLEAR(&con_info->suspend_lock);
+  } else {
+    ret = U_ERROR_PARAMS;
+  }
+  return ret;
+}
+
 int ulfius_set_upload_file_callback_function(struct _u_instance * u_instance,
                                              int (* file_upload_callback) (const struct _u_request * request,
                                                                            const char * key,
@@ -1642,17 +2235,47 @@ int ulfius_set_upload_file_callback_function(struct _u_instance * u_instance,
   }
 }
 
+int ulfius_set_upload_file_directory(struct _u_instance * u_instance, const char * directory, size_t buffer_size, int flags) {
+  char * new_directory = NULL;
+
+  if (u_instance != NULL && !(flags & ~U_UPLOAD_FILE_DIRECT)) {
+    if (directory != NULL && (new_directory = o_strdup(directory)) == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for upload_file_directory");
+      return U_ERROR_MEMORY;
+    }
+    o_free(u_instance->upload_file_directory);
+    u_instance->upload_file_directory = new_directory;
+    u_instance->upload_file_buffer_size = buffer_size?buffer_size:U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE;
+    u_instance->upload_file_flags = flags;
+    return U_OK;
+  } else {
+    return U_ERROR_PARAMS;
+  }
+}
+
 void ulfius_clean_instance(struct _u_instance * u_instance) {
   if (u_instance != NULL) {
     ulfius_clean_endpoint_list(u_instance->endpoint_list);
+    if (u_instance->router != NULL) {
+      ulfius_router_clean_handler((struct _u_router_handler *)u_instance->router);
+      o_free(u_instance->router);
+    }
+    if (u_instance->pool != NULL) {
+      ulfius_pool_clean((struct _u_pool *)u_instance->pool);
+      o_free(u_instance->pool);
+    }
     u_map_clean_full(u_instance->default_headers);
     o_free(u_instance->default_auth_realm);
     o_free(u_instance->default_endpoint);
+    o_free(u_instance->upload_file_directory);
     u_instance->endpoint_list = NULL;
+    u_instance->router = NULL;
+    u_instance->pool = NULL;
     u_instance->default_headers = NULL;
     u_instance->default_auth_realm = NULL;
     u_instance->bind_address = NULL;
     u_instance->default_endpoint = NULL;
+    u_instance->upload_file_directory = NULL;
 #ifndef U_DISABLE_WEBSOCKET
     /* ulfius_clean_instance might be called without websocket_handler being initialized */
     if ((struct _websocket_handler *)u_instance->websocket_handler) {
@@ -1699,15 +2322,37 @@ UNUSED(network_type);
     u_instance->endpoint_list = NULL;
     u_instance->websocket_handler = NULL;
     u_instance->default_endpoint = NULL;
-    u_instance->default_headers = o_malloc(sizeof(struct _u_map));
+    u_instance->upload_file_directory = NULL;
     u_instance->mhd_response_copy_data = 0;
     u_instance->check_utf8 = 1;
+    // Each allocation is checked and initialized before the next one, so ulfius_clean_instance can clean them on error
+    u_instance->router = NULL;
+    u_instance->pool = NULL;
+    u_instance->default_headers = o_malloc(sizeof(struct _u_map));
     if (u_instance->default_headers == NULL) {
       y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_instance->default_headers");
       ulfius_clean_instance(u_instance);
       return U_ERROR_MEMORY;
     }
-    u_map_init(u_instance->default_headers);
+    if (u_map_init(u_instance->default_headers) != U_OK) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error initializing u_instance->default_headers");
+      ulfius_clean_instance(u_instance);
+      return U_ERROR_MEMORY;
+    }
+    u_instance->router = o_malloc(sizeof(struct _u_router_handler));
+    if (u_instance->router == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_instance->router");
+      ulfius_clean_instance(u_instance);
+      return U_ERROR_MEMORY;
+    }
+    memset(u_instance->router, 0, sizeof(struct _u_router_handler));
+    u_instance->pool = o_malloc(sizeof(struct _u_pool));
+    if (u_instance->pool == NULL) {
+      y_log_message(Y_LOG_LEVEL_ERROR, "Ulfius - Error allocating memory for u_instance->pool");
+      ulfius_clean_instance(u_instance);
+      return U_ERROR_MEMORY;
+    }
+    memset(u_instance->pool, 0, sizeof(struct _u_pool));
     u_instance->max_post_param_size = 0;
     u_instance->max_post_body_size = 0;
     u_instance->file_upload_callback = NULL;
@@ -1722,6 +2367,7 @@ UNUSED(network_type);
       ulfius_clean_instance(u_instance);
       return U_ERROR_MEMORY;
     }
+    ((struct _websocket_handler *)u_instance->websocket_handler)->pthread_init = 0;
     pthread_mutexattr_init ( &mutexattr );
     pthread_mutexattr_settype( &mutexattr, PTHREAD_MUTEX_RECURSIVE );
     if (pthread_mutex_init(&((struct _websocket_handler *)u_instance->websocket_handler)->websocket_active_lock, &mutexattr) != 0) {
@@ -1730,7 +2376,6 @@ UNUSED(network_type);
       return U_ERROR;
     }
     pthread_mutexattr_destroy(&mutexattr);
-    ((struct _websocket_handler *)u_instance->websocket_handler)->pthread_init = 0;
     ((struct _websocket_handler *)u_instance->websocket_handler)->nb_websocket_active = 0;
     ((struct _websocket_handler *)u_instance->websocket_handler)->websocket_active = NULL;
     if (pthread_mutex_init(&((struct _websocket_handler *)u_instance->websocket_handler)->websocket_close_lock, NULL) ||
@@ -1744,6 +2389,16 @@ UNUSED(network_type);
     u_instance->websocket_handler = NULL;
 #endif
     u_instance->allowed_post_processor = U_POST_PROCESS_URL_ENCODED|U_POST_PROCESS_MULTIPART_FORMDATA;
+    u_instance->route_cache_size = U_ROUTE_CACHE_DEFAULT_SIZE;
+    u_instance->daemon_mode = U_DAEMON_MODE_THREAD_PER_CONNECTION;
+    u_instance->thread_pool_size = 0;
+    u_instance->arena_block_size = U_ARENA_DEFAULT_BLOCK_SIZE;
+    u_instance->pool_max_retained = U_POOL_DEFAULT_MAX_RETAINED;
+    u_instance->post_body_storage = U_POST_BODY_RAW|U_POST_BODY_PARSED;
+    u_instance->post_processor_buffer_size = ULFIUS_POSTBUFFERSIZE;
+    u_instance->upload_file_buffer_size = U_UPLOAD_FILE_DEFAULT_BUFFER_SIZE;
+    u_instance->upload_file_flags = 0;
+    u_instance->allow_suspend = 0;
     return U_OK;
   } else {
     return U_ERROR_PARAMS;
@@ -1768,78 +2423,6 @@ void u_free(void * data) {
   o_free(data);
 }
 
-/**
- * The utf8_check() function scans the string starting
- * at s. It returns a pointer to the first byte of the first malformed
- * or overlong UTF-8 sequence found, or NULL if the string contains
- * only correct UTF-8. It also spots UTF-8 sequences that could cause
- * trouble if converted to UTF-16, namely surrogate characters
- * (U+D800..U+DFFF) and non-Unicode positions (U+FFFE..U+FFFF). This
- * routine is very likely to find a malformed sequence if the input
- * uses any other encoding than UTF-8. It therefore can be used as a
- * very effective heuristic for distinguishing between UTF-8 and other
- * encodings.
- *
- * I wrote this code mainly as a specification of functionality; there
- * are no doubt performance optimizations possible for certain CPUs.
- *
- * Markus Kuhn <http://www.cl.cam.ac.uk/~mgk25/> -- 2005-03-30
- * Nicolas Mora <mail@babelouest.org>
- * License: http://www.cl.cam.ac.uk/~mgk25/short-license.html
- */
-const unsigned char * utf8_check(const char * s_orig, size_t len) {
-  const unsigned char * s = (unsigned char *)s_orig;
-  size_t i = 0;
-
-  while (i<len) {
-    if (*s < 0x80) {
-      /* 0xxxxxxx */
-      s++;
-      i++;
-    } else if ((s[0] & 0xe0) == 0xc0) {
-      /* 110XXXXx 10xxxxxx */
-      if ((i+1 >= len) ||
-          (s[1] & 0xc0) != 0x80 ||
-          (s[0] & 0xfe) == 0xc0) {                  /* overlong? */
-        return s;
-      } else {
-        s += 2;
-        i += 2;
-      }
-    } else if ((s[0] & 0xf0) == 0xe0) {
-      /* 1110XXXX 10Xxxxxx 10xxxxxx */
-      if ((i+2 >= len) ||
-          (s[1] & 0xc0) != 0x80 ||
-          (s[2] & 0xc0) != 0x80 ||
-          (s[0] == 0xe0 && (s[1] & 0xe0) == 0x80) ||                 /* overlong? */
-          (s[0] == 0xed && (s[1] & 0xe0) == 0xa0) ||                 /* surrogate? */
-          (s[0] == 0xef && s[1] == 0xbf && (s[2] & 0xfe) == 0xbe && /* U+FFFE or U+FFFF? */
-          s[2] != 0xbf && s[2] != 0xbe)) { /* Hideous hack to comply with autobahn testsuite, TODO: fix that one day (and other jokes I tell myself) */
-        return s;
-      } else {
-        s += 3;
-        i += 3;
-      }
-    } else if ((s[0] & 0xf8) == 0xf0) {
-      /* 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx */
-      if ((i+3 >= len) ||
-          (s[1] & 0xc0) != 0x80 ||
-          (s[2] & 0xc0) != 0x80 ||
-          (s[3] & 0xc0) != 0x80 ||
-          (s[0] == 0xf0 && (s[1] & 0xf0) == 0x80) ||      /* overlong? */
-          (s[0] == 0xf4 && s[1] > 0x8f) || s[0] > 0xf4) { /* > U+10FFFF? */
-        return s;
-      } else {
-        s += 4;
-        i += 4;
-      }
-    } else {
-      return s;
-    }
-  }
-  return NULL;
-}
-
 /**
  * Converts a hex character to its integer value
  */
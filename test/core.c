@@ -12,6 +12,7 @@
 #include <string.h>
 #include <time.h>
 #include <ulfius.h>
+#include <u_private.h>
 
 #define HTTP_PROTOCOL "http_protocol"
 #define HTTP_VERB "http_verb"
@@ -1337,6 +1338,129 @@ START_TEST(test_url_encode_decode)
 }
 END_TEST
 
+/**
+ * Scalar utf8_check, the vectorized validation must return the same result
+ */
+static const unsigned char * utf8_check_reference(const char * s_orig, size_t len) {
+  const unsigned char * s = (unsigned char *)s_orig;
+  size_t i = 0;
+
+  while (i<len) {
+    if (*s < 0x80) {
+      s++;
+      i++;
+    } else if ((s[0] & 0xe0) == 0xc0) {
+      if ((i+1 >= len) || (s[1] & 0xc0) != 0x80 || (s[0] & 0xfe) == 0xc0) {
+        return s;
+      }
+      s += 2;
+      i += 2;
+    } else if ((s[0] & 0xf0) == 0xe0) {
+      if ((i+2 >= len) || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 ||
+          (s[0] == 0xe0 && (s[1] & 0xe0) == 0x80) || (s[0] == 0xed && (s[1] & 0xe0) == 0xa0)) {
+        return s;
+      }
+      s += 3;
+      i += 3;
+    } else if ((s[0] & 0xf8) == 0xf0) {
+      if ((i+3 >= len) || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80 ||
+          (s[0] == 0xf0 && (s[1] & 0xf0) == 0x80) || (s[0] == 0xf4 && s[1] > 0x8f) || s[0] > 0xf4) {
+        return s;
+      }
+      s += 4;
+      i += 4;
+    } else {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Append a random character to buffer, valid or not, return its length
+ */
+static size_t utf8_random_char(unsigned char * buffer) {
+  unsigned int cp;
+
+  switch (random()%8) {
+    case 0:
+    case 1:
+    case 2:
+      buffer[0] = (unsigned char)(random()%0x80);
+      return 1;
+    case 3:
+      cp = 0x80 + (unsigned int)(random()%0x780);
+      buffer[0] = (unsigned char)(0xc0|(cp>>6));
+      buffer[1] = (unsigned char)(0x80|(cp&0x3f));
+      return 2;
+    case 4:
+      // surrogates included
+      cp = 0x800 + (unsigned int)(random()%0xf800);
+      buffer[0] = (unsigned char)(0xe0|(cp>>12));
+      buffer[1] = (unsigned char)(0x80|((cp>>6)&0x3f));
+      buffer[2] = (unsigned char)(0x80|(cp&0x3f));
+      return 3;
+    case 5:
+      cp = 0x10000 + (unsigned int)(random()%0x100000);
+      buffer[0] = (unsigned char)(0xf0|(cp>>18));
+      buffer[1] = (unsigned char)(0x80|((cp>>12)&0x3f));
+      buffer[2] = (unsigned char)(0x80|((cp>>6)&0x3f));
+      buffer[3] = (unsigned char)(0x80|(cp&0x3f));
+      return 4;
+    case 6:
+      // continuation byte
+      buffer[0] = (unsigned char)(0x80|(random()%0x40));
+      return 1;
+    default:
+      buffer[0] = (unsigned char)random();
+      return 1;
+  }
+}
+
+START_TEST(test_utf8_check)
+{
+  const char * invalid[] = {"\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xe0\x9f\xbf", "\xed\xa0\x80", "\xed\xbf\xbf", "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf",
+                            "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xf8\x88\x80\x80\x80", "\xff", "\x80", "\xbf", "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xc3\x28", NULL};
+  const char * valid[] = {"\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", NULL};
+  char buffer[512];
+  size_t len, offset, i, j;
+
+  ck_assert_ptr_eq(utf8_check("", 0), NULL);
+  ck_assert_ptr_eq(utf8_check("Hëllô Ulfius", o_strlen("Hëllô Ulfius")), NULL);
+  // The sequences are tested in ascii strings at the offsets around the 64 bytes blocks limits
+  for (offset=0; offset<140; offset++) {
+    for (i=0; invalid[i]!=NULL; i++) {
+      for (len=offset+o_strlen(invalid[i]); len<offset+o_strlen(invalid[i])+70; len+=23) {
+        memset(buffer, 'a', sizeof(buffer));
+        memcpy(buffer+offset, invalid[i], o_strlen(invalid[i]));
+        ck_assert_ptr_eq(utf8_check(buffer, len), buffer+offset);
+      }
+    }
+    for (i=0; valid[i]!=NULL; i++) {
+      memset(buffer, 'a', sizeof(buffer));
+      memcpy(buffer+offset, valid[i], o_strlen(valid[i]));
+      ck_assert_ptr_eq(utf8_check(buffer, offset+o_strlen(valid[i])), NULL);
+      ck_assert_ptr_eq(utf8_check(buffer, 200), NULL);
+    }
+  }
+
+  // Random strings, valid or not, give the same result as the scalar validation
+  srandom(42);
+  for (i=0; i<200000; i++) {
+    len = (size_t)random()%((i%100)?200:500);
+    for (j=0; j<len; ) {
+      if (random()%4) {
+        j += utf8_random_char((unsigned char *)buffer+j);
+      } else {
+        // Long valid parts, so the vectorized validation has complete blocks
+        buffer[j++] = 'a';
+      }
+    }
+    ck_assert_ptr_eq(utf8_check(buffer, len), utf8_check_reference(buffer, len));
+  }
+}
+END_TEST
+
 static Suite *ulfius_suite(void)
 {
 	Suite *s;
@@ -1356,6 +1480,7 @@ static Suite *ulfius_suite(void)
 	tcase_add_test(tc_core, test_endpoint_weirder);
 	tcase_add_test(tc_core, test_ulfius_start_instance);
 	tcase_add_test(tc_core, test_url_encode_decode);
+	tcase_add_test(tc_core, test_utf8_check);
 	tcase_set_timeout(tc_core, 30);
 	suite_add_tcase(s, tc_core);
 
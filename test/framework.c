@@ -20,6 +20,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -4977,6 +4978,283 @@ int callback_function_multiple_complete(const struct _u_request * request, struc
   return U_CALLBACK_COMPLETE;
 }
 
+int callback_function_append_user_data(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  UNUSED(request);
+  if (response->binary_body != NULL) {
+    char * body = msprintf("%.*s\n%s", (int)response->binary_body_length, (char*)response->binary_body, (const char *)user_data);
+    ulfius_set_string_body_response(response, 200, body);
+    o_free(body);
+  } else {
+    ulfius_set_string_body_response(response, 200, (const char *)user_data);
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_append_url_param(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  return callback_function_append_user_data(request, response, (void *)u_map_get(request->map_url, (const char *)user_data));
+}
+
+int callback_function_append_user_data_ignore(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  callback_function_append_user_data(request, response, user_data);
+  return U_CALLBACK_IGNORE;
+}
+
+#define LARGE_BODY_SIZE (4*1024*1024)
+
+int callback_function_large_body(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  unsigned char * body = o_malloc(LARGE_BODY_SIZE);
+  size_t i;
+  UNUSED(request);
+  UNUSED(user_data);
+
+  for (i=0; i<LARGE_BODY_SIZE; i++) {
+    body[i] = (unsigned char)('a' + (i%26));
+  }
+  response->status = 200;
+  response->binary_body = body;
+  response->binary_body_length = LARGE_BODY_SIZE;
+  return U_CALLBACK_COMPLETE;
+}
+
+int callback_function_arena(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  char * value = ulfius_request_arena_strdup(request, u_map_get(request->map_url, "value"));
+  unsigned char * large = ulfius_request_arena_alloc(request, 3*U_ARENA_DEFAULT_BLOCK_SIZE);
+  UNUSED(user_data);
+
+  if (value == NULL || large == NULL) {
+    return U_CALLBACK_ERROR;
+  }
+  memset(large, 'a', 3*U_ARENA_DEFAULT_BLOCK_SIZE);
+  ulfius_set_string_body_response(response, 200, value);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_pool(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  char * body = msprintf("%s:%s:%s", u_map_get(request->map_url, "value"), u_map_has_key(request->map_url, "key")?u_map_get(request->map_url, "key"):"none", u_map_has_key(response->map_header, "X-Pool")?"stale":"clean");
+  UNUSED(user_data);
+
+  u_map_put(response->map_header, "X-Pool", "set");
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_borrowed_maps(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  char * body;
+  UNUSED(user_data);
+
+  // The values borrowed from the connection are copied before they're modified
+  u_map_put_binary(request->map_header, "X-Borrowed", "-modified", (uint64_t)u_map_get_length(request->map_header, "X-Borrowed")-1, o_strlen("-modified")+1);
+  u_map_put(request->map_cookie, "first", "changed");
+  u_map_remove_from_key(request->map_cookie, "second");
+  u_map_put(request->map_url, "key", NULL);
+  body = msprintf("%s:%s:%s:%s", u_map_get(request->map_header, "X-Borrowed"), u_map_get(request->map_cookie, "first"), u_map_has_key(request->map_cookie, "second")?"second":"none", u_map_get(request->map_url, "key")!=NULL?"key":"empty");
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_default_headers(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  char * body;
+  UNUSED(request);
+  UNUSED(user_data);
+
+  // The default headers are visible in the response headers, a default header overridden is copied
+  body = msprintf("%s:%d", u_map_get(response->map_header, "X-Default"), u_map_count(response->map_header));
+  u_map_put(response->map_header, "X-Override", "callback");
+  u_map_put(response->map_header, "X-Callback", "value");
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+struct _body_stream {
+  size_t       size;
+  unsigned int checksum;
+  int          suspend;
+  size_t       error_after;
+};
+
+static void * thread_resume_request_body(void * args) {
+  usleep(1000);
+  ck_assert_int_eq(ulfius_resume_request_body((const struct _u_request *)args), U_OK);
+  return NULL;
+}
+
+int callback_body_stream(const struct _u_request * request, const char * data, uint64_t off, size_t size, void * user_data) {
+  struct _body_stream * stream = (struct _body_stream *)user_data;
+  pthread_t thread;
+  size_t i;
+
+  if (off != stream->size) {
+    return U_CALLBACK_ERROR;
+  }
+  for (i=0; i<size; i++) {
+    stream->checksum = stream->checksum*31 + (unsigned char)data[i];
+  }
+  stream->size += size;
+  if (stream->error_after && stream->size > stream->error_after) {
+    return U_CALLBACK_ERROR;
+  } else if (stream->suspend == 1) {
+    // The next chunk is received when the thread resumes the request body
+    if (pthread_create(&thread, NULL, thread_resume_request_body, (void *)request) || pthread_detach(thread)) {
+      return U_CALLBACK_ERROR;
+    }
+    return U_CALLBACK_SUSPEND;
+  } else if (stream->suspend == 2) {
+    // Resumed before the body_callback returns, the connection isn't suspended
+    ck_assert_int_eq(ulfius_resume_request_body(request), U_OK);
+    ck_assert_int_eq(ulfius_resume_request_body(request), U_ERROR_PARAMS);
+    return U_CALLBACK_SUSPEND;
+  } else if (stream->suspend == 3) {
+    // The connection can't be suspended, U_CALLBACK_SUSPEND is handled as U_CALLBACK_ERROR
+    ck_assert_int_eq(ulfius_resume_request_body(request), U_ERROR_PARAMS);
+    return U_CALLBACK_SUSPEND;
+  }
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_body_stream(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _body_stream * stream = (struct _body_stream *)user_data;
+  char * body;
+
+  // The body was given to the body_callback, it's not stored in the request
+  body = msprintf("%s:%zu:%u:%zu:%u", u_map_get(request->map_url, "name"), stream->size, stream->checksum, request->binary_body_length, u_map_count(request->map_post_body));
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_buffered_body(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  unsigned int checksum = 0;
+  char * body;
+  size_t i;
+  UNUSED(user_data);
+
+  for (i=0; i<request->binary_body_length; i++) {
+    checksum = checksum*31 + request->binary_body[i];
+  }
+  body = msprintf("%zu:%u", request->binary_body_length, checksum);
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_post_body_storage(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  char * body;
+  UNUSED(user_data);
+
+  body = msprintf("%zu:%s", request->binary_body_length, u_map_has_key(request->map_post_body, "key")?u_map_get(request->map_post_body, "key"):"none");
+  ulfius_set_string_body_response(response, 200, body);
+  o_free(body);
+  return U_CALLBACK_CONTINUE;
+}
+
+int callback_function_upload_file_directory(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  const char * path = u_map_get(request->map_upload_file, "file");
+  char * data = o_malloc(sizeof(large_binary_data)+1);
+  FILE * f;
+
+  // The file is written in the upload directory, its data isn't in the request
+  ck_assert_int_eq(request->binary_body_length, 0);
+  ck_assert_str_eq(u_map_get(request->map_post_body, "key"), "value");
+  ck_assert_int_eq(u_map_has_key(request->map_upload_file, "key"), 0);
+  // The post parameters sent by the client can't change the values of the files
+  if (u_map_has_key(request->map_post_body, "file")) {
+    ck_assert_str_eq(u_map_get(request->map_post_body, "file"), "/etc/shadow");
+    ck_assert_str_eq(u_map_get(request->map_post_body, "file_sha256"), "spoof");
+  }
+  ck_assert_ptr_ne(path, NULL);
+  ck_assert_int_eq(o_strncmp(path, (const char *)user_data, o_strlen((const char *)user_data)), 0);
+  ck_assert_str_eq(u_map_get(request->map_upload_file, "file_filename"), "image.png");
+  ck_assert_int_eq(strtoul(u_map_get(request->map_upload_file, "file_size"), NULL, 10), sizeof(large_binary_data));
+#ifndef U_DISABLE_GNUTLS
+  ck_assert_str_eq(u_map_get(request->map_upload_file, "file_sha256"), "f21c7244ee88341faa9163090e506ad7a0ac731791b774b65c5bf0d1df0c726b");
+#endif
+  ck_assert_ptr_ne((f = fopen(path, "rb")), NULL);
+  ck_assert_int_eq(fread(data, 1, sizeof(large_binary_data)+1, f), sizeof(large_binary_data));
+  ck_assert_int_eq(memcmp(data, large_binary_data, sizeof(large_binary_data)), 0);
+  fclose(f);
+  o_free(data);
+  remove(path);
+  // The second file sent in the same post parameter has its own values
+  ck_assert_ptr_ne(u_map_get(request->map_upload_file, "file.1"), NULL);
+  ck_assert_str_ne(u_map_get(request->map_upload_file, "file.1"), path);
+  ck_assert_int_eq(o_strncmp(u_map_get(request->map_upload_file, "file.1"), (const char *)user_data, o_strlen((const char *)user_data)), 0);
+  ck_assert_str_eq(u_map_get(request->map_upload_file, "file.1_filename"), "image2.png");
+  ck_assert_str_eq(u_map_get(request->map_upload_file, "file.1_size"), "3");
+  ck_assert_int_eq(u_map_has_key(request->map_upload_file, "file.2"), 0);
+  remove(u_map_get(request->map_upload_file, "file.1"));
+  ulfius_set_string_body_response(response, 200, "ok");
+  return U_CALLBACK_CONTINUE;
+}
+
+struct _resume_args {
+  struct _u_response * response;
+  int                  callback_ret;
+};
+
+static void * thread_resume_response(void * args) {
+  struct _resume_args * resume_args = (struct _resume_args *)args;
+  usleep(100000);
+  callback_function_append_user_data(NULL, resume_args->response, "async");
+  ck_assert_int_eq(ulfius_resume_response(resume_args->response, resume_args->callback_ret), U_OK);
+  o_free(resume_args);
+  return NULL;
+}
+
+int callback_function_suspend(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _resume_args * resume_args = o_malloc(sizeof(struct _resume_args));
+  pthread_t thread;
+  UNUSED(request);
+
+  resume_args->response = response;
+  resume_args->callback_ret = *(int *)user_data;
+  if (pthread_create(&thread, NULL, thread_resume_response, resume_args) || pthread_detach(thread)) {
+    o_free(resume_args);
+    return U_CALLBACK_ERROR;
+  }
+  return U_CALLBACK_SUSPEND;
+}
+
+int callback_function_suspend_resumed(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  UNUSED(user_data);
+  callback_function_append_user_data(request, response, "immediate");
+  ck_assert_int_eq(ulfius_resume_response(response, U_CALLBACK_CONTINUE), U_OK);
+  ck_assert_int_eq(ulfius_resume_response(response, U_CALLBACK_CONTINUE), U_ERROR_PARAMS);
+  return U_CALLBACK_SUSPEND;
+}
+
+int callback_function_suspend_not_allowed(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  UNUSED(request);
+  UNUSED(user_data);
+  // The connection can't be suspended, U_CALLBACK_SUSPEND is handled as U_CALLBACK_ERROR
+  ck_assert_int_eq(ulfius_resume_response(response, U_CALLBACK_CONTINUE), U_ERROR_PARAMS);
+  return U_CALLBACK_SUSPEND;
+}
+
+struct _kept_response {
+  pthread_mutex_t      lock;
+  struct _u_response * response;
+};
+
+int callback_function_suspend_kept(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  struct _kept_response * kept = (struct _kept_response *)user_data;
+  UNUSED(request);
+  // The response is resumed by the test after the framework is stopped
+  pthread_mutex_lock(&kept->lock);
+  kept->response = response;
+  pthread_mutex_unlock(&kept->lock);
+  return U_CALLBACK_SUSPEND;
+}
+
+int callback_function_remove_endpoint(const struct _u_request * request, struct _u_response * response, void * user_data) {
+  UNUSED(request);
+  ck_assert_int_eq(ulfius_remove_endpoint_by_val((struct _u_instance *)user_data, "GET", "remove", "*"), U_OK);
+  ulfius_set_string_body_response(response, 200, "first");
+  return U_CALLBACK_CONTINUE;
+}
+
 ssize_t stream_data (void * cls, uint64_t pos, char * buf, size_t max) {
   usleep(100);
   if (pos <= 100) {
@@ -5968,6 +6246,203 @@ START_TEST(test_ulfius_endpoint_multiple)
 }
 END_TEST
 
+static void check_router_response(const char * url, long status, const char * body) {
+  struct _u_request request;
+  struct _u_response response;
+
+  ulfius_init_request(&request);
+  request.http_url = o_strdup(url);
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+  ck_assert_int_eq(response.status, status);
+  if (body != NULL) {
+    ck_assert_int_eq(response.binary_body_length, o_strlen(body));
+    ck_assert_int_eq(o_strncmp((const char *)response.binary_body, body, o_strlen(body)), 0);
+  }
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+}
+
+static void * thread_check_suspended_response(void * args) {
+  UNUSED(args);
+  check_router_response("http://localhost:8080/async/chained", 200, "async\nsync");
+  return NULL;
+}
+
+static void * thread_send_kept_request(void * args) {
+  struct _u_request request;
+  struct _u_response response;
+  UNUSED(args);
+
+  // The connection is closed by ulfius_stop_framework before the response is sent
+  ulfius_init_request(&request);
+  ulfius_init_response(&response);
+  request.http_url = o_strdup("http://localhost:8080/async/kept");
+  ulfius_send_http_request(&request, &response);
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+  return NULL;
+}
+
+START_TEST(test_ulfius_endpoint_router)
+{
+  struct _u_instance u_instance;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/items/:id", 1, &callback_function_append_user_data, "param"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/items/all", 0, &callback_function_append_user_data, "static"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/items/*", 2, &callback_function_append_user_data, "wildcard"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "router", "/items/all", 0, &callback_function_append_user_data, "post"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/items/all/more", 1, &callback_function_append_user_data, "deep"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "*", "router", "/order", 3, &callback_function_append_user_data, "first"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/order", 3, &callback_function_append_user_data, "second"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/order", 3, &callback_function_append_user_data, "third"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  check_router_response("http://localhost:8080/router/items/all", 200, "static\nparam\nwildcard");
+  check_router_response("http://localhost:8080/router/items/42", 200, "param\nwildcard");
+  check_router_response("http://localhost:8080/router/items/all/more", 200, "deep\nwildcard");
+  check_router_response("http://localhost:8080/router/items/42/more", 200, "wildcard");
+  check_router_response("http://localhost:8080/router/items", 200, "wildcard");
+  check_router_response("http://localhost:8080/router/order", 200, "first\nsecond\nthird");
+  check_router_response("http://localhost:8080/router", 404, NULL);
+  check_router_response("http://localhost:8080/nope/items/all", 404, NULL);
+
+  // The routing table is updated when an endpoint is removed or added while the instance is running
+  ck_assert_int_eq(ulfius_remove_endpoint_by_val(&u_instance, "GET", "router", "/items/all"), U_OK);
+  check_router_response("http://localhost:8080/router/items/all", 200, "param\nwildcard");
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "router", "/items/all", 0, &callback_function_append_user_data, "static again"), U_OK);
+  check_router_response("http://localhost:8080/router/items/all", 200, "static again\nparam\nwildcard");
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_remove_during_request)
+{
+  struct _u_instance u_instance;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "remove", NULL, 0, &callback_function_remove_endpoint, &u_instance), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "remove", "*", 1, &callback_function_append_user_data, "second"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  // The endpoints matched by a request remain valid until the end of the request
+  check_router_response("http://localhost:8080/remove", 200, "first\nsecond");
+  ck_assert_int_eq(u_instance.nb_endpoints, 1);
+  ck_assert_int_eq(ulfius_remove_endpoint_by_val(&u_instance, "GET", "remove", "*"), U_ERROR_NOT_FOUND);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "remove", "*", 1, &callback_function_append_user_data, "second"), U_OK);
+  check_router_response("http://localhost:8080/remove", 200, "first\nsecond");
+  check_router_response("http://localhost:8080/remove", 200, "first");
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_url_params_chained)
+{
+  struct _u_instance u_instance;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "chain", "/:id/:name", 0, &callback_function_append_url_param, "id"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "chain", "/:id/:name", 1, &callback_function_append_url_param, "name"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "chain", "/:name/*", 2, &callback_function_append_url_param, "name"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "chain", "/:id/:id", 3, &callback_function_append_url_param, "id"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "chain", "/:id/:name", 4, &callback_function_append_url_param, "id"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  // The url parameters are decoded, repeated keys are concatenated with the query parameters first
+  check_router_response("http://localhost:8080/chain/first%20one/second", 200, "first one\nsecond\nfirst one\nfirst one,second\nfirst one");
+  check_router_response("http://localhost:8080/chain/first/second?id=query", 200, "query,first\nsecond\nfirst\nquery,first,second\nquery,first");
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_route_cache)
+{
+  struct _u_instance u_instance;
+  size_t hits = 0, misses = 0;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(u_instance.route_cache_size, U_ROUTE_CACHE_DEFAULT_SIZE);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "cache", "/:id", 0, &callback_function_append_url_param, "id"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  check_router_response("http://localhost:8080/cache/42", 200, "42");
+  check_router_response("http://localhost:8080/cache/42", 200, "42");
+  check_router_response("http://localhost:8080/cache/43", 200, "43");
+  ck_assert_int_eq(ulfius_get_route_cache_stats(&u_instance, &hits, &misses), U_OK);
+  ck_assert_int_eq(hits, 1);
+  ck_assert_int_eq(misses, 2);
+
+  // The cache is emptied when an endpoint is added
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "cache", "/42", 1, &callback_function_append_user_data, "static"), U_OK);
+  check_router_response("http://localhost:8080/cache/42", 200, "42\nstatic");
+  check_router_response("http://localhost:8080/cache/42", 200, "42\nstatic");
+  ck_assert_int_eq(ulfius_get_route_cache_stats(&u_instance, &hits, NULL), U_OK);
+  ck_assert_int_eq(ulfius_get_route_cache_stats(&u_instance, NULL, &misses), U_OK);
+  ck_assert_int_eq(hits, 2);
+  ck_assert_int_eq(misses, 3);
+  ck_assert_int_eq(ulfius_get_route_cache_stats(NULL, &hits, &misses), U_ERROR_PARAMS);
+
+  ulfius_stop_framework(&u_instance);
+
+  // The cache is disabled
+  u_instance.route_cache_size = 0;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/cache/43", 200, "43");
+  ck_assert_int_eq(ulfius_get_route_cache_stats(&u_instance, &hits, &misses), U_OK);
+  ck_assert_int_eq(hits, 2);
+  ck_assert_int_eq(misses, 3);
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+static void * thread_update_endpoints(void * arg) {
+  struct _u_instance * u_instance = (struct _u_instance *)arg;
+  int i;
+
+  for (i=0; i<200; i++) {
+    if (ulfius_add_endpoint_by_val(u_instance, "GET", "dynamic", "/:id", 0, &callback_function_append_user_data, "param") != U_OK ||
+        ulfius_remove_endpoint_by_val(u_instance, "GET", "dynamic", "/:id") != U_OK) {
+      return (void *)1;
+    }
+  }
+  return NULL;
+}
+
+START_TEST(test_ulfius_endpoint_update_during_requests)
+{
+  struct _u_instance u_instance;
+  pthread_t thread;
+  void * thread_ret = NULL;
+  int i;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "concurrent", "/static", 1, &callback_function_append_user_data, "static"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  // Requests are served while the routing table is replaced by another thread
+  ck_assert_int_eq(pthread_create(&thread, NULL, thread_update_endpoints, &u_instance), 0);
+  for (i=0; i<50; i++) {
+    check_router_response("http://localhost:8080/concurrent/static", 200, "static");
+  }
+  ck_assert_int_eq(pthread_join(thread, &thread_ret), 0);
+  ck_assert_ptr_eq(thread_ret, NULL);
+  ck_assert_int_eq(u_instance.nb_endpoints, 1);
+  check_router_response("http://localhost:8080/dynamic/42", 404, NULL);
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
 START_TEST(test_ulfius_endpoint_multiple_with_unauthorized)
 {
   struct _u_instance u_instance;
@@ -6126,6 +6601,634 @@ START_TEST(test_ulfius_endpoint_stream)
 }
 END_TEST
 
+START_TEST(test_ulfius_endpoint_thread_pool)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(u_instance.daemon_mode, U_DAEMON_MODE_THREAD_PER_CONNECTION);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "pool", "/:id", 0, &callback_function_append_url_param, "id"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "stream", NULL, 0, &callback_function_stream, NULL), U_OK);
+
+  u_instance.daemon_mode = 42;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_ERROR_PARAMS);
+
+  u_instance.daemon_mode = U_DAEMON_MODE_THREAD_POOL;
+  u_instance.thread_pool_size = 2;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/pool/42", 200, "42");
+
+  ulfius_init_request(&request);
+  request.http_url = o_strdup("http://localhost:8080/stream");
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_streaming_request(&request, &response, my_write_body, NULL), U_OK);
+  ck_assert_int_eq(response.status, 200);
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+  ulfius_stop_framework(&u_instance);
+
+  // The number of workers is the number of processors
+  u_instance.thread_pool_size = 0;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/pool/43", 200, "43");
+  ulfius_stop_framework(&u_instance);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_suspend)
+{
+  struct _u_instance u_instance;
+  struct _u_response response;
+  struct _kept_response kept = {PTHREAD_MUTEX_INITIALIZER, NULL};
+  struct _u_response * kept_response = NULL;
+  pthread_t threads[4];
+  int resume_continue = U_CALLBACK_CONTINUE, resume_error = U_CALLBACK_ERROR, resume_unauthorized = U_CALLBACK_UNAUTHORIZED;
+  size_t i;
+
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_resume_response(NULL, U_CALLBACK_COMPLETE), U_ERROR_PARAMS);
+  ck_assert_int_eq(ulfius_resume_response(&response, U_CALLBACK_COMPLETE), U_ERROR_PARAMS);
+  ulfius_clean_response(&response);
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/chained", 0, &callback_function_suspend, &resume_continue), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/chained", 1, &callback_function_append_user_data, "sync"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/twice", 0, &callback_function_suspend, &resume_continue), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/twice", 1, &callback_function_suspend, &resume_continue), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/immediate", 0, &callback_function_suspend_resumed, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/immediate", 1, &callback_function_append_user_data, "sync"), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/error", 0, &callback_function_suspend, &resume_error), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/unauthorized", 0, &callback_function_suspend, &resume_unauthorized), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/not_allowed", 0, &callback_function_suspend_not_allowed, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "async", "/kept", 0, &callback_function_suspend_kept, &kept), U_OK);
+
+  // The connections can't be suspended with a thread per connection
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/async/not_allowed", 500, NULL);
+  ulfius_stop_framework(&u_instance);
+
+  u_instance.daemon_mode = U_DAEMON_MODE_THREAD_POOL;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/async/chained", 200, "async\nsync");
+  check_router_response("http://localhost:8080/async/twice", 200, "async\nasync");
+  check_router_response("http://localhost:8080/async/immediate", 200, "immediate\nsync");
+  check_router_response("http://localhost:8080/async/error", 500, NULL);
+  check_router_response("http://localhost:8080/async/unauthorized", 401, NULL);
+  ulfius_stop_framework(&u_instance);
+
+  // A single worker thread serves all the suspended requests at the same time
+  u_instance.thread_pool_size = 1;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  for (i=0; i<4; i++) {
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, thread_check_suspended_response, NULL), 0);
+  }
+  for (i=0; i<4; i++) {
+    ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+  }
+  check_router_response("http://localhost:8080/async/immediate", 200, "immediate\nsync");
+  ulfius_stop_framework(&u_instance);
+
+  // The framework is stopped while a request is suspended, the response is still valid until it's resumed
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  ck_assert_int_eq(pthread_create(&threads[0], NULL, thread_send_kept_request, NULL), 0);
+  for (i=0; i<100 && kept_response == NULL; i++) {
+    usleep(50000);
+    pthread_mutex_lock(&kept.lock);
+    kept_response = kept.response;
+    pthread_mutex_unlock(&kept.lock);
+  }
+  ck_assert_ptr_ne(kept_response, NULL);
+  ulfius_stop_framework(&u_instance);
+  ck_assert_int_eq(ulfius_set_string_body_response(kept_response, 200, "too late"), U_OK);
+  ck_assert_int_eq(ulfius_resume_response(kept_response, U_CALLBACK_CONTINUE), U_ERROR);
+  ck_assert_int_eq(pthread_join(threads[0], NULL), 0);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_response_body)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+  size_t i;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "body", "/large", 0, &callback_function_large_body, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "body", "/ignored", 0, &callback_function_append_user_data_ignore, "ignored"), U_OK);
+  ck_assert_int_eq(ulfius_set_default_endpoint(&u_instance, &callback_function_append_user_data, "default"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  ulfius_init_request(&request);
+  request.http_url = o_strdup("http://localhost:8080/body/large");
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+  ck_assert_int_eq(response.status, 200);
+  ck_assert_int_eq(response.binary_body_length, LARGE_BODY_SIZE);
+  for (i=0; i<LARGE_BODY_SIZE; i+=4099) {
+    ck_assert_int_eq(((unsigned char *)response.binary_body)[i], 'a' + (i%26));
+  }
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+
+  // The body set by an ignored callback function is still available to the default callback function
+  check_router_response("http://localhost:8080/body/ignored", 200, "ignored\ndefault");
+  check_router_response("http://localhost:8080/body/none", 200, "default");
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_arena)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+
+  ulfius_init_request(&request);
+  ck_assert_ptr_eq(ulfius_request_arena_alloc(&request, 8), NULL);
+  ck_assert_ptr_eq(ulfius_request_arena_strdup(&request, "value"), NULL);
+  ulfius_clean_request(&request);
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(u_instance.arena_block_size, U_ARENA_DEFAULT_BLOCK_SIZE);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "arena", "/:value", 0, &callback_function_arena, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "arena", "/:value", 1, &callback_function_append_user_data, "next"), U_OK);
+
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/arena/default?key=value", 200, "default\nnext");
+  ulfius_stop_framework(&u_instance);
+
+  // Each per-request object is allocated separately
+  u_instance.arena_block_size = 0;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/arena/separate?key=value", 200, "separate\nnext");
+  ulfius_stop_framework(&u_instance);
+
+  u_instance.arena_block_size = 64;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/arena/small?key=value", 200, "small\nnext");
+  ulfius_stop_framework(&u_instance);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_pool)
+{
+  struct _u_instance u_instance;
+  size_t hits = 0, misses = 0, retained = 0, new_hits = 0;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(u_instance.pool_max_retained, U_POOL_DEFAULT_MAX_RETAINED);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "pool", "/:value", 0, &callback_function_pool, NULL), U_OK);
+  ck_assert_int_eq(ulfius_get_pool_stats(&u_instance, &hits, &misses, &retained), U_OK);
+  ck_assert_int_eq(hits, 0);
+  ck_assert_int_eq(misses, 0);
+  ck_assert_int_eq(retained, 0);
+  ck_assert_int_eq(ulfius_get_pool_stats(NULL, &hits, &misses, &retained), U_ERROR_PARAMS);
+
+  // A reused request context doesn't keep the values of the previous request
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/pool/first?key=value", 200, "first:value:clean");
+  check_router_response("http://localhost:8080/pool/second", 200, "second:none:clean");
+  check_router_response("http://localhost:8080/pool/third", 200, "third:none:clean");
+  ulfius_stop_framework(&u_instance);
+  ck_assert_int_eq(ulfius_get_pool_stats(&u_instance, &hits, &misses, &retained), U_OK);
+  ck_assert_int_eq(hits+misses, 3);
+  ck_assert_int_ge(misses, 1);
+  ck_assert_int_ge(retained, 1);
+
+  // The pool keeps at most pool_max_retained request contexts
+  u_instance.pool_max_retained = 1;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/pool/fourth", 200, "fourth:none:clean");
+  ulfius_stop_framework(&u_instance);
+  ck_assert_int_eq(ulfius_get_pool_stats(&u_instance, NULL, NULL, &retained), U_OK);
+  ck_assert_int_le(retained, 1);
+
+  // The pool is disabled
+  u_instance.pool_max_retained = 0;
+  ck_assert_int_eq(ulfius_get_pool_stats(&u_instance, &hits, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_router_response("http://localhost:8080/pool/fifth", 200, "fifth:none:clean");
+  ulfius_stop_framework(&u_instance);
+  ck_assert_int_eq(ulfius_get_pool_stats(&u_instance, &new_hits, NULL, NULL), U_OK);
+  ck_assert_int_eq(new_hits, hits);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_borrowed_maps)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+  int i;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "borrowed", NULL, 0, &callback_function_borrowed_maps, NULL), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+  for (i=0; i<3; i++) {
+    ulfius_init_request(&request);
+    request.http_url = o_strdup("http://localhost:8080/borrowed?key=value");
+    u_map_put(request.map_header, "X-Borrowed", "header");
+    u_map_put(request.map_cookie, "first", "value1");
+    u_map_put(request.map_cookie, "second", "value2");
+    ulfius_init_response(&response);
+    ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+    ck_assert_int_eq(response.status, 200);
+    ck_assert_int_eq(response.binary_body_length, o_strlen("header-modified:changed:none:empty"));
+    ck_assert_int_eq(o_strncmp((const char *)response.binary_body, "header-modified:changed:none:empty", response.binary_body_length), 0);
+    ulfius_clean_request(&request);
+    ulfius_clean_response(&response);
+  }
+
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_default_headers)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+  int i;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "GET", "default", NULL, 0, &callback_function_default_headers, NULL), U_OK);
+  ck_assert_int_eq(u_map_put(u_instance.default_headers, "X-Default", "default"), U_OK);
+  ck_assert_int_eq(u_map_put(u_instance.default_headers, "X-Override", "default"), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  // The default headers can't be modified while the framework is running
+  ck_assert_int_eq(u_map_put(u_instance.default_headers, "X-Default", "changed"), U_ERROR_PARAMS);
+
+  for (i=0; i<3; i++) {
+    ulfius_init_request(&request);
+    request.http_url = o_strdup("http://localhost:8080/default");
+    ulfius_init_response(&response);
+    ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+    ck_assert_int_eq(response.status, 200);
+    ck_assert_int_eq(response.binary_body_length, o_strlen("default:2"));
+    ck_assert_int_eq(o_strncmp((const char *)response.binary_body, "default:2", response.binary_body_length), 0);
+    ck_assert_str_eq(u_map_get_case(response.map_header, "X-Default"), "default");
+    ck_assert_str_eq(u_map_get_case(response.map_header, "X-Override"), "callback");
+    ck_assert_str_eq(u_map_get_case(response.map_header, "X-Callback"), "value");
+    ulfius_clean_request(&request);
+    ulfius_clean_response(&response);
+  }
+
+  ulfius_stop_framework(&u_instance);
+  ck_assert_int_eq(u_map_put(u_instance.default_headers, "X-Default", "changed"), U_OK);
+  ck_assert_str_eq(u_map_get(u_instance.default_headers, "X-Override"), "default");
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_body_stream)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+  struct _body_stream stream;
+  struct _u_endpoint endpoint = {"PUT", "stream", "/:name", 0, &callback_function_body_stream, &stream, &callback_body_stream};
+  unsigned int checksum = 0;
+  char * expected;
+  size_t body_size = 1024*1024, i;
+  int suspend, daemon_mode;
+
+  ck_assert_int_eq(ulfius_resume_request_body(NULL), U_ERROR_PARAMS);
+  ulfius_init_request(&request);
+  ck_assert_int_eq(ulfius_resume_request_body(&request), U_ERROR_PARAMS);
+  ulfius_clean_request(&request);
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint(&u_instance, &endpoint), U_OK);
+  for (i=0; i<body_size; i++) {
+    checksum = checksum*31 + (unsigned char)(i%251);
+  }
+
+  // The body is streamed in both daemon modes, it can be suspended with a pool of worker threads only
+  for (daemon_mode=U_DAEMON_MODE_THREAD_PER_CONNECTION; daemon_mode<=U_DAEMON_MODE_THREAD_POOL; daemon_mode++) {
+    u_instance.daemon_mode = daemon_mode;
+    ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+
+    for (suspend=0; suspend<4; suspend++) {
+      if ((daemon_mode == U_DAEMON_MODE_THREAD_POOL) == (suspend == 3)) {
+        continue;
+      }
+      memset(&stream, 0, sizeof(struct _body_stream));
+      stream.suspend = suspend;
+      ulfius_init_request(&request);
+      request.http_verb = o_strdup("PUT");
+      request.http_url = o_strdup("http://localhost:8080/stream/artifact");
+      request.binary_body = o_malloc(body_size);
+      request.binary_body_length = body_size;
+      for (i=0; i<body_size; i++) {
+        ((unsigned char *)request.binary_body)[i] = (unsigned char)(i%251);
+      }
+      ulfius_init_response(&response);
+      ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+      if (suspend == 3) {
+        // U_CALLBACK_SUSPEND is handled as U_CALLBACK_ERROR with a thread per connection
+        ck_assert_int_eq(response.status, 500);
+      } else {
+        ck_assert_int_eq(response.status, 200);
+        expected = msprintf("artifact:%zu:%u:0:0", body_size, checksum);
+        ck_assert_int_eq(response.binary_body_length, o_strlen(expected));
+        ck_assert_int_eq(o_strncmp((const char *)response.binary_body, expected, response.binary_body_length), 0);
+        o_free(expected);
+      }
+      ulfius_clean_request(&request);
+      ulfius_clean_response(&response);
+    }
+
+    // A form body is streamed too, it's not parsed
+    memset(&stream, 0, sizeof(struct _body_stream));
+    ulfius_init_request(&request);
+    request.http_verb = o_strdup("PUT");
+    request.http_url = o_strdup("http://localhost:8080/stream/form");
+    u_map_put(request.map_post_body, "key", "value");
+    ulfius_init_response(&response);
+    ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+    ck_assert_int_eq(response.status, 200);
+    expected = msprintf("form:%zu:%u:0:0", o_strlen("key=value"), stream.checksum);
+    ck_assert_int_eq(response.binary_body_length, o_strlen(expected));
+    ck_assert_int_eq(o_strncmp((const char *)response.binary_body, expected, response.binary_body_length), 0);
+    o_free(expected);
+    ulfius_clean_request(&request);
+    ulfius_clean_response(&response);
+
+    // The rest of the body is discarded when the body_callback fails
+    memset(&stream, 0, sizeof(struct _body_stream));
+    stream.error_after = 1000;
+    ulfius_init_request(&request);
+    request.http_verb = o_strdup("PUT");
+    request.http_url = o_strdup("http://localhost:8080/stream/error");
+    request.binary_body = o_malloc(body_size);
+    request.binary_body_length = body_size;
+    memset(request.binary_body, 'a', body_size);
+    ulfius_init_response(&response);
+    ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+    ck_assert_int_eq(response.status, 500);
+    ulfius_clean_request(&request);
+    ulfius_clean_response(&response);
+
+    ulfius_stop_framework(&u_instance);
+  }
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_buffered_body)
+{
+  struct _u_instance u_instance;
+  struct _u_request request;
+  struct _u_response response;
+  unsigned int checksum = 0, checksum_truncated = 0;
+  size_t body_size = 1024*1024, reallocs = 0, bytes_copied = 0, previous_bytes_copied, i;
+  char * expected;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "PUT", "buffered", NULL, 0, &callback_function_buffered_body, NULL), U_OK);
+  ck_assert_int_eq(ulfius_get_body_stats(NULL, &reallocs, &bytes_copied), U_ERROR_PARAMS);
+  ck_assert_int_eq(ulfius_get_body_stats(&u_instance, &reallocs, &bytes_copied), U_OK);
+  ck_assert_int_eq(reallocs, 0);
+  ck_assert_int_eq(bytes_copied, 0);
+  for (i=0; i<body_size; i++) {
+    checksum = checksum*31 + (unsigned char)(i%251);
+    if (i == 1000-1) {
+      checksum_truncated = checksum;
+    }
+  }
+
+  // The body is allocated with 256KB at first, then its size is doubled up to the Content-Length
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  ulfius_init_request(&request);
+  request.http_verb = o_strdup("PUT");
+  request.http_url = o_strdup("http://localhost:8080/buffered");
+  request.binary_body = o_malloc(body_size);
+  request.binary_body_length = body_size;
+  for (i=0; i<body_size; i++) {
+    ((unsigned char *)request.binary_body)[i] = (unsigned char)(i%251);
+  }
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+  ck_assert_int_eq(response.status, 200);
+  expected = msprintf("%zu:%u", body_size, checksum);
+  ck_assert_int_eq(response.binary_body_length, o_strlen(expected));
+  ck_assert_int_eq(o_strncmp((const char *)response.binary_body, expected, response.binary_body_length), 0);
+  o_free(expected);
+  ulfius_clean_response(&response);
+  ck_assert_int_eq(ulfius_get_body_stats(&u_instance, &reallocs, &bytes_copied), U_OK);
+  ck_assert_int_eq(reallocs, 3);
+  ck_assert_int_ge(bytes_copied, body_size);
+  ck_assert_int_lt(bytes_copied, body_size*2);
+  previous_bytes_copied = bytes_copied;
+  ulfius_stop_framework(&u_instance);
+
+  // The allocation is clamped by max_post_body_size
+  u_instance.max_post_body_size = 1000;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+  ck_assert_int_eq(response.status, 200);
+  expected = msprintf("%zu:%u", (size_t)1000, checksum_truncated);
+  ck_assert_int_eq(response.binary_body_length, o_strlen(expected));
+  ck_assert_int_eq(o_strncmp((const char *)response.binary_body, expected, response.binary_body_length), 0);
+  o_free(expected);
+  ulfius_clean_response(&response);
+  ck_assert_int_eq(ulfius_get_body_stats(&u_instance, &reallocs, &bytes_copied), U_OK);
+  ck_assert_int_eq(reallocs, 4);
+  ck_assert_int_eq(bytes_copied, previous_bytes_copied+1000);
+  ulfius_stop_framework(&u_instance);
+  ulfius_clean_request(&request);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+static void check_post_body_storage(const char * expected) {
+  struct _u_request request;
+  struct _u_response response;
+
+  ulfius_init_request(&request);
+  request.http_verb = o_strdup("POST");
+  request.http_url = o_strdup("http://localhost:8080/storage");
+  u_map_put(request.map_post_body, "key", "value");
+  ulfius_init_response(&response);
+  ck_assert_int_eq(ulfius_send_http_request(&request, &response), U_OK);
+  ck_assert_int_eq(response.status, 200);
+  ck_assert_int_eq(response.binary_body_length, o_strlen(expected));
+  ck_assert_int_eq(o_strncmp((const char *)response.binary_body, expected, response.binary_body_length), 0);
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+}
+
+START_TEST(test_ulfius_endpoint_post_body_storage)
+{
+  struct _u_instance u_instance;
+
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(u_instance.post_body_storage, U_POST_BODY_RAW|U_POST_BODY_PARSED);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "storage", NULL, 0, &callback_function_post_body_storage, NULL), U_OK);
+
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_post_body_storage("9:value");
+  ulfius_stop_framework(&u_instance);
+
+  // The form body is only parsed
+  u_instance.post_body_storage = U_POST_BODY_PARSED;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_post_body_storage("0:value");
+  ulfius_stop_framework(&u_instance);
+
+  // The form body is only stored
+  u_instance.post_body_storage = U_POST_BODY_RAW;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+  check_post_body_storage("9:none");
+  ulfius_stop_framework(&u_instance);
+
+  u_instance.post_body_storage = 0;
+  ck_assert_int_eq(ulfius_start_framework(&u_instance), U_ERROR_PARAMS);
+
+  ulfius_clean_instance(&u_instance);
+}
+END_TEST
+
+static long post_upload_file(const char * url, int spoof) {
+  CURL * curl;
+  curl_mime * form = NULL;
+  curl_mimepart * field = NULL;
+  long status = 0;
+
+  curl = curl_easy_init();
+  ck_assert_ptr_ne(curl, NULL);
+  form = curl_mime_init(curl);
+  field = curl_mime_addpart(form);
+  curl_mime_name(field, "key");
+  curl_mime_data(field, "value", CURL_ZERO_TERMINATED);
+  if (spoof) {
+    // Post parameters with the names of the values of the file, sent before the file
+    field = curl_mime_addpart(form);
+    curl_mime_name(field, "file");
+    curl_mime_data(field, "/etc/shadow", CURL_ZERO_TERMINATED);
+    field = curl_mime_addpart(form);
+    curl_mime_name(field, "file_sha256");
+    curl_mime_data(field, "spoof", CURL_ZERO_TERMINATED);
+  }
+  field = curl_mime_addpart(form);
+  curl_mime_name(field, "file");
+  curl_mime_filename(field, "image.png");
+  curl_mime_data(field, (const char *)large_binary_data, sizeof(large_binary_data));
+  field = curl_mime_addpart(form);
+  curl_mime_name(field, "file");
+  curl_mime_filename(field, "image2.png");
+  curl_mime_data(field, "abc", CURL_ZERO_TERMINATED);
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_MIMEPOST, form);
+  ck_assert_int_eq(curl_easy_perform(curl), CURLE_OK);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_cleanup(curl);
+  curl_mime_free(form);
+  return status;
+}
+
+START_TEST(test_ulfius_endpoint_upload_file_directory)
+{
+  struct _u_instance u_instance;
+  char directory[] = "/tmp/ulfius-upload-test-XXXXXX";
+  int daemon_mode;
+
+  ck_assert_ptr_ne(mkdtemp(directory), NULL);
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_ptr_eq(u_instance.upload_file_directory, NULL);
+  ck_assert_int_eq(u_instance.post_processor_buffer_size, ULFIUS_POSTBUFFERSIZE);
+  ck_assert_int_eq(ulfius_set_upload_file_directory(NULL, directory, 0, 0), U_ERROR_PARAMS);
+  ck_assert_int_eq(ulfius_set_upload_file_directory(&u_instance, directory, 0, 0x0100), U_ERROR_PARAMS);
+  ck_assert_int_eq(ulfius_set_upload_file_directory(&u_instance, directory, 4096, U_UPLOAD_FILE_DIRECT), U_OK);
+  ck_assert_str_eq(u_instance.upload_file_directory, directory);
+  // The file is received by small blocks
+  u_instance.post_processor_buffer_size = 1024;
+  u_instance.post_body_storage = U_POST_BODY_PARSED;
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "upload", NULL, 0, &callback_function_upload_file_directory, directory), U_OK);
+
+  for (daemon_mode=U_DAEMON_MODE_THREAD_PER_CONNECTION; daemon_mode<=U_DAEMON_MODE_THREAD_POOL; daemon_mode++) {
+    u_instance.daemon_mode = daemon_mode;
+    ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+    ck_assert_int_eq(post_upload_file("http://localhost:8080/upload", 0), 200);
+    ulfius_stop_framework(&u_instance);
+  }
+
+  ck_assert_int_eq(ulfius_set_upload_file_directory(&u_instance, NULL, 0, 0), U_OK);
+  ck_assert_ptr_eq(u_instance.upload_file_directory, NULL);
+  ulfius_clean_instance(&u_instance);
+  ck_assert_int_eq(remove(directory), 0);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_upload_file_directory_spoofed)
+{
+  struct _u_instance u_instance;
+  char directory[] = "/tmp/ulfius-upload-test-XXXXXX";
+  int daemon_mode;
+
+  ck_assert_ptr_ne(mkdtemp(directory), NULL);
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_set_upload_file_directory(&u_instance, directory, 0, 0), U_OK);
+  u_instance.post_body_storage = U_POST_BODY_PARSED;
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "upload", NULL, 0, &callback_function_upload_file_directory, directory), U_OK);
+
+  for (daemon_mode=U_DAEMON_MODE_THREAD_PER_CONNECTION; daemon_mode<=U_DAEMON_MODE_THREAD_POOL; daemon_mode++) {
+    u_instance.daemon_mode = daemon_mode;
+    ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+    // The post parameters file and file_sha256 don't change the values of the uploaded files
+    ck_assert_int_eq(post_upload_file("http://localhost:8080/upload", 1), 200);
+    ulfius_stop_framework(&u_instance);
+  }
+
+  ulfius_clean_instance(&u_instance);
+  ck_assert_int_eq(remove(directory), 0);
+}
+END_TEST
+
+START_TEST(test_ulfius_endpoint_upload_file_directory_removed)
+{
+  struct _u_instance u_instance;
+  char directory[] = "/tmp/ulfius-upload-test-XXXXXX";
+  int daemon_mode;
+
+  ck_assert_ptr_ne(mkdtemp(directory), NULL);
+  ck_assert_int_eq(ulfius_init_instance(&u_instance, 8080, NULL, NULL), U_OK);
+  ck_assert_int_eq(ulfius_set_upload_file_directory(&u_instance, directory, 0, 0), U_OK);
+  u_instance.post_body_storage = U_POST_BODY_PARSED;
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "error", NULL, 0, &callback_function_error, NULL), U_OK);
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&u_instance, "POST", "unauthorized", NULL, 0, &callback_function_unauthorized, NULL), U_OK);
+
+  for (daemon_mode=U_DAEMON_MODE_THREAD_PER_CONNECTION; daemon_mode<=U_DAEMON_MODE_THREAD_POOL; daemon_mode++) {
+    u_instance.daemon_mode = daemon_mode;
+    ck_assert_int_eq(ulfius_start_framework(&u_instance), U_OK);
+    // No file is written for an unknown url, the files of a request with an error are removed
+    ck_assert_int_eq(post_upload_file("http://localhost:8080/unknown", 0), 404);
+    ck_assert_int_eq(post_upload_file("http://localhost:8080/error", 0), 500);
+    ck_assert_int_eq(post_upload_file("http://localhost:8080/unauthorized", 0), 401);
+    ulfius_stop_framework(&u_instance);
+  }
+
+  // The requests are complete when the framework is stopped, the directory must be empty then
+  ulfius_clean_instance(&u_instance);
+  ck_assert_int_eq(remove(directory), 0);
+}
+END_TEST
+
 START_TEST(test_ulfius_endpoint_ignored)
 {
   struct _u_instance u_instance;
@@ -7118,12 +8221,30 @@ static Suite *ulfius_suite(void)
   tcase_add_test(tc_core, test_ulfius_endpoint_parameters);
   tcase_add_test(tc_core, test_ulfius_endpoint_injection);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple);
+  tcase_add_test(tc_core, test_ulfius_endpoint_router);
+  tcase_add_test(tc_core, test_ulfius_endpoint_remove_during_request);
+  tcase_add_test(tc_core, test_ulfius_endpoint_update_during_requests);
+  tcase_add_test(tc_core, test_ulfius_endpoint_url_params_chained);
+  tcase_add_test(tc_core, test_ulfius_endpoint_route_cache);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple_with_unauthorized);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple_with_error);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple_with_complete);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple_with_continue);
   tcase_add_test(tc_core, test_ulfius_endpoint_multiple_with_ignore);
   tcase_add_test(tc_core, test_ulfius_endpoint_stream);
+  tcase_add_test(tc_core, test_ulfius_endpoint_thread_pool);
+  tcase_add_test(tc_core, test_ulfius_endpoint_suspend);
+  tcase_add_test(tc_core, test_ulfius_endpoint_arena);
+  tcase_add_test(tc_core, test_ulfius_endpoint_response_body);
+  tcase_add_test(tc_core, test_ulfius_endpoint_pool);
+  tcase_add_test(tc_core, test_ulfius_endpoint_borrowed_maps);
+  tcase_add_test(tc_core, test_ulfius_endpoint_default_headers);
+  tcase_add_test(tc_core, test_ulfius_endpoint_body_stream);
+  tcase_add_test(tc_core, test_ulfius_endpoint_buffered_body);
+  tcase_add_test(tc_core, test_ulfius_endpoint_post_body_storage);
+  tcase_add_test(tc_core, test_ulfius_endpoint_upload_file_directory);
+  tcase_add_test(tc_core, test_ulfius_endpoint_upload_file_directory_spoofed);
+  tcase_add_test(tc_core, test_ulfius_endpoint_upload_file_directory_removed);
   tcase_add_test(tc_core, test_ulfius_endpoint_ignored);
   tcase_add_test(tc_core, test_ulfius_utf8_not_ignored);
   tcase_add_test(tc_core, test_ulfius_utf8_ignored);
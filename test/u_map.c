@@ -111,6 +111,25 @@ START_TEST(test_u_map_enum)
   ck_assert_ptr_ne(enum_keys, NULL);
   ck_assert_ptr_ne(enum_values, NULL);
   ck_assert_int_eq(u_map_count(&map), 4);
+  // Without removed values, the arrays of the map are returned
+  ck_assert_ptr_eq(enum_keys, (const char **)map.keys);
+  ck_assert_ptr_eq(enum_values, (const char **)map.values);
+  ck_assert_ptr_eq(u_map_enum_keys(NULL), NULL);
+  ck_assert_ptr_eq(u_map_enum_values(NULL), NULL);
+
+  // The removed values are skipped, the map isn't compacted
+  ck_assert_int_eq(u_map_remove_from_key(&map, "key2"), U_OK);
+  enum_keys = u_map_enum_keys(&map);
+  enum_values = u_map_enum_values(&map);
+  ck_assert_str_eq(enum_keys[1], "key3");
+  ck_assert_str_eq(enum_values[1], "value3");
+  ck_assert_ptr_eq(enum_keys[3], NULL);
+  ck_assert_ptr_eq(enum_values[3], NULL);
+  ck_assert_int_eq(map.nb_values, 4);
+  ck_assert_str_eq(map.keys[2], "key3");
+  // The arrays belong to the map, they're free'd by u_map_clean
+  ck_assert_ptr_eq(enum_keys, (const char **)map.enum_keys);
+  ck_assert_ptr_eq(u_map_enum_keys(&map), (const char **)map.enum_keys);
   u_map_clean(&map);
 }
 END_TEST
@@ -232,6 +251,461 @@ START_TEST(test_u_map_count)
 }
 END_TEST
 
+START_TEST(test_u_map_large)
+{
+  struct _u_map map;
+  const char ** keys;
+  char key[32], value[32];
+  int i;
+
+  u_map_init(&map);
+  for (i=0; i<200; i++) {
+    snprintf(key, sizeof(key), "Key-%d", i);
+    snprintf(value, sizeof(value), "value-%d", i);
+    ck_assert_int_eq(u_map_put(&map, key, value), U_OK);
+  }
+  ck_assert_int_eq(u_map_put(&map, "key-10", "lower"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "Key-20", "replaced"), U_OK);
+  ck_assert_int_eq(u_map_count(&map), 201);
+
+  // Insertion order is kept
+  keys = u_map_enum_keys(&map);
+  ck_assert_str_eq(keys[0], "Key-0");
+  ck_assert_str_eq(keys[199], "Key-199");
+  ck_assert_str_eq(keys[200], "key-10");
+  ck_assert_ptr_eq(keys[201], NULL);
+
+  ck_assert_str_eq(u_map_get(&map, "Key-150"), "value-150");
+  ck_assert_str_eq(u_map_get(&map, "Key-20"), "replaced");
+  ck_assert_str_eq(u_map_get(&map, "key-10"), "lower");
+  ck_assert_ptr_eq((void *)u_map_get(&map, "key-150"), NULL);
+  ck_assert_str_eq(u_map_get_case(&map, "KEY-150"), "value-150");
+  // The first key inserted is returned
+  ck_assert_str_eq(u_map_get_case(&map, "KEY-10"), "value-10");
+  ck_assert_int_eq(u_map_count_keys_case(&map, "KEY-10"), 2);
+  ck_assert_int_eq(u_map_has_key(&map, "Key-199"), 1);
+  ck_assert_int_eq(u_map_has_key(&map, "Key-200"), 0);
+  ck_assert_int_eq(u_map_has_key_case(&map, "kEY-199"), 1);
+
+  ck_assert_int_eq(u_map_remove_from_key(&map, "Key-10"), U_OK);
+  ck_assert_str_eq(u_map_get_case(&map, "KEY-10"), "lower");
+  ck_assert_int_eq(u_map_remove_at(&map, 0), U_OK);
+  ck_assert_ptr_eq((void *)u_map_get(&map, "Key-0"), NULL);
+  ck_assert_str_eq(u_map_get(&map, "Key-1"), "value-1");
+  ck_assert_str_eq(u_map_get(&map, "Key-199"), "value-199");
+  ck_assert_int_eq(u_map_remove_from_key_case(&map, "KEY-10"), U_OK);
+  ck_assert_int_eq(u_map_has_key_case(&map, "key-10"), 0);
+  ck_assert_int_eq(u_map_count(&map), 198);
+
+  ck_assert_int_eq(u_map_empty(&map), U_OK);
+  ck_assert_int_eq(u_map_count(&map), 0);
+  ck_assert_ptr_eq((void *)u_map_get(&map, "Key-1"), NULL);
+  ck_assert_int_eq(u_map_put(&map, "Key-1", "again"), U_OK);
+  ck_assert_str_eq(u_map_get_case(&map, "key-1"), "again");
+  u_map_clean(&map);
+}
+END_TEST
+
+START_TEST(test_u_map_inline)
+{
+  struct _u_map map, * copy;
+  char long_value[129];
+  int i;
+
+  memset(long_value, 'a', 128);
+  long_value[128] = '\0';
+  u_map_init(&map);
+  for (i=0; i<100; i++) {
+    ck_assert_int_eq(u_map_put(&map, "short", "value"), U_OK);
+    ck_assert_int_eq(u_map_put(&map, "long", long_value), U_OK);
+  }
+  ck_assert_str_eq(u_map_get(&map, "short"), "value");
+  ck_assert_str_eq(u_map_get(&map, "long"), long_value);
+
+  // A short value growing past the inline size
+  ck_assert_int_eq(u_map_put_binary(&map, "short", long_value, 5, 128), U_OK);
+  ck_assert_int_eq(u_map_get_length(&map, "short"), 133);
+  ck_assert_int_eq(o_strncmp(u_map_get(&map, "short"), "valueaaa", 8), 0);
+  ck_assert_int_eq(u_map_put_binary(&map, "long", "bb", 128, 2), U_OK);
+  ck_assert_int_eq(u_map_get_length(&map, "long"), 130);
+  ck_assert_str_eq(u_map_get(&map, "long")+126, "aabb");
+  ck_assert_int_eq(u_map_put(&map, "long", NULL), U_OK);
+  ck_assert_int_eq(u_map_get_length(&map, "long"), 0);
+
+  copy = u_map_copy(&map);
+  ck_assert_ptr_ne(copy, NULL);
+  ck_assert_int_eq(u_map_remove_from_key(&map, "short"), U_OK);
+  ck_assert_int_eq(u_map_get_length(copy, "short"), 133);
+  u_map_clean_full(copy);
+
+  for (i=0; i<3; i++) {
+    ck_assert_int_eq(u_map_empty(&map), U_OK);
+    ck_assert_int_eq(u_map_put(&map, "key", "value"), U_OK);
+    ck_assert_int_eq(u_map_put(&map, "long", long_value), U_OK);
+    ck_assert_str_eq(u_map_get(&map, "key"), "value");
+  }
+  u_map_clean(&map);
+}
+END_TEST
+
+START_TEST(test_u_map_known)
+{
+  struct _u_map map;
+  const char * names[] = {
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Access-Control-Allow-Origin",
+    "Access-Control-Request-Headers", "Access-Control-Request-Method", "Allow", "Authorization",
+    "Cache-Control", "Connection", "Content-Disposition", "Content-Encoding", "Content-Length",
+    "Content-Type", "Cookie", "Date", "ETag", "Expect", "Expires", "Forwarded", "Host", "If-Match",
+    "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since", "Keep-Alive", "Last-Modified",
+    "Location", "Origin", "Pragma", "Proxy-Authorization", "Range", "Referer", "Sec-WebSocket-Accept",
+    "Sec-WebSocket-Extensions", "Sec-WebSocket-Key", "Sec-WebSocket-Protocol", "Sec-WebSocket-Version",
+    "Server", "Set-Cookie", "TE", "Trailer", "Transfer-Encoding", "Upgrade", "User-Agent", "Vary", "Via",
+    "WWW-Authenticate", "X-Forwarded-For", "X-Forwarded-Host", "X-Forwarded-Proto", "X-Requested-With"
+  };
+  int i;
+
+  ck_assert_int_eq(sizeof(names)/sizeof(names[0]), U_HDR_COUNT);
+  u_map_init(&map);
+  ck_assert_ptr_eq((void *)u_map_get_known(&map, U_HDR_HOST), NULL);
+  ck_assert_int_eq(u_map_put(&map, "host", "localhost"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "Hostname", "other"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "HOST", "second"), U_OK);
+  ck_assert_str_eq(u_map_get_known(&map, U_HDR_HOST), "localhost");
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_HOST), 2);
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_CONTENT_TYPE), 0);
+  ck_assert_ptr_eq((void *)u_map_get_known(&map, U_HDR_COUNT), NULL);
+  ck_assert_ptr_eq((void *)u_map_get_known(NULL, U_HDR_HOST), NULL);
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_COUNT), 0);
+  ck_assert_int_eq(u_map_remove_from_key(&map, "host"), U_OK);
+  ck_assert_str_eq(u_map_get_known(&map, U_HDR_HOST), "second");
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_HOST), 1);
+  ck_assert_int_eq(u_map_empty(&map), U_OK);
+  ck_assert_ptr_eq((void *)u_map_get_known(&map, U_HDR_HOST), NULL);
+
+  // The map is indexed with all the known header names
+  for (i=0; i<U_HDR_COUNT; i++) {
+    ck_assert_int_eq(u_map_put(&map, names[i], names[i]), U_OK);
+  }
+  for (i=0; i<U_HDR_COUNT; i++) {
+    ck_assert_str_eq(u_map_get_known(&map, (u_known_header)i), names[i]);
+    ck_assert_int_eq(u_map_count_known(&map, (u_known_header)i), 1);
+  }
+  ck_assert_int_eq(u_map_put(&map, "content-type", "text/plain"), U_OK);
+  ck_assert_str_eq(u_map_get_known(&map, U_HDR_CONTENT_TYPE), "Content-Type");
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_CONTENT_TYPE), 2);
+  u_map_clean(&map);
+}
+END_TEST
+
+START_TEST(test_u_map_merge)
+{
+  struct _u_map source, dest;
+  char key[32];
+  int i;
+
+  u_map_init(&source);
+  u_map_init(&dest);
+  for (i=0; i<20; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    ck_assert_int_eq(u_map_put(&source, key, "source"), U_OK);
+  }
+  ck_assert_int_eq(u_map_merge(NULL, &source, U_MAP_MERGE_OVERWRITE), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_merge(&dest, NULL, U_MAP_MERGE_OVERWRITE), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_merge(&source, &source, U_MAP_MERGE_OVERWRITE), U_ERROR_PARAMS);
+
+  ck_assert_int_eq(u_map_put(&dest, "key1", "dest"), U_OK);
+  ck_assert_int_eq(u_map_put(&dest, "other", "dest"), U_OK);
+  ck_assert_int_eq(u_map_merge(&dest, &source, U_MAP_MERGE_SKIP_EXISTING), U_OK);
+  ck_assert_int_eq(u_map_count(&dest), 21);
+  ck_assert_str_eq(u_map_get(&dest, "key1"), "dest");
+  ck_assert_str_eq(u_map_get(&dest, "key19"), "source");
+  ck_assert_int_eq(u_map_merge(&dest, &source, U_MAP_MERGE_OVERWRITE), U_OK);
+  ck_assert_int_eq(u_map_count(&dest), 21);
+  ck_assert_str_eq(u_map_get(&dest, "key1"), "source");
+  ck_assert_str_eq(u_map_get(&dest, "other"), "dest");
+  u_map_clean(&dest);
+
+  // The borrowed values are copied before they're modified
+  u_map_init(&dest);
+  ck_assert_int_eq(u_map_merge(&dest, &source, U_MAP_MERGE_OVERWRITE|U_MAP_MERGE_BORROW), U_OK);
+  ck_assert_int_eq(u_map_count(&dest), 20);
+  ck_assert_ptr_eq(u_map_get(&dest, "key2"), u_map_get(&source, "key2"));
+  ck_assert_int_eq(u_map_put(&dest, "key2", "changed"), U_OK);
+  ck_assert_str_eq(u_map_get(&dest, "key2"), "changed");
+  ck_assert_str_eq(u_map_get(&source, "key2"), "source");
+  ck_assert_int_eq(u_map_put_binary(&dest, "key3", "-appended", 6, 10), U_OK);
+  ck_assert_str_eq(u_map_get(&dest, "key3"), "source-appended");
+  ck_assert_str_eq(u_map_get(&source, "key3"), "source");
+  ck_assert_int_eq(u_map_remove_from_key(&dest, "key4"), U_OK);
+  ck_assert_str_eq(u_map_get(&source, "key4"), "source");
+  u_map_clean(&dest);
+  ck_assert_str_eq(u_map_get(&source, "key5"), "source");
+  u_map_clean(&source);
+}
+END_TEST
+
+START_TEST(test_u_map_append)
+{
+  struct _u_map map;
+  const char chunk[] = "0123456";
+  const char * value;
+  size_t i;
+
+  u_map_init(&map);
+  // A value appended chunk by chunk at increasing offsets, the way a POST body is received
+  for (i=0; i<2000; i++) {
+    ck_assert_int_eq(u_map_put_binary(&map, "body", chunk, i*7, 7), U_OK);
+    ck_assert_int_eq(u_map_get_length(&map, "body"), (ssize_t)((i+1)*7));
+  }
+  value = u_map_get(&map, "body");
+  for (i=0; i<2000; i++) {
+    ck_assert_int_eq(memcmp(value+i*7, chunk, 7), 0);
+  }
+  ck_assert_int_eq(value[2000*7], '\0');
+
+  // Overwriting the beginning of the value keeps its length
+  ck_assert_int_eq(u_map_put_binary(&map, "body", "abc", 0, 3), U_OK);
+  ck_assert_int_eq(u_map_get_length(&map, "body"), 2000*7);
+  ck_assert_int_eq(memcmp(u_map_get(&map, "body"), "abc3456", 7), 0);
+
+  // The value can be emptied, then grow again
+  ck_assert_int_eq(u_map_put_binary(&map, "body", NULL, 0, 0), U_OK);
+  ck_assert_int_eq(u_map_get_length(&map, "body"), 0);
+  for (i=0; i<100; i++) {
+    ck_assert_int_eq(u_map_put_binary(&map, "body", chunk, i*7, 7), U_OK);
+  }
+  ck_assert_int_eq(u_map_get_length(&map, "body"), 100*7);
+  ck_assert_int_eq(memcmp(u_map_get(&map, "body")+99*7, chunk, 8), 0);
+  u_map_clean(&map);
+}
+END_TEST
+
+START_TEST(test_u_map_iter)
+{
+  struct _u_map map;
+  struct _u_map_iter iter;
+  char key[32];
+  int i, nb_values;
+
+  ck_assert_int_eq(u_map_iter_begin(NULL, &iter), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_iter_next(&iter), 0);
+  ck_assert_int_eq(u_map_iter_next(NULL), 0);
+
+  u_map_init(&map);
+  ck_assert_int_eq(u_map_iter_begin(&map, NULL), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_iter_begin(&map, &iter), U_OK);
+  ck_assert_int_eq(u_map_iter_next(&iter), 0);
+  for (i=0; i<40; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    ck_assert_int_eq(u_map_put(&map, key, key), U_OK);
+  }
+  ck_assert_int_eq(u_map_put(&map, "empty", NULL), U_OK);
+  ck_assert_int_eq(u_map_put_binary(&map, "binary", "a\0b", 0, 3), U_OK);
+  for (i=0; i<40; i+=3) {
+    snprintf(key, sizeof(key), "key%d", i);
+    ck_assert_int_eq(u_map_remove_from_key(&map, key), U_OK);
+  }
+  nb_values = map.nb_values;
+
+  // The removed values are skipped in the order the values were added
+  u_map_iter_begin(&map, &iter);
+  for (i=0; i<40; i++) {
+    if (i%3) {
+      snprintf(key, sizeof(key), "key%d", i);
+      ck_assert_int_eq(u_map_iter_next(&iter), 1);
+      ck_assert_str_eq(iter.key, key);
+      ck_assert_str_eq(iter.value, key);
+      ck_assert_int_eq(iter.length, o_strlen(key)+1);
+    }
+  }
+  ck_assert_int_eq(u_map_iter_next(&iter), 1);
+  ck_assert_str_eq(iter.key, "empty");
+  ck_assert_ptr_eq((void *)iter.value, NULL);
+  ck_assert_int_eq(iter.length, 0);
+  ck_assert_int_eq(u_map_iter_next(&iter), 1);
+  ck_assert_str_eq(iter.key, "binary");
+  ck_assert_int_eq(memcmp(iter.value, "a\0b", 3), 0);
+  ck_assert_int_eq(iter.length, 3);
+  ck_assert_int_eq(u_map_iter_next(&iter), 0);
+  ck_assert_ptr_eq((void *)iter.key, NULL);
+  ck_assert_int_eq(u_map_iter_next(&iter), 0);
+  // The map isn't compacted by the iterator
+  ck_assert_int_eq(map.nb_values, nb_values);
+  u_map_clean(&map);
+}
+END_TEST
+
+START_TEST(test_u_map_base)
+{
+  struct _u_map base, map, * copy;
+  struct _u_map_iter iter;
+  const char ** keys;
+
+  u_map_init(&base);
+  u_map_init(&map);
+  ck_assert_int_eq(u_map_put(&base, "Server", "ulfius"), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "Content-Type", "text/plain"), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "X-Removed", "removed"), U_OK);
+  ck_assert_int_eq(u_map_remove_from_key(&base, "X-Removed"), U_OK);
+
+  // Only a frozen map can be used as a base, a frozen map can't be modified
+  ck_assert_int_eq(u_map_set_base(&map, &base), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_freeze(&base), U_OK);
+  ck_assert_int_eq(u_map_freeze(NULL), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_put(&base, "key", "value"), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_put_binary(&base, "Server", "x", 0, 1), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_remove_from_key(&base, "Server"), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_merge(&base, &map, U_MAP_MERGE_OVERWRITE), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_empty(&base), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_count(&base), 2);
+  ck_assert_int_eq(u_map_set_base(&map, &map), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_set_base(&map, &base), U_OK);
+
+  // The values of the base are visible until they're overridden
+  ck_assert_int_eq(u_map_count(&map), 2);
+  ck_assert_str_eq(u_map_get(&map, "Server"), "ulfius");
+  ck_assert_str_eq(u_map_get_case(&map, "content-type"), "text/plain");
+  ck_assert_str_eq(u_map_get_known(&map, U_HDR_CONTENT_TYPE), "text/plain");
+  ck_assert_int_eq(u_map_has_key(&map, "Server"), 1);
+  ck_assert_int_eq(u_map_has_key(&map, "X-Removed"), 0);
+  ck_assert_int_eq(u_map_put(&map, "Content-Type", "application/json"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "X-Key", "value"), U_OK);
+  ck_assert_int_eq(u_map_count(&map), 3);
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_CONTENT_TYPE), 1);
+  ck_assert_str_eq(u_map_get(&map, "Content-Type"), "application/json");
+  ck_assert_str_eq(u_map_get(&base, "Content-Type"), "text/plain");
+  ck_assert_int_eq(u_map_put_binary(&map, "Server", "/2", 6, 3), U_OK);
+  ck_assert_str_eq(u_map_get(&map, "Server"), "ulfius/2");
+  ck_assert_str_eq(u_map_get(&base, "Server"), "ulfius");
+
+  // The values of the base that aren't overridden come first
+  ck_assert_int_eq(u_map_put(&map, "Server", "ulfius"), U_OK);
+  ck_assert_int_eq(u_map_set_base(&map, NULL), U_OK);
+  ck_assert_int_eq(u_map_count(&map), 3);
+  ck_assert_int_eq(u_map_set_base(&map, &base), U_OK);
+  ck_assert_int_eq(u_map_remove_from_key(&map, "Server"), U_OK);
+  u_map_iter_begin(&map, &iter);
+  ck_assert_int_eq(u_map_iter_next(&iter), 1);
+  ck_assert_str_eq(iter.key, "Content-Type");
+  ck_assert_str_eq(iter.value, "application/json");
+  ck_assert_int_eq(u_map_iter_next(&iter), 1);
+  ck_assert_str_eq(iter.key, "X-Key");
+  ck_assert_int_eq(u_map_iter_next(&iter), 0);
+
+  // A copy has its own values
+  u_map_empty(&map);
+  ck_assert_int_eq(u_map_set_base(&map, &base), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "X-Key", "value"), U_OK);
+  copy = u_map_copy(&map);
+  ck_assert_int_eq(u_map_count(copy), 3);
+  ck_assert_int_eq(u_map_put(copy, "Server", "copy"), U_OK);
+  u_map_clean_full(copy);
+  keys = u_map_enum_keys(&map);
+  ck_assert_str_eq(keys[0], "Server");
+  ck_assert_str_eq(keys[1], "Content-Type");
+  ck_assert_str_eq(keys[2], "X-Key");
+  ck_assert_ptr_eq((void *)keys[3], NULL);
+  // The base isn't detached by the enum
+  ck_assert_ptr_eq(map.base, &base);
+  ck_assert_int_eq(u_map_count(&map), 3);
+
+  u_map_clean(&map);
+  ck_assert_int_eq(u_map_unfreeze(&base), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "key", "value"), U_OK);
+  u_map_clean(&base);
+}
+END_TEST
+
+START_TEST(test_u_map_base_detach)
+{
+  struct _u_map base, map, other;
+
+  u_map_init(&base);
+  u_map_init(&map);
+  u_map_init(&other);
+  ck_assert_int_eq(u_map_put(&base, "Server", "ulfius"), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "Content-Type", "text/plain"), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "X-Removed", "removed"), U_OK);
+  ck_assert_int_eq(u_map_freeze(&base), U_OK);
+  ck_assert_int_eq(u_map_set_base(&map, &base), U_OK);
+  ck_assert_int_eq(u_map_set_base(&other, &base), U_OK);
+
+  // map is detached by a removal, other overrides a value of the base then removes the base
+  ck_assert_int_eq(u_map_remove_from_key(&map, "X-Removed"), U_OK);
+  ck_assert_ptr_eq(map.base, NULL);
+  ck_assert_int_eq(u_map_put(&other, "Server", "other"), U_OK);
+  ck_assert_int_eq(u_map_set_base(&other, NULL), U_OK);
+
+  // The base is modified then free'd, the maps don't reference its keys or values
+  ck_assert_int_eq(u_map_unfreeze(&base), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "Server", "modified"), U_OK);
+  ck_assert_int_eq(u_map_put(&base, "Content-Type", "modified"), U_OK);
+  u_map_clean(&base);
+  ck_assert_int_eq(u_map_count(&map), 2);
+  ck_assert_str_eq(u_map_get(&map, "Server"), "ulfius");
+  ck_assert_str_eq(u_map_get_known(&map, U_HDR_CONTENT_TYPE), "text/plain");
+  ck_assert_int_eq(u_map_has_key(&map, "X-Removed"), 0);
+  ck_assert_int_eq(u_map_count(&other), 1);
+  ck_assert_str_eq(u_map_get(&other, "Server"), "other");
+  ck_assert_int_eq(u_map_put(&map, "Server", "ulfius/2"), U_OK);
+  ck_assert_str_eq(u_map_get(&map, "Server"), "ulfius/2");
+
+  u_map_clean(&map);
+  u_map_clean(&other);
+}
+END_TEST
+
+START_TEST(test_u_map_remove_keys)
+{
+  struct _u_map map;
+  const char * hop_by_hop[] = {"connection", "keep-alive", "te", "trailer", "transfer-encoding", "upgrade", NULL};
+  const char * none[] = {"none", NULL};
+  const char ** keys;
+  char key[32];
+  int i;
+
+  u_map_init(&map);
+  ck_assert_int_eq(u_map_remove_keys(NULL, none), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_remove_keys(&map, NULL), U_ERROR_PARAMS);
+  ck_assert_int_eq(u_map_remove_keys(&map, none), U_ERROR_NOT_FOUND);
+  for (i=0; i<10; i++) {
+    snprintf(key, sizeof(key), "X-Key-%d", i);
+    ck_assert_int_eq(u_map_put(&map, key, "value"), U_OK);
+  }
+  ck_assert_int_eq(u_map_put(&map, "Connection", "keep-alive"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "Keep-Alive", "timeout=5"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "Host", "localhost"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "TE", "trailers"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "Upgrade", "websocket"), U_OK);
+  ck_assert_int_eq(u_map_put(&map, "upgrade", "h2c"), U_OK);
+  ck_assert_int_eq(u_map_remove_keys(&map, hop_by_hop), U_OK);
+  ck_assert_int_eq(u_map_count(&map), 15);
+  ck_assert_ptr_eq((void *)u_map_get(&map, "upgrade"), NULL);
+  ck_assert_str_eq(u_map_get(&map, "Upgrade"), "websocket");
+  ck_assert_int_eq(u_map_remove_keys_case(&map, hop_by_hop), U_OK);
+  ck_assert_int_eq(u_map_remove_keys_case(&map, hop_by_hop), U_ERROR_NOT_FOUND);
+  ck_assert_int_eq(u_map_count(&map), 11);
+  ck_assert_int_eq(u_map_has_key_case(&map, "connection"), 0);
+  ck_assert_str_eq(u_map_get_case(&map, "host"), "localhost");
+  ck_assert_int_eq(u_map_count_known(&map, U_HDR_UPGRADE), 0);
+
+  // The values left keep their order
+  ck_assert_int_eq(u_map_remove_from_key(&map, "X-Key-3"), U_OK);
+  ck_assert_int_eq(u_map_remove_at(&map, 0), U_OK);
+  ck_assert_int_eq(u_map_remove_at(&map, 9), U_ERROR_NOT_FOUND);
+  keys = u_map_enum_keys(&map);
+  ck_assert_str_eq(keys[0], "X-Key-1");
+  ck_assert_str_eq(keys[1], "X-Key-2");
+  ck_assert_str_eq(keys[2], "X-Key-4");
+  ck_assert_str_eq(keys[8], "Host");
+  ck_assert_ptr_eq(keys[9], NULL);
+  ck_assert_int_eq(u_map_put(&map, "X-Key-3", "again"), U_OK);
+  ck_assert_str_eq(u_map_enum_keys(&map)[9], "X-Key-3");
+  ck_assert_int_eq(u_map_count(&map), 10);
+  u_map_clean(&map);
+}
+END_TEST
+
 static Suite *ulfius_suite(void)
 {
 	Suite *s;
@@ -249,6 +723,15 @@ static Suite *ulfius_suite(void)
 	tcase_add_test(tc_core, test_u_map_copy_empty);
 	tcase_add_test(tc_core, test_u_map_copy);
 	tcase_add_test(tc_core, test_u_map_count);
+	tcase_add_test(tc_core, test_u_map_large);
+	tcase_add_test(tc_core, test_u_map_inline);
+	tcase_add_test(tc_core, test_u_map_known);
+	tcase_add_test(tc_core, test_u_map_merge);
+	tcase_add_test(tc_core, test_u_map_remove_keys);
+	tcase_add_test(tc_core, test_u_map_append);
+	tcase_add_test(tc_core, test_u_map_iter);
+	tcase_add_test(tc_core, test_u_map_base);
+	tcase_add_test(tc_core, test_u_map_base_detach);
 	tcase_set_timeout(tc_core, 30);
 	suite_add_tcase(s, tc_core);
 
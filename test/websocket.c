@@ -915,6 +915,39 @@ START_TEST(test_ulfius_websocket_client)
 }
 END_TEST
 
+START_TEST(test_ulfius_websocket_client_thread_pool)
+{
+  struct _u_instance instance;
+  struct _u_request request;
+  struct _u_response response;
+  struct _websocket_client_handler websocket_client_handler = {NULL, NULL};
+  char url[64], * allocated_data = o_strdup("plop");
+
+  ck_assert_int_eq(ulfius_init_instance(&instance, PORT_1, NULL, NULL), U_OK);
+  instance.daemon_mode = U_DAEMON_MODE_THREAD_POOL;
+  instance.thread_pool_size = 2;
+  ck_assert_int_eq(ulfius_add_endpoint_by_val(&instance, "GET", PREFIX_WEBSOCKET, NULL, 0, &callback_websocket, allocated_data), U_OK);
+  ck_assert_int_eq(ulfius_start_framework(&instance), U_OK);
+
+  ulfius_init_request(&request);
+  ulfius_init_response(&response);
+  sprintf(url, "ws://localhost:%d/%s", PORT_1, PREFIX_WEBSOCKET);
+  
+  // Test correct websocket connection on a websocket service using a thread pool
+  ck_assert_int_eq(ulfius_set_websocket_request(&request, url, DEFAULT_PROTOCOL, DEFAULT_EXTENSION), U_OK);
+  ck_assert_int_eq(ulfius_open_websocket_client_connection(&request, &websocket_manager_callback_client, NULL, &websocket_incoming_message_callback_client, NULL, websocket_onclose_callback_client, allocated_data, &websocket_client_handler, &response), U_OK);
+  ck_assert_int_eq(ulfius_websocket_client_connection_wait_close(&websocket_client_handler, 0), U_WEBSOCKET_STATUS_CLOSE);
+  ulfius_clean_request(&request);
+  ulfius_clean_response(&response);
+  
+  usleep(50);
+  ck_assert_int_eq(ulfius_stop_framework(&instance), U_OK);
+
+  ulfius_clean_instance(&instance);
+  o_free(allocated_data);
+}
+END_TEST
+
 START_TEST(test_ulfius_websocket_client_no_onclose)
 {
   struct _u_instance instance;
@@ -1292,6 +1325,7 @@ static Suite *ulfius_suite(void)
 	tcase_add_test(tc_websocket, test_ulfius_websocket_set_websocket_request);
 	tcase_add_test(tc_websocket, test_ulfius_websocket_open_websocket_client_connection_error);
 	tcase_add_test(tc_websocket, test_ulfius_websocket_client);
+	tcase_add_test(tc_websocket, test_ulfius_websocket_client_thread_pool);
 	tcase_add_test(tc_websocket, test_ulfius_websocket_client_no_onclose);
 	tcase_add_test(tc_websocket, test_ulfius_websocket_extension_no_match_function);
 	tcase_add_test(tc_websocket, test_ulfius_websocket_extension_match_function);